@@ -5,8 +5,15 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
 #include "btree.h"
 #include "filescan.h"
+#include "node_search.h"
+#include "exceptions/badgerdb_exception.h"
+#include "exceptions/end_of_file_exception.h"
 #include "exceptions/bad_index_info_exception.h"
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/bad_scanrange_exception.h"
@@ -14,9 +21,7 @@
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
-#include "exceptions/end_of_file_exception.h"
-#include "exceptions/hash_not_found_exception.h"
-#include "exceptions/page_not_pinned_exception.h"
+#include "exceptions/index_read_only_exception.h"
 
 
 //#define DEBUG
@@ -24,6 +29,46 @@
 namespace badgerdb
 {
 
+// -----------------------------------------------------------------------------
+// Key helpers
+// -----------------------------------------------------------------------------
+
+// Copy the key that an insert, a scan bound or a record points to into a key of type T.
+template <class T>
+static void readKey(const void* ptr, T& key)
+{
+	memcpy(&key, ptr, sizeof(T));
+}
+
+// STRING keys are character strings of any length up to STRINGSIZE; the key is zero padded.
+static void readKey(const void* ptr, StringKey& key)
+{
+	key.set((const char*)ptr);
+}
+
+// Separator between two neighbouring leaves: the last key of the left one, or for STRING keys the
+// shortest key that tells the two apart.
+template <class T>
+static T leafSeparator(const T& left, const T&)
+{
+	return left;
+}
+
+static StringKey leafSeparator(const StringKey& left, const StringKey& right)
+{
+	return shortestSeparator(left, right);
+}
+
+template <> int& IndexCursor::lowVal<int>() { return lowValInt; }
+template <> int& IndexCursor::highVal<int>() { return highValInt; }
+template <> double& IndexCursor::lowVal<double>() { return lowValDouble; }
+template <> double& IndexCursor::highVal<double>() { return highValDouble; }
+template <> StringKey& IndexCursor::lowVal<StringKey>() { return lowValString; }
+template <> StringKey& IndexCursor::highVal<StringKey>() { return highValString; }
+template <> int& IndexCursor::lastKey<int>() { return lastKeyInt; }
+template <> double& IndexCursor::lastKey<double>() { return lastKeyDouble; }
+template <> StringKey& IndexCursor::lastKey<StringKey>() { return lastKeyString; }
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::BTreeIndex -- Constructor
 // -----------------------------------------------------------------------------
@@ -32,7 +77,11 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		std::string & outIndexName,
 		BufMgr *bufMgrIn,
 		const int attrByteOffset,
-		const Datatype attrType)
+		const Datatype attrType,
+		const double fillFactor,
+		const bool mapped,
+		const unsigned buildThreads)
+	: scan(this)
 {
 	std::ostringstream idxStr;
 	idxStr<<relationName<<'.'<< attrByteOffset;
@@ -41,48 +90,237 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 	bufMgr = bufMgrIn;
 	this->attrByteOffset = attrByteOffset;
 	this->attributeType = attrType;
+	this->mapped = mapped;
 	if ( File::exists(indexName) ) {
 		file = new BlobFile(outIndexName,false);
 		Page* metaPage;
-		bufMgr->readPage(file,file->getFirstPageNo(),metaPage);
-		bufMgr->unPinPage(file,file->getFirstPageNo(),false);
+		headerPageNum = file->getFirstPageNo();
+		bufMgr->readPage(file,headerPageNum,metaPage);
 		IndexMetaInfo* meta = reinterpret_cast<IndexMetaInfo*>(metaPage);
 		this->rootPageNum = meta->rootPageNo;
+		const bool matches = std::string(meta->relationName) == relationName.substr(0, sizeof(meta->relationName) - 1)
+			&& meta->attrByteOffset == attrByteOffset && meta->attrType == attrType;
+		bufMgr->unPinPage(file,headerPageNum,false);
+		if (!matches) {
+			bufMgr->flushFile(file);
+			delete file;
+			throw BadIndexInfoException("meta page of " + indexName + " does not match the index parameters");
+		}
 	}
 	else 
 		{
+			if (!(fillFactor > 0 && fillFactor <= 1))
+				throw BadIndexInfoException("fill factor must be in (0, 1]");
 			file = new BlobFile(indexName,true);
-			Page *metaPage,*rootPage;
+			Page *metaPage;
 			bufMgr->allocPage(file, headerPageNum, metaPage);
-			bufMgr->allocPage(file, rootPageNum, rootPage);
-			NonLeafNodeInt* root = reinterpret_cast<NonLeafNodeInt*>(rootPage);
-			*root = NonLeafNodeInt();
-			root->level = 1;
-			bufMgr->unPinPage(file,rootPageNum,true);
-			FileScan fs(relationName,bufMgr);
-			try
-			{
-				RecordId scanRid;
-				while(1)
-				{
-					fs.scanNext(scanRid);
-					std::string recordStr = fs.getRecord();
-					const char *record = recordStr.c_str();
-					void* key = (void*)(record + attrByteOffset);
-					insertEntry(key,scanRid);
-				}
-			}
-			catch(EndOfFileException e)
-			{
-			}
+
+			if (attrType == INTEGER)
+				buildIndex<int>(relationName, indexName, fillFactor, buildThreads);
+			else if (attrType == DOUBLE)
+				buildIndex<double>(relationName, indexName, fillFactor, buildThreads);
+			else
+				buildIndex<StringKey>(relationName, indexName, fillFactor, buildThreads);
+
 			IndexMetaInfo* meta = reinterpret_cast<IndexMetaInfo*>(metaPage);
-			strcpy(meta->relationName,relationName.c_str());
+			strncpy(meta->relationName, relationName.c_str(), sizeof(meta->relationName) - 1);
+			meta->relationName[sizeof(meta->relationName) - 1] = '\0';
 			meta->attrByteOffset = attrByteOffset;
 			meta->attrType = attrType;
 			meta->rootPageNo = rootPageNum;
 			bufMgr->unPinPage(file,headerPageNum,true);
 		}
-	
+
+	if (mapped) {
+		// Write the nodes out and drop them from the pool; from here on they are read from the mapping.
+		bufMgr->flushFile(file);
+		file->map();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::buildIndex
+// -----------------------------------------------------------------------------
+
+template <class T>
+void BTreeIndex::buildIndex(const std::string & relationName, const std::string & indexName, const double fillFactor,
+                            const unsigned buildThreads)
+{
+	// The threads take morsels of the relation from one shared scan, so none sits idle while another still
+	// has pages left. Its destructor flushes the pages of the relation from the pool once the threads are done.
+	ParallelFileScan relation(relationName, bufMgr);
+	std::size_t numThreads = buildThreads > 0 ? buildThreads : std::max(1u, std::thread::hardware_concurrency());
+	numThreads = std::max<std::size_t>(1, std::min(numThreads, relation.pageCount()));
+
+	// Every thread collects and sorts the entries of its morsels. Their runs together hold as many pairs as
+	// fit in the buffer pool.
+	const std::size_t runCapacity = (std::size_t)bufMgr->getNumBufs() * Page::SIZE / sizeof(RIDKeyPair<T>) / numThreads;
+	// The sorters remove their run files when they are destroyed, also if the build throws.
+	std::vector< std::unique_ptr< ExternalSorter< RIDKeyPair<T> > > > sorterOwners;
+	std::vector< ExternalSorter< RIDKeyPair<T> >* > sorters;
+	for (std::size_t t = 0; t < numThreads; t++) {
+		std::ostringstream runPrefix;
+		runPrefix << indexName << ".run." << t;
+		sorterOwners.push_back(std::unique_ptr< ExternalSorter< RIDKeyPair<T> > >(
+				new ExternalSorter< RIDKeyPair<T> >(runPrefix.str(), runCapacity)));
+		sorters.push_back(sorterOwners.back().get());
+	}
+	std::vector<std::exception_ptr> errors(numThreads);
+	auto sortMorsels = [&](const std::size_t t) {
+		try {
+			FileScanWorker scan(&relation);
+			collectEntries<T>(scan, *sorters[t]);
+			sorters[t]->sort();
+		}
+		catch (...) {
+			errors[t] = std::current_exception();
+		}
+	};
+	std::vector<std::thread> threads;
+	for (std::size_t t = 1; t < numThreads; t++)
+		threads.push_back(std::thread(sortMorsels, t));
+	sortMorsels(0);
+	for (std::size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+
+	for (std::size_t t = 0; t < numThreads; t++) {
+		if (errors[t])
+			std::rethrow_exception(errors[t]);
+	}
+
+	SortedMerge< RIDKeyPair<T> > entries(sorters);
+
+	if (entries.size() == 0) {
+		typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+		Page *rootPage;
+		PageId rootPageNo;
+		bufMgr->allocPage(file, rootPageNo, rootPage);
+		NonLeaf* root = reinterpret_cast<NonLeaf*>(rootPage);
+		*root = NonLeaf();
+		root->level = 1;
+		bufMgr->unPinPage(file,rootPageNo,true);
+		rootPageNum = rootPageNo;
+	}
+	else
+		bulkLoad<T>(entries, fillFactor);
+}
+
+template <class T>
+void BTreeIndex::collectEntries(FileScanWorker& scan, ExternalSorter< RIDKeyPair<T> >& sorter)
+{
+	RIDKeyPair<T> entry;
+	try
+	{
+		while(1)
+		{
+			scan.scanNext(entry.rid);
+			readKey(scan.getRecordView().data() + attrByteOffset, entry.key);
+			sorter.add(entry);
+		}
+	}
+	catch(const EndOfFileException&)
+	{
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::bulkLoad
+// -----------------------------------------------------------------------------
+
+template <class T>
+void BTreeIndex::bulkLoad(SortedMerge< RIDKeyPair<T> >& entries, const double fillFactor)
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	// (page, separator on its left) of every node in the level being built, left to right.
+	// The key of the first node is unused.
+	std::vector< PageKeyPair<T> > level;
+	PageKeyPair<T> node;
+
+	// Fill each leaf up to fillFactor, then start the next one. Once the first key of the next leaf is
+	// known, the separator between the two bounds the key range of the finished leaf, which can be compressed.
+	Page* page;
+	bufMgr->allocPage(file, node.pageNo, page);
+	Leaf* leaf = reinterpret_cast<Leaf*>(page);
+	*leaf = Leaf();
+	RIDKeyPair<T> entry;
+	bool more = entries.next(entry);
+	while (more)
+	{
+		if (!leaf->canAppend(entry.key, fillFactor)) {
+			const T sep = leafSeparator(leaf->key(leaf->k - 1), entry.key);
+			Page* nextPage;
+			PageId nextPageNo;
+			bufMgr->allocPage(file, nextPageNo, nextPage);
+			leaf->rightSibPageNo = nextPageNo;
+			leaf->highKey = sep;
+			leaf->compress(level.empty() ? NULL : &node.key, &sep);
+			bufMgr->unPinPage(file, node.pageNo, true);
+			level.push_back(node);
+			node.set(nextPageNo, sep);
+			leaf = reinterpret_cast<Leaf*>(nextPage);
+			*leaf = Leaf();
+		}
+		leaf->insert(leaf->k, entry.key, entry.rid);
+		more = entries.next(entry);
+	}
+
+	// The root is always a non-leaf over at least two leaves: add an empty one if everything fit in one.
+	if (level.empty()) {
+		const T sep = leaf->key(leaf->k - 1);
+		Page* nextPage;
+		PageId nextPageNo;
+		bufMgr->allocPage(file, nextPageNo, nextPage);
+		*reinterpret_cast<Leaf*>(nextPage) = Leaf();
+		leaf->rightSibPageNo = nextPageNo;
+		leaf->highKey = sep;
+		bufMgr->unPinPage(file, node.pageNo, true);
+		level.push_back(node);
+		node.set(nextPageNo, sep);
+	}
+	else
+		leaf->compress(&node.key, NULL);
+	bufMgr->unPinPage(file, node.pageNo, true);
+	level.push_back(node);
+
+	// Build non-leaf levels the same way until a single node, the root, is left. Nodes directly above the
+	// leaves have level 1. The separator left of the first child of a node moves up to the next level, and
+	// is the high key of the node before it.
+	int nodeLevel = 1;
+	while (level.size() > 1)
+	{
+		std::vector< PageKeyPair<T> > parents;
+		node.pageNo = Page::INVALID_NUMBER;
+		NonLeaf* nonLeaf = NULL;
+		for (std::size_t i = 0; i < level.size(); i++)
+		{
+			if (nonLeaf != NULL && nonLeaf->canAppend(level[i].key, fillFactor)) {
+				nonLeaf->insert(nonLeaf->k, level[i].key, level[i].pageNo);
+				continue;
+			}
+			PageId pageNo;
+			bufMgr->allocPage(file, pageNo, page);
+			if (nonLeaf != NULL) {
+				nonLeaf->rightSibPageNo = pageNo;
+				nonLeaf->highKey = level[i].key;
+				nonLeaf->compress(parents.empty() ? NULL : &node.key, &level[i].key);
+				bufMgr->unPinPage(file, node.pageNo, true);
+				parents.push_back(node);
+			}
+			node.set(pageNo, level[i].key);
+			nonLeaf = reinterpret_cast<NonLeaf*>(page);
+			*nonLeaf = NonLeaf();
+			nonLeaf->level = nodeLevel;
+			nonLeaf->setFirstChild(level[i].pageNo);
+		}
+		nonLeaf->compress(parents.empty() ? NULL : &node.key, NULL);
+		bufMgr->unPinPage(file, node.pageNo, true);
+		parents.push_back(node);
+		level.swap(parents);
+		nodeLevel = 0;
+	}
+	rootPageNum = level[0].pageNo;
 }
 
 
@@ -92,7 +330,15 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 
 BTreeIndex::~BTreeIndex()
 {
-	bufMgr->flushFile(file);
+	try
+	{
+		if (scan.isScanning())
+			scan.endScan();
+		bufMgr->flushFile(file);
+	}
+	catch(const BadgerDbException&)
+	{
+	}
 	delete file;
 }
 
@@ -102,52 +348,591 @@ BTreeIndex::~BTreeIndex()
 
 const void BTreeIndex::insertEntry(const void *key, const RecordId rid) 
 {
-	int val = *((int*)(key));
-	Page* rpg;
-	bufMgr->readPage(file,rootPageNum,rpg);
-	bufMgr->unPinPage(file,rootPageNum,true);
-	NonLeafNodeInt* root = reinterpret_cast<NonLeafNodeInt*>(rpg);
-	if (root->k == 0){
-		root->k++;
-		Page* nPage;
-		PageId pid;
-		Page* nlPage;
-		PageId lpid;
-		bufMgr->allocPage(file,lpid,nlPage);
-		bufMgr->allocPage(file, pid , nPage);
-		bufMgr->unPinPage(file,pid,true);
-		bufMgr->unPinPage(file,lpid,true);
-		root->keyArray[0]=val;
-		root->pageNoArray[0]= lpid;
-		root->pageNoArray[1]= pid;
-		LeafNodeInt* lni;
-		LeafNodeInt* llni;
-		llni = reinterpret_cast<LeafNodeInt*>(nlPage);
-		llni->k=0;
-		llni->rightSibPageNo =pid;
-		lni = reinterpret_cast<LeafNodeInt*>(nPage);
-		lni->k=1;
-		lni->keyArray[0]=val;
-		lni->ridArray[0]=rid;
-	}
-	else if (root->k == INTARRAYNONLEAFSIZE){
-		Page* newRoot;
-		PageId temp;
-		temp = rootPageNum ;
-		bufMgr->allocPage(file,rootPageNum,newRoot);
-		bufMgr->unPinPage(file,rootPageNum,true);
-		NonLeafNodeInt* nRoot = reinterpret_cast<NonLeafNodeInt*>(newRoot);
-		*nRoot = NonLeafNodeInt();
-		nRoot->pageNoArray[0]= temp;
-		splitChildren(nRoot,0);	
-		insertNonFull(nRoot,val,rid);
+	if (mapped)
+		throw IndexReadOnlyException(file->filename());
+
+	if (attributeType == INTEGER) {
+		int val;
+		readKey(key, val);
+		insertKey<int>(val, rid);
+	} else if (attributeType == DOUBLE) {
+		double val;
+		readKey(key, val);
+		insertKey<double>(val, rid);
+	} else {
+		StringKey val;
+		readKey(key, val);
+		insertKey<StringKey>(val, rid);
+	}
+}
+
+template <class T>
+void BTreeIndex::insertKey(const T& key, const RecordId rid)
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	// The root latch is held until the root is sure not to split, so the root page cannot change under us.
+	// Below the root, the latch of a node is held until its child cannot split, so an insert never needs to
+	// move right as readers do.
+	rootLatch.lockExclusive();
+	const PageId rootNo = rootPageNum;
+	Page* rootPage;
+	try {
+		rootPage = writeNode(rootNo);
+	}
+	catch (...) {
+		rootLatch.unlockExclusive();
+		throw;
+	}
+	NonLeaf* root = reinterpret_cast<NonLeaf*>(rootPage);
+	if (root->child(0) == Page::INVALID_NUMBER){
+		// First entry of an empty tree: an empty left leaf and a right leaf holding the entry.
+		// If a page cannot be had, what was taken so far is given back and the tree stays empty.
+		Page* leftPage;
+		PageId leftPageNo = Page::INVALID_NUMBER;
+		Page* rightPage;
+		PageId rightPageNo;
+		try {
+			bufMgr->allocPage(file,leftPageNo,leftPage);
+			bufMgr->allocPage(file,rightPageNo,rightPage);
+		}
+		catch (...) {
+			if (leftPageNo != Page::INVALID_NUMBER) {
+				bufMgr->unPinPage(file,leftPageNo,false);
+				bufMgr->disposePage(file,leftPageNo);
+			}
+			releaseWrite(rootNo,rootPage,false);
+			rootLatch.unlockExclusive();
+			throw;
+		}
+		Leaf* left = reinterpret_cast<Leaf*>(leftPage);
+		*left = Leaf();
+		left->rightSibPageNo = rightPageNo;
+		left->highKey = key;
+		Leaf* right = reinterpret_cast<Leaf*>(rightPage);
+		*right = Leaf();
+		right->insert(0, key, rid);
+		root->setFirstChild(leftPageNo);
+		root->insert(0, key, rightPageNo);
+		bufMgr->unPinPage(file,leftPageNo,true);
+		bufMgr->unPinPage(file,rightPageNo,true);
+		releaseWrite(rootNo,rootPage,true);
+		rootLatch.unlockExclusive();
+	}
+	else if (root->isFull()){
+		// Root is full: grow the tree by one level and split the old root under the new one. The meta page is
+		// pinned first, so once the old root is split nothing is left that can fail before the new root is in.
+		Page* metaPage = NULL;
+		Page* newRootPage;
+		PageId newRootNo = Page::INVALID_NUMBER;
+		try {
+			bufMgr->readPage(file,headerPageNum,metaPage);
+			bufMgr->allocPage(file,newRootNo,newRootPage);
+			NonLeaf* newRoot = reinterpret_cast<NonLeaf*>(newRootPage);
+			*newRoot = NonLeaf();
+			newRoot->setFirstChild(rootNo);
+			splitChildren<T>(newRoot,0);
+		}
+		catch (...) {
+			// splitChildren changes nothing when it throws, so the old root is still the whole tree.
+			if (newRootNo != Page::INVALID_NUMBER) {
+				bufMgr->unPinPage(file,newRootNo,false);
+				bufMgr->disposePage(file,newRootNo);
+			}
+			if (metaPage != NULL)
+				bufMgr->unPinPage(file,headerPageNum,false);
+			releaseWrite(rootNo,rootPage,false);
+			rootLatch.unlockExclusive();
+			throw;
+		}
+		NonLeaf* newRoot = reinterpret_cast<NonLeaf*>(newRootPage);
+		releaseWrite(rootNo,rootPage,true);
+		bufMgr->latchPage(newRootPage, EXCLUSIVE);
+		reinterpret_cast<IndexMetaInfo*>(metaPage)->rootPageNo = newRootNo;
+		bufMgr->unPinPage(file,headerPageNum,true);
+		rootPageNum = newRootNo;
+		rootLatch.unlockExclusive();
+		insertNonFull<T>(newRoot,newRootNo,key,rid);
 	}
 	else
 		{
-			insertNonFull(root,val,rid);
+			rootLatch.unlockExclusive();
+			insertNonFull<T>(root,rootNo,key,rid);
 		}
 }
 
+// -----------------------------------------------------------------------------
+// BTreeIndex::deleteEntry
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::deleteEntry(const void *key, const RecordId rid)
+{
+	if (mapped)
+		throw IndexReadOnlyException(file->filename());
+
+	// Pages of the scan may be merged away.
+	if (scan.isScanning())
+		scan.endScan();
+
+	if (attributeType == INTEGER) {
+		int val;
+		readKey(key, val);
+		deleteKey<int>(val, rid);
+	} else if (attributeType == DOUBLE) {
+		double val;
+		readKey(key, val);
+		deleteKey<double>(val, rid);
+	} else {
+		StringKey val;
+		readKey(key, val);
+		deleteKey<StringKey>(val, rid);
+	}
+}
+
+template <class T>
+void BTreeIndex::deleteKey(const T& key, const RecordId rid)
+{
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	Page* rootPage;
+	const PageId rootNo = rootPageNum;
+	bufMgr->readPage(file,rootNo,rootPage);
+	NonLeaf* root = reinterpret_cast<NonLeaf*>(rootPage);
+	if (root->child(0) == Page::INVALID_NUMBER || !deleteFrom<T>(root, key, rid)) {
+		bufMgr->unPinPage(file,rootNo,false);
+		throw NoSuchKeyFoundException();
+	}
+
+	if (root->k == 0 && root->level != 1) {
+		// The last two children of the root were merged: the tree loses a level.
+		const PageId childNo = root->child(0);
+		bufMgr->unPinPage(file,rootNo,false);
+		bufMgr->disposePage(file,rootNo);
+		setRootPageNum(childNo);
+	}
+	else
+		bufMgr->unPinPage(file,rootNo,true);
+}
+
+template <class T>
+bool BTreeIndex::deleteFrom(typename NodeTraits<T>::NonLeaf* node, const T& key, const RecordId rid)
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	// Duplicates of key may be spread over every child between these two.
+	const int last = node->upperBound(key);
+	for (int c = node->lowerBound(key); c <= last; c++) {
+		Page* pg;
+		const PageId childPageNo = node->child(c);
+		bufMgr->readPage(file,childPageNo,pg);
+		bool found = false;
+		bool underfull = false;
+		if (node->level != 1) {
+			NonLeaf* child = reinterpret_cast<NonLeaf*>(pg);
+			found = deleteFrom<T>(child, key, rid);
+			underfull = child->isUnderfull();
+		}
+		else {
+			Leaf* child = reinterpret_cast<Leaf*>(pg);
+			for (int i = child->lowerBound(key); i < child->upperBound(key) && !found; i++) {
+				if (child->rid(i) == rid) {
+					child->remove(i);
+					found = true;
+				}
+			}
+			underfull = child->isUnderfull();
+		}
+		bufMgr->unPinPage(file,childPageNo,found);
+		if (found) {
+			if (underfull)
+				rebalance<T>(node, c);
+			return true;
+		}
+	}
+	return false;
+}
+
+template <class T>
+void BTreeIndex::rebalance(typename NodeTraits<T>::NonLeaf* node, const int c)
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	if (node->k == 0)
+		return;
+
+	// Children s and s + 1 around separator s, where one of them is c.
+	const int s = c < node->k ? c : c - 1;
+	const PageId leftPageNo = node->child(s);
+	const PageId rightPageNo = node->child(s+1);
+	const T low = s > 0 ? node->key(s-1) : T();
+	const T high = s + 1 < node->k ? node->key(s+1) : T();
+	const T* lowPtr = s > 0 ? &low : NULL;
+	const T* highPtr = s + 1 < node->k ? &high : NULL;
+	T sep = node->key(s);
+
+	Page* leftPage;
+	Page* rightPage;
+	bufMgr->readPage(file,leftPageNo,leftPage);
+	bufMgr->readPage(file,rightPageNo,rightPage);
+	bool merged = false;
+	bool changed = false;
+	if (node->level == 1) {
+		Leaf* left = reinterpret_cast<Leaf*>(leftPage);
+		Leaf* right = reinterpret_cast<Leaf*>(rightPage);
+		if (left->merge(*right)) {
+			left->rightSibPageNo = right->rightSibPageNo;
+			left->highKey = right->highKey;
+			left->compress(lowPtr, highPtr);
+			merged = true;
+		}
+		else {
+			// Work on copies: the parent may have no room for a longer separator.
+			Leaf leftCopy = *left;
+			Leaf rightCopy = *right;
+			if (leftCopy.redistribute(rightCopy, sep) && node->canSetKey(s, sep)) {
+				*left = leftCopy;
+				*right = rightCopy;
+				left->highKey = sep;
+				left->compress(lowPtr, &sep);
+				right->compress(&sep, highPtr);
+				changed = true;
+			}
+		}
+	}
+	else {
+		NonLeaf* left = reinterpret_cast<NonLeaf*>(leftPage);
+		NonLeaf* right = reinterpret_cast<NonLeaf*>(rightPage);
+		if (left->merge(sep, *right)) {
+			left->rightSibPageNo = right->rightSibPageNo;
+			left->highKey = right->highKey;
+			left->compress(lowPtr, highPtr);
+			merged = true;
+		}
+		else {
+			NonLeaf leftCopy = *left;
+			NonLeaf rightCopy = *right;
+			if (leftCopy.redistribute(sep, rightCopy) && node->canSetKey(s, sep)) {
+				*left = leftCopy;
+				*right = rightCopy;
+				left->highKey = sep;
+				left->compress(lowPtr, &sep);
+				right->compress(&sep, highPtr);
+				changed = true;
+			}
+		}
+	}
+
+	if (merged) {
+		node->remove(s);
+		bufMgr->unPinPage(file,leftPageNo,true);
+		bufMgr->unPinPage(file,rightPageNo,false);
+		bufMgr->disposePage(file,rightPageNo);
+	}
+	else {
+		if (changed)
+			node->setKey(s, sep);
+		bufMgr->unPinPage(file,leftPageNo,changed);
+		bufMgr->unPinPage(file,rightPageNo,changed);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookup
+// -----------------------------------------------------------------------------
+
+const std::size_t BTreeIndex::lookup(const void* key, const std::function<bool(const RecordId&)>& callback)
+{
+	return lookupAny(key, callback);
+}
+
+const std::size_t BTreeIndex::lookup(const void* key, std::vector<RecordId>& outRids)
+{
+	auto append = [&outRids](const RecordId& rid) { outRids.push_back(rid); return true; };
+	return lookupAny(key, append);
+}
+
+template <class Callback>
+std::size_t BTreeIndex::lookupAny(const void* key, Callback& callback)
+{
+	if (attributeType == INTEGER) {
+		int val;
+		readKey(key, val);
+		return lookupKey<int>(val, callback);
+	} else if (attributeType == DOUBLE) {
+		double val;
+		readKey(key, val);
+		return lookupKey<double>(val, callback);
+	} else {
+		StringKey val;
+		readKey(key, val);
+		return lookupKey<StringKey>(val, callback);
+	}
+}
+
+template <class T, class Callback>
+std::size_t BTreeIndex::lookupKey(const T& key, Callback& callback)
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	// Descend as startScan does for [key, key].
+	PageId pageNum;
+	const NonLeaf* parent = readLeafParent<T>(key, pageNum);
+	const PageId leafPageNum = parent->child(parent->lowerBound(key));
+	releaseNode(pageNum, (const Page*) parent);
+	if (leafPageNum == Page::INVALID_NUMBER)
+		// Empty tree.
+		return 0;
+	pageNum = leafPageNum;
+	const Page* page = moveRight<Leaf>(key, pageNum, readNode(leafPageNum));
+
+	std::size_t found = 0;
+	while (1) {
+		const Leaf* leaf = (const Leaf*) page;
+		const int end = leaf->upperBound(key);
+		for (int i = leaf->lowerBound(key); i < end; i++) {
+			found++;
+			if (!callback(leaf->rid(i))) {
+				releaseNode(pageNum, page);
+				return found;
+			}
+		}
+		// Only entries past the end of the leaf can still be equal to key.
+		if (end < leaf->k || leaf->rightSibPageNo == Page::INVALID_NUMBER)
+			break;
+		const PageId nextPageNum = leaf->rightSibPageNo;
+		releaseNode(pageNum, page);
+		page = readNode(nextPageNum);
+		pageNum = nextPageNum;
+	}
+	releaseNode(pageNum, page);
+	return found;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::partitionScan
+// -----------------------------------------------------------------------------
+
+const std::size_t BTreeIndex::partitionScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm,
+				   const std::size_t count,
+				   std::vector< std::unique_ptr<IndexCursor> >& cursors)
+{
+	if (lowOpParm != GT && lowOpParm != GTE)
+		throw BadOpcodesException();
+	if (highOpParm != LT && highOpParm != LTE)
+		throw BadOpcodesException();
+
+	if (attributeType == INTEGER) {
+		int low, high;
+		readKey(lowValParm, low);
+		readKey(highValParm, high);
+		return partitionRange<int>(low, lowOpParm, high, highOpParm, count, cursors);
+	} else if (attributeType == DOUBLE) {
+		double low, high;
+		readKey(lowValParm, low);
+		readKey(highValParm, high);
+		return partitionRange<double>(low, lowOpParm, high, highOpParm, count, cursors);
+	} else {
+		StringKey low, high;
+		readKey(lowValParm, low);
+		readKey(highValParm, high);
+		return partitionRange<StringKey>(low, lowOpParm, high, highOpParm, count, cursors);
+	}
+}
+
+template <class T>
+std::size_t BTreeIndex::partitionRange(const T& low, const Operator lowOp, const T& high, const Operator highOp,
+                                      const std::size_t count, std::vector< std::unique_ptr<IndexCursor> >& cursors)
+{
+	if (high < low)
+		throw BadScanrangeException();
+
+	// A few separators per subrange, so subranges made of whole subtrees still come out about even.
+	std::vector<T> seps;
+	if (count > 1)
+		rangeSeparators<T>(low, high, count * 8, seps);
+
+	// Every subrange but the last ends at a separator, taking the keys up to and including it.
+	std::vector<T> bounds;
+	for (std::size_t i = 1; i < count && !seps.empty(); i++) {
+		const T& sep = seps[i * seps.size() / count];
+		if ((lowOp == GTE || low < sep) && (bounds.empty() || bounds.back() < sep))
+			bounds.push_back(sep);
+	}
+
+	const std::size_t first = cursors.size();
+	try {
+		for (std::size_t i = 0; i <= bounds.size(); i++) {
+			const T& from = i == 0 ? low : bounds[i-1];
+			const T& to = i == bounds.size() ? high : bounds[i];
+			cursors.push_back(std::unique_ptr<IndexCursor>(new IndexCursor(this)));
+			cursors.back()->startScan(&from, i == 0 ? lowOp : GT, &to, i == bounds.size() ? highOp : LTE);
+		}
+	}
+	catch (...) {
+		cursors.erase(cursors.begin() + first, cursors.end());
+		throw;
+	}
+	return bounds.size() + 1;
+}
+
+template <class T>
+void BTreeIndex::rangeSeparators(const T& low, const T& high, const std::size_t want, std::vector<T>& seps)
+{
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	PageId pageNo;
+	const Page* page = readRoot(pageNo);
+	while (1) {
+		// The nodes of a level holding [low, high] are the one holding low and those right of it, up to the
+		// one holding high. They are read one at a time, as lookups do.
+		page = moveRight<NonLeaf>(low, pageNo, page);
+		const NonLeaf* node = (const NonLeaf*) page;
+		const PageId firstChild = node->child(node->lowerBound(low));
+		const bool leafNext = node->level == 1;
+		seps.clear();
+		while (1) {
+			for (int i = node->lowerBound(low); i < node->k; i++) {
+				const T key = node->key(i);
+				if (!(key < high))
+					break;
+				seps.push_back(key);
+			}
+			if (node->rightSibPageNo == Page::INVALID_NUMBER || !(node->highKey < high))
+				break;
+			const PageId rightPageNo = node->rightSibPageNo;
+			releaseNode(pageNo, page);
+			pageNo = rightPageNo;
+			page = readNode(pageNo);
+			node = (const NonLeaf*) page;
+		}
+		releaseNode(pageNo, page);
+		if (leafNext || seps.size() >= want || firstChild == Page::INVALID_NUMBER)
+			return;
+		pageNo = firstChild;
+		page = readNode(pageNo);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readNode
+// -----------------------------------------------------------------------------
+
+const Page* BTreeIndex::pinNode(const PageId pageNo)
+{
+	if (mapped)
+		return file->mappedPage(pageNo);
+	Page* page;
+	bufMgr->readPage(file, pageNo, page);
+	return page;
+}
+
+void BTreeIndex::unpinNode(const PageId pageNo)
+{
+	if (!mapped)
+		bufMgr->unPinPage(file, pageNo, false);
+}
+
+void BTreeIndex::latchNode(const Page* page, const LatchMode mode)
+{
+	// Nothing changes a mapped index.
+	if (!mapped)
+		bufMgr->latchPage(page, mode);
+}
+
+void BTreeIndex::unlatchNode(const Page* page, const LatchMode mode)
+{
+	if (!mapped)
+		bufMgr->unlatchPage(page, mode);
+}
+
+const Page* BTreeIndex::readNode(const PageId pageNo)
+{
+	const Page* page = pinNode(pageNo);
+	latchNode(page, SHARED);
+	return page;
+}
+
+void BTreeIndex::releaseNode(const PageId pageNo, const Page* page)
+{
+	unlatchNode(page, SHARED);
+	unpinNode(pageNo);
+}
+
+const Page* BTreeIndex::readRoot(PageId& pageNo)
+{
+	// The root may be split and replaced before its page is latched. The old root is then the left-most
+	// node of the level below, and moving right from it works as it does for any node split under a reader.
+	pageNo = rootPageNum;
+	return readNode(pageNo);
+}
+
+template <class Node, class T>
+const Page* BTreeIndex::moveRight(const T& key, PageId& pageNo, const Page* page)
+{
+	// Nodes are never freed while readers run, so the right sibling can be latched after the node is let go.
+	while (((const Node*) page)->pastHighKey(key)) {
+		const PageId rightPageNo = ((const Node*) page)->rightSibPageNo;
+		releaseNode(pageNo, page);
+		pageNo = rightPageNo;
+		page = readNode(pageNo);
+	}
+	return page;
+}
+
+template <class T>
+const typename NodeTraits<T>::NonLeaf* BTreeIndex::readLeafParent(const T& key, PageId& pageNo)
+{
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	// A node is let go before its child is latched. If the child splits in between, the keys moved out
+	// of it are above its new high key and are found by moving right.
+	const Page* page = readRoot(pageNo);
+	while (1) {
+		page = moveRight<NonLeaf>(key, pageNo, page);
+		const NonLeaf* node = (const NonLeaf*) page;
+		if (node->level == 1)
+			return node;
+		const PageId childPageNo = node->child(node->lowerBound(key));
+		releaseNode(pageNo, page);
+		pageNo = childPageNo;
+		page = readNode(pageNo);
+	}
+}
+
+Page* BTreeIndex::writeNode(const PageId pageNo)
+{
+	Page* page;
+	bufMgr->readPage(file, pageNo, page);
+	bufMgr->latchPage(page, EXCLUSIVE);
+	return page;
+}
+
+void BTreeIndex::releaseWrite(const PageId pageNo, Page* page, const bool dirty)
+{
+	bufMgr->unlatchPage(page, EXCLUSIVE);
+	bufMgr->unPinPage(file, pageNo, dirty);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::setRootPageNum
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::setRootPageNum(const PageId pageNo)
+{
+	Page* metaPage;
+	bufMgr->readPage(file,headerPageNum,metaPage);
+	reinterpret_cast<IndexMetaInfo*>(metaPage)->rootPageNo = pageNo;
+	bufMgr->unPinPage(file,headerPageNum,true);
+	rootPageNum = pageNo;
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::startScan
 // -----------------------------------------------------------------------------
@@ -157,8 +942,70 @@ const void BTreeIndex::startScan(const void* lowValParm,
 				   const void* highValParm,
 				   const Operator highOpParm)
 {
+	scan.startScan(lowValParm, lowOpParm, highValParm, highOpParm);
+}
 
-	scanExecuting = true;
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNext
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::scanNext(RecordId& outRid) 
+{
+	scan.scanNext(outRid);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNextBatch
+// -----------------------------------------------------------------------------
+
+const std::size_t BTreeIndex::scanNextBatch(RecordId* outRids, const std::size_t max)
+{
+	return scan.scanNextBatch(outRids, max);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::endScan
+// -----------------------------------------------------------------------------
+//
+const void BTreeIndex::endScan() 
+{
+	scan.endScan();
+}
+
+// -----------------------------------------------------------------------------
+// IndexCursor::IndexCursor -- Constructor
+// -----------------------------------------------------------------------------
+
+IndexCursor::IndexCursor(BTreeIndex* indexIn)
+	: index(indexIn), scanExecuting(false), prefetchedLeafNum(Page::INVALID_NUMBER)
+{
+}
+
+// -----------------------------------------------------------------------------
+// IndexCursor::~IndexCursor -- destructor
+// -----------------------------------------------------------------------------
+
+IndexCursor::~IndexCursor()
+{
+	try
+	{
+		if (scanExecuting)
+			endScan();
+	}
+	catch(const BadgerDbException&)
+	{
+	}
+}
+
+// -----------------------------------------------------------------------------
+// IndexCursor::startScan
+// -----------------------------------------------------------------------------
+
+void IndexCursor::startScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm)
+{
 	if (lowOpParm != GT && lowOpParm != GTE ){
 		throw BadOpcodesException();
 	}
@@ -167,268 +1014,431 @@ const void BTreeIndex::startScan(const void* lowValParm,
 		throw BadOpcodesException();
 	}
 
+	if (scanExecuting)
+		endScan();
+
 	this->lowOp = lowOpParm;
 	this->highOp = highOpParm;
 
-	if(attributeType == INTEGER) {
-		this->lowValInt = *((int*) lowValParm);
-		this->highValInt = *((int*) highValParm);
-		if(*(int*)lowValParm > *(int*)highValParm)
-			throw BadScanrangeException();
-
-		//find first leaf
-		currentPageNum = rootPageNum;
-		bufMgr->readPage(file, currentPageNum, currentPageData);
-		NonLeafNodeInt* nonLeafNode = (NonLeafNodeInt*) currentPageData;
-
-		int pos = 0;
-		while(nonLeafNode->level != 1) {
-			// If current level is not 1, then next page is not leaf page.
-			// Still need to go to next level.
-			pos = 0;
-			while(!(*(int*)lowValParm <= nonLeafNode->keyArray[pos]) && pos <nonLeafNode->k)
-				pos++;
-			PageId nextPageId = nonLeafNode->pageNoArray[pos];
-			bufMgr->readPage(file, nextPageId, currentPageData);
-			bufMgr->unPinPage(file, currentPageNum, false);
-			currentPageNum = nextPageId;
-			nonLeafNode = (NonLeafNodeInt*) currentPageData;
-		}
-
-		// This page is level 1, which means next page is leaf node.
-		pos = 0;
-		while(!(*(int*)lowValParm <= nonLeafNode->keyArray[pos]) &&  pos < nonLeafNode->k)
-			pos++;
-		PageId nextPageId = nonLeafNode->pageNoArray[pos];
-		bufMgr->readPage(file, nextPageId, currentPageData);
-		bufMgr->unPinPage(file, currentPageNum, false);
-		currentPageNum = nextPageId;
-		nextEntry = 0;		
-	} else if (attributeType == DOUBLE) {
-		;
+	if(index->attributeType == INTEGER) {
+		readKey(lowValParm, lowValInt);
+		readKey(highValParm, highValInt);
+		startScan<int>();
+	} else if (index->attributeType == DOUBLE) {
+		readKey(lowValParm, lowValDouble);
+		readKey(highValParm, highValDouble);
+		startScan<double>();
 	} else {
-		;
-	}	
+		readKey(lowValParm, lowValString);
+		readKey(highValParm, highValString);
+		startScan<StringKey>();
+	}
+}
+
+template <class T>
+void IndexCursor::startScan()
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	const T& low = lowVal<T>();
+	if (highVal<T>() < low)
+		throw BadScanrangeException();
 
+	//find first leaf: the child of the leaf parent holding the first key >= low
+	PageId parentPageNum;
+	const NonLeaf* parent = index->readLeafParent<T>(low, parentPageNum);
+	const int c = parent->lowerBound(low);
+	const PageId leafPageNum = parent->child(c);
+	if (leafPageNum == Page::INVALID_NUMBER) {
+		// Empty tree.
+		index->releaseNode(parentPageNum, (const Page*) parent);
+		throw NoSuchKeyFoundException();
+	}
+	prefetchLeaves<T>(parent, c);
+	index->releaseNode(parentPageNum, (const Page*) parent);
+	currentPageNum = leafPageNum;
+	currentPageData = index->moveRight<Leaf>(low, currentPageNum, index->readNode(leafPageNum));
+
+	// Between calls the leaf is only pinned, so an idle cursor holds up no writer.
+	scanLeafRange<T>();
+	index->unlatchNode(currentPageData, SHARED);
+	scanExecuting = true;
+}
+
+template <class T>
+void IndexCursor::prefetchLeaves(const typename NodeTraits<T>::NonLeaf* parent, const int c)
+{
+	// The children after c, up to the one holding the high end of the range.
+	const int last = std::min(parent->upperBound(highVal<T>()), c + PREFETCH_LEAVES);
+	std::vector<PageId> pageNos;
+	for (int i = c + 1; i <= last; i++)
+		pageNos.push_back(parent->child(i));
+
+	prefetchedLeafNum = pageNos.empty() ? Page::INVALID_NUMBER : pageNos.back();
+	// The leaves of a mapped index are paged in by the OS, not read into the pool.
+	if (!pageNos.empty() && !index->mapped)
+		index->bufMgr->prefetchPages(index->file, &pageNos[0], pageNos.size());
+}
+
+template <class T>
+void IndexCursor::prefetchLeavesAfter(const T& key)
+{
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	PageId pageNum;
+	const NonLeaf* node = index->readLeafParent<T>(key, pageNum);
+	prefetchLeaves<T>(node, node->lowerBound(key));
+	index->releaseNode(pageNum, (const Page*) node);
+}
+
+template <class T>
+void IndexCursor::scanLeafRange()
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+
+	const Leaf* leafNode = (const Leaf*) currentPageData;
+	nextEntry = lowOp == GT ? leafNode->upperBound(lowVal<T>()) : leafNode->lowerBound(lowVal<T>());
+	endEntry = highOp == LT ? leafNode->lowerBound(highVal<T>()) : leafNode->upperBound(highVal<T>());
+	leafCount = leafNode->k;
+	leafRightSib = leafNode->rightSibPageNo;
+	returnedFromLeaf = false;
+}
+
+template <class T>
+void IndexCursor::latchLeaf()
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+
+	index->latchNode(currentPageData, SHARED);
+	// Inserts only add entries to a leaf, and a split always gives it a new right link, so the leaf is as
+	// the scan left it if both are unchanged. Deletes do not run alongside scans.
+	const Leaf* leafNode = (const Leaf*) currentPageData;
+	if (leafNode->k == leafCount && leafNode->rightSibPageNo == leafRightSib)
+		return;
+
+	if (!returnedFromLeaf) {
+		currentPageData = index->moveRight<Leaf>(lowVal<T>(), currentPageNum, currentPageData);
+		scanLeafRange<T>();
+		return;
+	}
+
+	// Go on after the last entry returned. Splits only move entries to the right, in order, so it is after
+	// the other entries of its key on this leaf, or on a leaf to the right if the entries of its key run
+	// to the end of this one.
+	const T key = lastKey<T>();
+	while (1) {
+		currentPageData = index->moveRight<Leaf>(key, currentPageNum, currentPageData);
+		leafNode = (const Leaf*) currentPageData;
+		int next = leafNode->lowerBound(key);
+		const int end = leafNode->upperBound(key);
+		while (next < end && leafNode->rid(next) != lastRid)
+			next++;
+		if (next < end || end < leafNode->k || leafNode->rightSibPageNo == Page::INVALID_NUMBER) {
+			scanLeafRange<T>();
+			nextEntry = next < end ? next + 1 : end;
+			returnedFromLeaf = true;
+			return;
+		}
+		const PageId rightPageNum = leafNode->rightSibPageNo;
+		index->releaseNode(currentPageNum, currentPageData);
+		currentPageNum = rightPageNum;
+		currentPageData = index->readNode(currentPageNum);
+	}
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::scanNext
+// IndexCursor::scanNext
 // -----------------------------------------------------------------------------
 
-const void BTreeIndex::scanNext(RecordId& outRid) 
+void IndexCursor::scanNext(RecordId& outRid) 
 {
 	if(scanExecuting == false)
 		throw ScanNotInitializedException();
 
-	if(attributeType == INTEGER) {
-		LeafNodeInt* leafNode;
-		while(1){
-			leafNode = (LeafNodeInt*) currentPageData;
-
-			// Go to next page.
-			if(leafNode->ridArray[nextEntry].page_number == 0 || nextEntry == INTARRAYLEAFSIZE || nextEntry >= leafNode->k) {
-				PageId nextPageNum = leafNode->rightSibPageNo;
-				if(nextPageNum == 0){
-					// Next page is 0, scan finish.
-					bufMgr->unPinPage(file, currentPageNum, false);
-					throw IndexScanCompletedException();
-				}
-				// if(nextPageNum) {
-				// 	bufMgr -> readPage(file, nextPageNum, currentPageData);
-				// 	bufMgr -> unPinPage(file, nextPageNum, false);
-				// 	leafNode = (LeafNodeInt*)currentPageData;
-				// } else
-				// 	continue;
-				bufMgr->unPinPage(file, currentPageNum, false);
-				currentPageNum = nextPageNum;
-				// std::cout << "==============" << currentPageNum << "================="<< std::endl;
-				bufMgr->readPage(file, currentPageNum, currentPageData);
-				nextEntry = 0;
-				continue;
-			}
+	if(index->attributeType == INTEGER)
+		scanNext<int>(outRid);
+	else if (index->attributeType == DOUBLE)
+		scanNext<double>(outRid);
+	else
+		scanNext<StringKey>(outRid);
+}
 
-			// Do not satisfy.
-			if((lowOp==GT && !(leafNode->keyArray[nextEntry] > this->lowValInt) )
-			   || (lowOp==GTE && (leafNode->keyArray[nextEntry] < this->lowValInt))
-			   ) {
-				nextEntry++;
-				continue;
-			}
+template <class T>
+void IndexCursor::scanNext(RecordId& outRid)
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
 
-			// Value bigger that high value, scan end.
-			if((highOp==LT && !(leafNode->keyArray[nextEntry] < this->highValInt))
-			   || (highOp==LTE && (leafNode->keyArray[nextEntry] > this->highValInt) ))
-				throw IndexScanCompletedException();
+	latchLeaf<T>();
+	while(1){
+		const Leaf* leafNode = (const Leaf*) currentPageData;
 
-			// Got a record.
-			outRid = leafNode->ridArray[nextEntry];
-			// std::cout<< leafNode->keyArray[nextEntry] << std::endl;
+		// Got a record.
+		if(nextEntry < endEntry) {
+			outRid = leafNode->rid(nextEntry);
+			lastKey<T>() = leafNode->key(nextEntry);
+			lastRid = outRid;
+			returnedFromLeaf = true;
 			nextEntry++;
-			return ;
+			index->unlatchNode(currentPageData, SHARED);
+			return;
+		}
+
+		// Value bigger that high value, scan end. The last page stays pinned until endScan.
+		if(!nextLeaf<T>()) {
+			index->unlatchNode(currentPageData, SHARED);
+			throw IndexScanCompletedException();
 		}
 	}
-	else if (attributeType == DOUBLE)
-		;
+}
+
+template <class T>
+bool IndexCursor::nextLeaf()
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+
+	const Leaf* leafNode = (const Leaf*) currentPageData;
+	if(endEntry < leafNode->k || leafNode->rightSibPageNo == Page::INVALID_NUMBER)
+		return false;
+
+	// Go to next page. Leaves are latched one at a time: a split of this leaf in between only moves entries
+	// already returned, or inserted since, to a leaf before the next one.
+	const PageId nextPageNum = leafNode->rightSibPageNo;
+	index->releaseNode(currentPageNum, currentPageData);
+	const Page* nextPage = index->readNode(nextPageNum);
+	currentPageNum = nextPageNum;
+	currentPageData = nextPage;
+	scanLeafRange<T>();
+
+	// Past the leaves read ahead, and the range goes on after this one. The descent latches from the
+	// root down, so the leaf is let go meanwhile.
+	const Leaf* next = (const Leaf*) nextPage;
+	if ((currentPageNum == prefetchedLeafNum || prefetchedLeafNum == Page::INVALID_NUMBER) &&
+			endEntry == next->k && next->k > 0 && next->rightSibPageNo != Page::INVALID_NUMBER) {
+		const T lastKey = next->key(next->k - 1);
+		index->unlatchNode(currentPageData, SHARED);
+		prefetchLeavesAfter<T>(lastKey);
+		latchLeaf<T>();
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// IndexCursor::scanNextBatch
+// -----------------------------------------------------------------------------
+
+std::size_t IndexCursor::scanNextBatch(RecordId* outRids, const std::size_t max)
+{
+	if(scanExecuting == false)
+		throw ScanNotInitializedException();
+
+	if(index->attributeType == INTEGER)
+		return scanNextBatch<int>(outRids, max);
+	else if (index->attributeType == DOUBLE)
+		return scanNextBatch<double>(outRids, max);
 	else
-		;
+		return scanNextBatch<StringKey>(outRids, max);
+}
+
+template <class T>
+std::size_t IndexCursor::scanNextBatch(RecordId* outRids, const std::size_t max)
+{
+	typedef typename NodeTraits<T>::Leaf Leaf;
+
+	std::size_t n = 0;
+	latchLeaf<T>();
+	while (n < max) {
+		// Entries [nextEntry, endEntry) of the current leaf are all inside the range.
+		if (nextEntry < endEntry) {
+			const Leaf* leafNode = (const Leaf*) currentPageData;
+			const int count = (int)std::min<std::size_t>(endEntry - nextEntry, max - n);
+			leafNode->copyRids(nextEntry, count, outRids + n);
+			nextEntry += count;
+			n += count;
+			lastKey<T>() = leafNode->key(nextEntry - 1);
+			lastRid = outRids[n - 1];
+			returnedFromLeaf = true;
+		}
+		else if (!nextLeaf<T>())
+			break;
+	}
+	index->unlatchNode(currentPageData, SHARED);
+	return n;
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::endScan
+// IndexCursor::endScan
 // -----------------------------------------------------------------------------
 //
-const void BTreeIndex::endScan() 
+void IndexCursor::endScan() 
 {
 	if(scanExecuting == false)
 		throw ScanNotInitializedException();
 	scanExecuting = false;
 
-	try {
-		bufMgr->unPinPage(file, currentPageNum, false);
-	} catch (PageNotPinnedException e) {
-	} catch (HashNotFoundException e) {
-	}
+	// The current leaf stays pinned from startScan until here.
+	index->unpinNode(currentPageNum);
 }
-void BTreeIndex::splitChildren(NonLeafNodeInt* node, int c)
+
+template <class T>
+void BTreeIndex::splitChildren(typename NodeTraits<T>::NonLeaf* node, int c)
 {
-	Page* curr;
-	Page* subl;
-	PageId pN;
-	int key;
-	bufMgr->allocPage(file,pN,subl);
-	bufMgr->unPinPage(file,pN,true);
-	bufMgr->readPage(file,node->pageNoArray[c],curr);
-	bufMgr->unPinPage(file,node->pageNoArray[c],true);
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	Page* leftPage;
+	Page* rightPage;
+	const PageId leftPageNo = node->child(c);
+	PageId rightPageNo;
+	// Both pages are had before anything changes, so a split that throws leaves the tree as it was.
+	bufMgr->allocPage(file,rightPageNo,rightPage);
+	try {
+		bufMgr->readPage(file,leftPageNo,leftPage);
+	}
+	catch (...) {
+		bufMgr->unPinPage(file,rightPageNo,false);
+		bufMgr->disposePage(file,rightPageNo);
+		throw;
+	}
+
+	// The halves cover [low, key] and [key, high], where low and high are the separators around child c.
+	// The right half takes over the right link and high key, so a reader that read node before the split
+	// and comes down to the left half finds the keys it is looking for by moving right.
+	const T low = c > 0 ? node->key(c-1) : T();
+	const T high = c < node->k ? node->key(c) : T();
+	T key;
 	if (node->level != 1 ){
-		NonLeafNodeInt* nlNodeR = reinterpret_cast<NonLeafNodeInt*>(subl);
-		NonLeafNodeInt* nlNodeL = reinterpret_cast<NonLeafNodeInt*>(curr);
-		nlNodeR->level = nlNodeL->level;
-		nlNodeR->k = INTARRAYNONLEAFSIZE/2;
-		for (int i = 0; i < INTARRAYNONLEAFSIZE/2; ++i)
-		{
-			nlNodeR->keyArray[i] = nlNodeL->keyArray[i+(INTARRAYNONLEAFSIZE+1)/2];
-		}
-		for (int i = 0; i < INTARRAYNONLEAFSIZE/2+1; ++i)
-		{
-			nlNodeR->pageNoArray[i] = nlNodeL->pageNoArray[i+(INTARRAYNONLEAFSIZE+1)/2];
-		}	
-		nlNodeL->k = (INTARRAYNONLEAFSIZE-1)/2;
-		key =  nlNodeL->keyArray[nlNodeL->k];
-	}
-	else if (node->level == 1){
-		LeafNodeInt* lNodeR = reinterpret_cast<LeafNodeInt*>(subl);
-		LeafNodeInt* lNodeL = reinterpret_cast<LeafNodeInt*>(curr);
-		lNodeR->k = INTARRAYLEAFSIZE/2;
-		for (int i = 0; i < INTARRAYLEAFSIZE/2; ++i)
-		{
-			lNodeR->keyArray[i] = lNodeL->keyArray[i+(INTARRAYLEAFSIZE+1)/2];
-		}
-		for (int i = 0; i < INTARRAYLEAFSIZE/2; ++i)
-		{
-			lNodeR->ridArray[i] = lNodeL->ridArray[i+(INTARRAYLEAFSIZE+1)/2];
-		}	
-		lNodeL->k = (INTARRAYLEAFSIZE+1)/2;
-		lNodeR->rightSibPageNo = lNodeL->rightSibPageNo;
-		lNodeL->rightSibPageNo = pN;
-		// std::cout<<pN<<"new allocpage of--"<< node->pageNoArray[c]<<std::endl;
-		key =  lNodeL->keyArray[lNodeL->k-1];
-	}
-	node->k++;
-	for (int i = node->k; i>c+1; --i)
-	{
-		node->pageNoArray[i] = node->pageNoArray[i-1];
+		// The middle key moves up to the parent; keys after it go to the new right node.
+		NonLeaf* left = reinterpret_cast<NonLeaf*>(leftPage);
+		NonLeaf* right = reinterpret_cast<NonLeaf*>(rightPage);
+		*right = NonLeaf();
+		key = left->split(*right);
+		right->rightSibPageNo = left->rightSibPageNo;
+		right->highKey = left->highKey;
+		left->rightSibPageNo = rightPageNo;
+		left->highKey = key;
+		left->compress(c > 0 ? &low : NULL, &key);
+		right->compress(&key, c < node->k ? &high : NULL);
 	}
-	node->pageNoArray[c+1] = pN;
-	for (int i = node->k-1; i > c; --i)
-	{
-		node->keyArray[i] = node->keyArray[i-1];
+	else {
+		// A separator between the two halves is copied up to the parent.
+		Leaf* left = reinterpret_cast<Leaf*>(leftPage);
+		Leaf* right = reinterpret_cast<Leaf*>(rightPage);
+		*right = Leaf();
+		key = left->split(*right);
+		right->rightSibPageNo = left->rightSibPageNo;
+		right->highKey = left->highKey;
+		left->rightSibPageNo = rightPageNo;
+		left->highKey = key;
+		left->compress(c > 0 ? &low : NULL, &key);
+		right->compress(&key, c < node->k ? &high : NULL);
 	}
-	node->keyArray[c]= key;
+	node->insert(c, key, rightPageNo);
+	bufMgr->unPinPage(file,leftPageNo,true);
+	bufMgr->unPinPage(file,rightPageNo,true);
+}
+
+void BTreeIndex::printall()
+{
+	if (attributeType == INTEGER)
+		printall<int>();
+	else if (attributeType == DOUBLE)
+		printall<double>();
+	else
+		printall<StringKey>();
 }
+
+template <class T>
 void BTreeIndex::printall()
 {
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
 
-	Page* curPage;
-	NonLeafNodeInt* nln;
-	bufMgr->readPage(file,rootPageNum,curPage);
-	bufMgr->unPinPage(file,rootPageNum,false);
-	nln = reinterpret_cast<NonLeafNodeInt*>(curPage);
-	while(nln->level!=1){
-		bufMgr->readPage(file,nln->pageNoArray[0],curPage);
-		bufMgr->unPinPage(file,nln->pageNoArray[0],false);
-		nln = reinterpret_cast<NonLeafNodeInt*>(curPage);		
-	}
-	bufMgr->readPage(file,nln->pageNoArray[1],curPage);
-	bufMgr->unPinPage(file,nln->pageNoArray[1],false);
-	LeafNodeInt* lni;
-	lni = reinterpret_cast<LeafNodeInt*>(curPage);
-	PageId nxtp;
+	const Page* curPage;
+	PageId curPageNo;
+	const NonLeaf* nln;
+	curPage = readRoot(curPageNo);
+	nln = reinterpret_cast<const NonLeaf*>(curPage);
+	while(1){
+		const PageId child = nln->child(0);
+		const bool leafNext = nln->level == 1;
+		releaseNode(curPageNo, curPage);
+		if (child == Page::INVALID_NUMBER)
+			return;
+		curPageNo = child;
+		curPage = readNode(curPageNo);
+		if (leafNext)
+			break;
+		nln = reinterpret_cast<const NonLeaf*>(curPage);
+	}
+	const Leaf* lni = reinterpret_cast<const Leaf*>(curPage);
 	while(1) {
 		for (int i = 0; i < lni->k; ++i)
 		{
-			std::cout<<lni->keyArray[i]<<"# "<<std::endl;
+			std::cout<<lni->key(i)<<"# "<<std::endl;
 		}
-		nxtp = lni->rightSibPageNo;
-		if (nxtp){
-			bufMgr->readPage(file,nxtp,curPage);
-			bufMgr->unPinPage(file,nxtp,false);
-			lni = reinterpret_cast<LeafNodeInt*>(curPage);
-			std::cout<< "==========PageNo:"<<(int)nxtp << std::endl;
-		} 
-		else
+		const PageId nxtp = lni->rightSibPageNo;
+		releaseNode(curPageNo, curPage);
+		if (nxtp == Page::INVALID_NUMBER)
 			break;
+		curPageNo = nxtp;
+		curPage = readNode(curPageNo);
+		lni = reinterpret_cast<const Leaf*>(curPage);
+		std::cout<< "==========PageNo:"<<(int)nxtp << std::endl;
 	}
 }
-void BTreeIndex::insertNonFull(NonLeafNodeInt* node , int val, RecordId rid)
+
+template <class T>
+void BTreeIndex::insertNonFull(typename NodeTraits<T>::NonLeaf* node, const PageId nodePageNo, const T& val, RecordId rid)
 {
+	typedef typename NodeTraits<T>::Leaf Leaf;
+	typedef typename NodeTraits<T>::NonLeaf NonLeaf;
+
+	const int pos = node->upperBound(val);
+	PageId childPageNo = node->child(pos);
+	// If a page cannot be had on the way down, the latches and pins held are given back before the exception
+	// leaves; node is dirty only once its child has been split.
 	Page* pg;
-	int pos = node->k-1;
-	if (node->level!=1){
-		for (; pos >= 0 && val < node->keyArray[pos]; pos--){
-		}
-		pos++;
-		bufMgr->readPage(file,node->pageNoArray[pos],pg);
-		bufMgr->unPinPage(file,node->pageNoArray[pos],true);
-		NonLeafNodeInt* child = reinterpret_cast<NonLeafNodeInt*>(pg);
-		if (child->k == INTARRAYNONLEAFSIZE) {
-			splitChildren(node,pos);
-			if (val>node->keyArray[pos]) {
-				pos++;
-				bufMgr->readPage(file,node->pageNoArray[pos],pg);
-				bufMgr->unPinPage(file,node->pageNoArray[pos],true);
-			}
+	try {
+		pg = writeNode(childPageNo);
+	}
+	catch (...) {
+		releaseWrite(nodePageNo,reinterpret_cast<Page*>(node),false);
+		throw;
+	}
+	const bool leafChild = node->level == 1;
+	const bool full = leafChild ? !reinterpret_cast<Leaf*>(pg)->canInsert(val) : reinterpret_cast<NonLeaf*>(pg)->isFull();
+	if (full) {
+		try {
+			splitChildren<T>(node,pos);
 		}
-		child = reinterpret_cast<NonLeafNodeInt*>(pg);
-
-		insertNonFull(child, val,rid);
+		catch (...) {
+			releaseWrite(childPageNo,pg,false);
+			releaseWrite(nodePageNo,reinterpret_cast<Page*>(node),false);
+			throw;
 		}
-		if (node->level == 1){
-			for (; pos >= 0 && val < node->keyArray[pos]; pos--){
-			}
-			pos++;
-			bufMgr->readPage(file,node->pageNoArray[pos],pg);
-			bufMgr->unPinPage(file,node->pageNoArray[pos],true);
-			LeafNodeInt* child = reinterpret_cast<LeafNodeInt*>(pg);
-			if (child->k == INTARRAYLEAFSIZE){
-				splitChildren(node,pos);
-				if (val>=node->keyArray[pos]) {
-					pos++;
-					bufMgr->readPage(file,node->pageNoArray[pos],pg);
-					bufMgr->unPinPage(file,node->pageNoArray[pos],true);
-				}
+		if (node->upperBound(val) != pos) {
+			releaseWrite(childPageNo,pg,true);
+			childPageNo = node->child(pos+1);
+			try {
+				pg = writeNode(childPageNo);
 			}
-			child = reinterpret_cast<LeafNodeInt*>(pg);
-			int i;
-			for (i = child->k-1; i >=0 && val<child->keyArray[i]; --i)
-			{
-				child->keyArray[i+1]=child->keyArray[i];
-				child->ridArray[i+1]=child->ridArray[i];
+			catch (...) {
+				releaseWrite(nodePageNo,reinterpret_cast<Page*>(node),true);
+				throw;
 			}
-			child->keyArray[i+1] = val;
-			child->ridArray[i+1] = rid;
-			child->k++;
 		}
+	}
+	// The child has room now, so the insert changes nothing above it: let go of node.
+	releaseWrite(nodePageNo,reinterpret_cast<Page*>(node),full);
+
+	if (!leafChild)
+		insertNonFull<T>(reinterpret_cast<NonLeaf*>(pg), childPageNo, val, rid);
+	else {
+		Leaf* child = reinterpret_cast<Leaf*>(pg);
+		child->insert(child->upperBound(val), val, rid);
+		releaseWrite(childPageNo,pg,true);
+	}
 }
 
 }
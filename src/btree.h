@@ -7,15 +7,24 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
 #include "string.h"
 #include <sstream>
+#include <vector>
 
 #include "types.h"
 #include "page.h"
 #include "file.h"
 #include "buffer.h"
+#include "latch.h"
+#include "external_sort.h"
+#include "node_search.h"
+#include "string_node.h"
 
 namespace badgerdb
 {
@@ -41,17 +50,43 @@ enum Operator
 	GT		/* Greater Than */
 };
 
+/**
+ * @brief Number of key slots in B+Tree nodes for a key of type T, computed so that a node fits in one page.
+ */
+template <class T>
+struct NodeCapacity {
+  /**
+   * Number of key slots in a leaf.
+   */
+	//                                   int k            sibling ptr       high key               key               rid
+	static const int LEAF = ( Page::SIZE - sizeof(int) - sizeof( PageId ) - sizeof( T ) ) / ( sizeof( T ) + sizeof( RecordId ) );
+
+  /**
+   * Number of key slots in a non-leaf.
+   */
+	//                                        k level  extra pageNo, sibling ptr        high key              key       pageNo
+	static const int NONLEAF = ( Page::SIZE - 2*sizeof( int ) - 2*sizeof( PageId ) - sizeof( T ) ) / ( sizeof( T ) + sizeof( PageId ) );
+};
+
 /**
  * @brief Number of key slots in B+Tree leaf for INTEGER key.
  */
-//                                             int k            sibling ptr             key               rid
-const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof(int) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( RecordId ) );
+const  int INTARRAYLEAFSIZE = NodeCapacity<int>::LEAF;
 
 /**
  * @brief Number of key slots in B+Tree non-leaf for INTEGER key.
  */
-//                                                    k level     extra pageNo                  key       pageNo
-const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - 2*sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
+const  int INTARRAYNONLEAFSIZE = NodeCapacity<int>::NONLEAF;
+
+/**
+ * @brief Number of key slots in B+Tree leaf for DOUBLE key.
+ */
+const  int DOUBLEARRAYLEAFSIZE = NodeCapacity<double>::LEAF;
+
+/**
+ * @brief Number of key slots in B+Tree non-leaf for DOUBLE key.
+ */
+const  int DOUBLEARRAYNONLEAFSIZE = NodeCapacity<double>::NONLEAF;
 
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that 
@@ -137,9 +172,13 @@ at this level are just above the leaf nodes. Otherwise set to 0.
 */
 
 /**
- * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
+ * @brief Structure for all non-leaf nodes, for a key of type T.
+ *
+ * Nodes are used through the same member functions as the slotted STRING nodes (see string_node.h),
+ * so the tree algorithms are written once for every key type.
 */
-struct NonLeafNodeInt{
+template <class T>
+struct NonLeafNode{
   /**
    * Level of the node in the tree.
    */
@@ -153,24 +192,184 @@ struct NonLeafNodeInt{
   /**
    * Stores keys.
    */
-	int keyArray[ INTARRAYNONLEAFSIZE ];
+	T keyArray[ NodeCapacity<T>::NONLEAF ];
 
   /**
    * Stores page numbers of child pages which themselves are other non-leaf/leaf nodes in the tree.
    */
-	PageId pageNoArray[ INTARRAYNONLEAFSIZE + 1 ];
-  NonLeafNodeInt(): level(0), k(0){};
+	PageId pageNoArray[ NodeCapacity<T>::NONLEAF + 1 ];
+
+  /**
+   * Page number of the node on the right side at the same level, or Page::INVALID_NUMBER for the right-most one.
+   */
+	PageId rightSibPageNo;
+
+  /**
+   * Separator left of the right sibling: no key routed to this node is above it.
+   */
+	T highKey;
+  NonLeafNode(): level(0), k(0), rightSibPageNo(Page::INVALID_NUMBER), highKey(){ pageNoArray[0] = Page::INVALID_NUMBER; };
+
+  /**
+   * Returns separator key i.
+   */
+	const T& key(int i) const { return keyArray[i]; }
+
+  /**
+   * Returns child page i, in [0, k].
+   */
+	PageId child(int i) const { return pageNoArray[i]; }
+
+  /**
+   * Returns true if key is above the high key, so a split has moved it to the right sibling.
+   */
+	bool pastHighKey(const T& key) const { return rightSibPageNo != Page::INVALID_NUMBER && highKey < key; }
+
+  /**
+   * Returns the position of the first key >= key.
+   */
+	int lowerBound(const T& key) const { return nodeLowerBound(keyArray, k, key); }
+
+  /**
+   * Returns the position of the first key > key.
+   */
+	int upperBound(const T& key) const { return nodeUpperBound(keyArray, k, key); }
+
+  /**
+   * Returns true if no key can be inserted.
+   */
+	bool isFull() const { return k == NodeCapacity<T>::NONLEAF; }
+
+  /**
+   * Returns true if a bulk load can append a key without filling the node past fillFactor.
+   * At least four children are allowed.
+   */
+	bool canAppend(const T&, const double fillFactor) const
+	{
+		return k + 1 < std::max(4, (int)((NodeCapacity<T>::NONLEAF + 1) * fillFactor)) && !isFull();
+	}
+
+  /**
+   * Set the left-most child page.
+   */
+	void setFirstChild(PageId pageNo) { pageNoArray[0] = pageNo; }
+
+  /**
+   * Insert key at position pos, with child page pageNo on its right.
+   */
+	void insert(int pos, const T& key, PageId pageNo)
+	{
+		memmove(&keyArray[pos+1], &keyArray[pos], (k - pos) * sizeof(T));
+		memmove(&pageNoArray[pos+2], &pageNoArray[pos+1], (k - pos) * sizeof(PageId));
+		keyArray[pos] = key;
+		pageNoArray[pos+1] = pageNo;
+		k++;
+	}
+
+  /**
+   * Move the keys above the middle one and their children to the empty node right.
+   *
+   * @return  The middle key, which is removed and goes up to the parent
+   */
+	T split(NonLeafNode& right)
+	{
+		const int mid = (k - 1) / 2;
+		right.level = level;
+		right.k = k - mid - 1;
+		memcpy(&right.keyArray[0], &keyArray[mid+1], right.k * sizeof(T));
+		memcpy(&right.pageNoArray[0], &pageNoArray[mid+1], (right.k + 1) * sizeof(PageId));
+		k = mid;
+		return keyArray[mid];
+	}
+
+  /**
+   * Fixed-size keys are stored whole, so there is nothing to compress.
+   */
+	void compress(const T*, const T*) {}
+
+  /**
+   * Returns true if the node is less than half full.
+   */
+	bool isUnderfull() const { return k < NodeCapacity<T>::NONLEAF / 2; }
+
+  /**
+   * Remove key i and child page i + 1.
+   */
+	void remove(int i)
+	{
+		memmove(&keyArray[i], &keyArray[i+1], (k - i - 1) * sizeof(T));
+		memmove(&pageNoArray[i+1], &pageNoArray[i+2], (k - i - 1) * sizeof(PageId));
+		k--;
+	}
+
+  /**
+   * Returns true if key i can be replaced by key.
+   */
+	bool canSetKey(int, const T&) const { return true; }
+
+  /**
+   * Replace key i by key.
+   */
+	void setKey(int i, const T& key) { keyArray[i] = key; }
+
+  /**
+   * Append the separator sep and all keys and children of the right sibling right, if they fit.
+   *
+   * @return  False, with nothing changed, if they do not fit
+   */
+	bool merge(const T& sep, const NonLeafNode& right)
+	{
+		if (k + 1 + right.k > NodeCapacity<T>::NONLEAF)
+			return false;
+		keyArray[k] = sep;
+		memcpy(&keyArray[k+1], &right.keyArray[0], right.k * sizeof(T));
+		memcpy(&pageNoArray[k+1], &right.pageNoArray[0], (right.k + 1) * sizeof(PageId));
+		k += 1 + right.k;
+		return true;
+	}
+
+  /**
+   * Even out the keys of this node and its right sibling right, rotating them through the separator sep
+   * of the parent.
+   *
+   * @return  False if nothing moved
+   */
+	bool redistribute(T& sep, NonLeafNode& right)
+	{
+		// Keys in order are this node's keys, sep, then right's keys; the middle one becomes the separator.
+		const int n = k + 1 + right.k;
+		const int mid = n / 2;
+		if (mid == k)
+			return false;
+		std::vector<T> keys(n);
+		std::vector<PageId> pages(n + 1);
+		memcpy(&keys[0], &keyArray[0], k * sizeof(T));
+		keys[k] = sep;
+		memcpy(&keys[k+1], &right.keyArray[0], right.k * sizeof(T));
+		memcpy(&pages[0], &pageNoArray[0], (k + 1) * sizeof(PageId));
+		memcpy(&pages[k+1], &right.pageNoArray[0], (right.k + 1) * sizeof(PageId));
+
+		k = mid;
+		right.k = n - mid - 1;
+		memcpy(&keyArray[0], &keys[0], k * sizeof(T));
+		memcpy(&pageNoArray[0], &pages[0], (k + 1) * sizeof(PageId));
+		sep = keys[mid];
+		memcpy(&right.keyArray[0], &keys[mid+1], right.k * sizeof(T));
+		memcpy(&right.pageNoArray[0], &pages[mid+1], (right.k + 1) * sizeof(PageId));
+		return true;
+	}
 };
 
 
 /**
- * @brief Structure for all leaf nodes when the key is of INTEGER type.
+ * @brief Structure for all leaf nodes, for a key of type T.
 */
-struct LeafNodeInt{
+template <class T>
+struct LeafNode{
   /**
    * Stores keys.
    */
-	int keyArray[ INTARRAYLEAFSIZE ];
+	T keyArray[ NodeCapacity<T>::LEAF ];
 
   /**
    * cout of the key stored.
@@ -179,68 +378,223 @@ struct LeafNodeInt{
   /**
    * Stores RecordIds.
    */
-	RecordId ridArray[ INTARRAYLEAFSIZE ];
+	RecordId ridArray[ NodeCapacity<T>::LEAF ];
 
   /**
    * Page number of the leaf on the right side.
 	 * This linking of leaves allows to easily move from one leaf to the next leaf during index scan.
    */
 	PageId rightSibPageNo;
-  LeafNodeInt():k(0),rightSibPageNo(0){};
 
-};
+  /**
+   * Separator left of the right sibling: no key of the leaf is above it.
+   */
+	T highKey;
+  LeafNode():k(0),rightSibPageNo(Page::INVALID_NUMBER),highKey(){};
 
+  /**
+   * Returns the key of entry i.
+   */
+	const T& key(int i) const { return keyArray[i]; }
 
-/**
- * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
- * relation. This index supports only one scan at a time.
-*/
-class BTreeIndex {
+  /**
+   * Returns the record of entry i.
+   */
+	RecordId rid(int i) const { return ridArray[i]; }
 
- private:
+  /**
+   * Copy the records of the count entries from entry i on to out.
+   */
+	void copyRids(int i, int count, RecordId* out) const { memcpy(out, &ridArray[i], count * sizeof(RecordId)); }
 
   /**
-   * File object for the index file.
+   * Returns true if key is above the high key, so a split has moved it to the right sibling.
    */
-	File		*file;
+	bool pastHighKey(const T& key) const { return rightSibPageNo != Page::INVALID_NUMBER && highKey < key; }
 
   /**
-   * Buffer Manager Instance.
+   * Returns the position of the first key >= key.
    */
-	BufMgr	*bufMgr;
+	int lowerBound(const T& key) const { return nodeLowerBound(keyArray, k, key); }
 
   /**
-   * Page number of meta page.
+   * Returns the position of the first key > key.
    */
-	PageId	headerPageNum;
+	int upperBound(const T& key) const { return nodeUpperBound(keyArray, k, key); }
 
   /**
-   * page number of root page of B+ tree inside index file.
+   * Returns true if there is room to insert a key.
    */
-	PageId	rootPageNum;
+	bool canInsert(const T&) const { return k < NodeCapacity<T>::LEAF; }
 
   /**
-   * Datatype of attribute over which index is built.
+   * Returns true if a bulk load can append a key without filling the node past fillFactor.
    */
-	Datatype	attributeType;
+	bool canAppend(const T&, const double fillFactor) const
+	{
+		return k < std::max(1, (int)(NodeCapacity<T>::LEAF * fillFactor)) && k < NodeCapacity<T>::LEAF;
+	}
 
   /**
-   * Offset of attribute, over which index is built, inside records. 
+   * Insert key at position pos. There must be room for it (see canInsert()).
    */
-	int 		attrByteOffset;
+	void insert(int pos, const T& key, RecordId rid)
+	{
+		memmove(&keyArray[pos+1], &keyArray[pos], (k - pos) * sizeof(T));
+		memmove(&ridArray[pos+1], &ridArray[pos], (k - pos) * sizeof(RecordId));
+		keyArray[pos] = key;
+		ridArray[pos] = rid;
+		k++;
+	}
 
   /**
-   * Number of keys in leaf node, depending upon the type of key.
+   * Move the upper half of the entries to the empty leaf right.
+   *
+   * @return  Separator between the two halves, the last key left in this leaf
    */
-	int			leafOccupancy;
+	T split(LeafNode& right)
+	{
+		const int keep = (k + 1) / 2;
+		right.k = k - keep;
+		memcpy(&right.keyArray[0], &keyArray[keep], right.k * sizeof(T));
+		memcpy(&right.ridArray[0], &ridArray[keep], right.k * sizeof(RecordId));
+		k = keep;
+		return keyArray[keep-1];
+	}
 
   /**
-   * Number of keys in non-leaf node, depending upon the type of key.
+   * Fixed-size keys are stored whole, so there is nothing to compress.
    */
-	int			nodeOccupancy;
+	void compress(const T*, const T*) {}
+
+  /**
+   * Returns true if the node is less than half full.
+   */
+	bool isUnderfull() const { return k < NodeCapacity<T>::LEAF / 2; }
+
+  /**
+   * Remove entry i.
+   */
+	void remove(int i)
+	{
+		memmove(&keyArray[i], &keyArray[i+1], (k - i - 1) * sizeof(T));
+		memmove(&ridArray[i], &ridArray[i+1], (k - i - 1) * sizeof(RecordId));
+		k--;
+	}
+
+  /**
+   * Append all entries of the right sibling right, if they fit. Sibling links are left to the caller.
+   *
+   * @return  False, with nothing changed, if they do not fit
+   */
+	bool merge(const LeafNode& right)
+	{
+		if (k + right.k > NodeCapacity<T>::LEAF)
+			return false;
+		memcpy(&keyArray[k], &right.keyArray[0], right.k * sizeof(T));
+		memcpy(&ridArray[k], &right.ridArray[0], right.k * sizeof(RecordId));
+		k += right.k;
+		return true;
+	}
+
+  /**
+   * Even out the entries of this leaf and its right sibling right.
+   *
+   * @param sep  New separator between the two leaves is returned in this
+   * @return  False if nothing moved
+   */
+	bool redistribute(LeafNode& right, T& sep)
+	{
+		const int n = k + right.k;
+		const int mid = n / 2;
+		if (mid == k || mid == 0)
+			return false;
+		if (mid > k) {
+			const int move = mid - k;
+			memcpy(&keyArray[k], &right.keyArray[0], move * sizeof(T));
+			memcpy(&ridArray[k], &right.ridArray[0], move * sizeof(RecordId));
+			memmove(&right.keyArray[0], &right.keyArray[move], (right.k - move) * sizeof(T));
+			memmove(&right.ridArray[0], &right.ridArray[move], (right.k - move) * sizeof(RecordId));
+		}
+		else {
+			const int move = k - mid;
+			memmove(&right.keyArray[move], &right.keyArray[0], right.k * sizeof(T));
+			memmove(&right.ridArray[move], &right.ridArray[0], right.k * sizeof(RecordId));
+			memcpy(&right.keyArray[0], &keyArray[mid], move * sizeof(T));
+			memcpy(&right.ridArray[0], &ridArray[mid], move * sizeof(RecordId));
+		}
+		k = mid;
+		right.k = n - mid;
+		sep = keyArray[mid-1];
+		return true;
+	}
+};
+
+/**
+ * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
+*/
+typedef NonLeafNode<int> NonLeafNodeInt;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of INTEGER type.
+*/
+typedef LeafNode<int> LeafNodeInt;
+
+/**
+ * @brief Structure for all non-leaf nodes when the key is of DOUBLE type.
+*/
+typedef NonLeafNode<double> NonLeafNodeDouble;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of DOUBLE type.
+*/
+typedef LeafNode<double> LeafNodeDouble;
+
+static_assert(sizeof(NonLeafNodeInt) <= Page::SIZE && sizeof(LeafNodeInt) <= Page::SIZE,
+              "INTEGER nodes must fit in a page.");
+static_assert(sizeof(NonLeafNodeDouble) <= Page::SIZE && sizeof(LeafNodeDouble) <= Page::SIZE,
+              "DOUBLE nodes must fit in a page.");
+
+/**
+ * @brief Node formats used for a key of type T. STRING keys use the slotted, prefix compressed nodes.
+*/
+template <class T>
+struct NodeTraits {
+	typedef NonLeafNode<T> NonLeaf;
+	typedef LeafNode<T> Leaf;
+};
+
+template <>
+struct NodeTraits<StringKey> {
+	typedef NonLeafNodeString NonLeaf;
+	typedef LeafNodeString Leaf;
+};
 
 
-	// MEMBERS SPECIFIC TO SCANNING
+class BTreeIndex;
+class FileScanWorker;
+
+/**
+ * @brief Range scan of a BTreeIndex. A cursor holds the state of one scan, so any number of cursors
+ * can scan the same index at once, also from different threads against a thread-safe BufMgr. The leaf
+ * a scan is on stays pinned until the scan is ended, at the latest when the cursor is destroyed, but
+ * it is latched only during calls, so inserts can go on meanwhile. Entries inserted into the range of
+ * a running scan may or may not be returned; every other entry of the range is returned once, in key order,
+ * also if inserts split the leaves of the scan.
+*/
+class IndexCursor {
+
+ private:
+
+  /**
+   * Index scanned.
+   */
+	BTreeIndex	*index;
+
+  /**
+   * Number of leaves a scan reads ahead of the one it is on.
+   */
+	static const int PREFETCH_LEAVES = 16;
 
   /**
    * True if an index scan has been started.
@@ -252,6 +606,38 @@ class BTreeIndex {
    */
 	int			nextEntry;
 
+  /**
+   * Index of the first entry past the high end of the scan in current leaf being scanned.
+   */
+	int			endEntry;
+
+  /**
+   * Number of entries of the current leaf when nextEntry and endEntry were set.
+   */
+	int			leafCount;
+
+  /**
+   * Right link of the current leaf when nextEntry and endEntry were set.
+   */
+	PageId	leafRightSib;
+
+  /**
+   * True if the scan has returned entries of the current leaf, the last of them being lastKey and lastRid.
+   */
+	bool		returnedFromLeaf;
+
+  /**
+   * Record id of the last entry returned.
+   */
+	RecordId	lastRid;
+
+  /**
+   * Key of the last entry returned, for INTEGER, DOUBLE and STRING keys.
+   */
+	int			lastKeyInt;
+	double	lastKeyDouble;
+	StringKey	lastKeyString;
+
   /**
    * Page number of current page being scanned.
    */
@@ -260,7 +646,12 @@ class BTreeIndex {
   /**
    * Current Page being scanned.
    */
-	Page		*currentPageData;
+	const Page	*currentPageData;
+
+  /**
+   * Last leaf read ahead by the scan, or Page::INVALID_NUMBER to read ahead again from the next leaf.
+   */
+	PageId	prefetchedLeafNum;
 
   /**
    * Low INTEGER value for scan.
@@ -275,7 +666,7 @@ class BTreeIndex {
   /**
    * Low STRING value for scan.
    */
-	std::string	lowValString;
+	StringKey	lowValString;
   
   /**
    * High INTEGER value for scan.
@@ -290,7 +681,7 @@ class BTreeIndex {
   /**
    * High STRING value for scan.
    */
-	std::string highValString;
+	StringKey highValString;
 	
   /**
    * Low Operator. Can only be GT(>) or GTE(>=).
@@ -302,23 +693,210 @@ class BTreeIndex {
    */
 	Operator	highOp;
 
+ public:
+
+  /**
+   * Constructs a cursor of index, with no scan started.
+   */
+	explicit IndexCursor(BTreeIndex *index);
+
+  /**
+   * Ends the scan, if one is running, unpinning its leaf.
+   */
+	~IndexCursor();
+
+  /**
+	 * Begin a filtered scan of the index, ending the scan of this cursor if one is running.
+	 * See BTreeIndex::startScan().
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values 
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+	**/
+	void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan. See BTreeIndex::scanNext().
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	void scanNext(RecordId& outRid);
+
+  /**
+	 * Fetch the record ids of up to max next index entries that match the scan. See BTreeIndex::scanNextBatch().
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	std::size_t scanNextBatch(RecordId* outRids, const std::size_t max);
+
+  /**
+	 * Terminate the scan, unpinning its leaf.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	void endScan();
+
+  /**
+   * Returns true if a scan has been started and not ended.
+   */
+	bool isScanning() const { return scanExecuting; }
+
+ private:
+  /**
+   * Cursors hold pinned pages and are not copied.
+   */
+	IndexCursor(const IndexCursor&);
+	IndexCursor& operator=(const IndexCursor&);
+
+    /**
+   * Descend to the leaf holding the first entry >= the low value of the scan, for a key of type T.
+  **/
+  template <class T>
+  void startScan();
+    /**
+   * Fetch the next entry of the scan, for a key of type T.
+  **/
+  template <class T>
+  void scanNext(RecordId& outRid);
+    /**
+   * Fetch up to max next entries of the scan, for a key of type T.
+  **/
+  template <class T>
+  std::size_t scanNextBatch(RecordId* outRids, const std::size_t max);
+    /**
+   * Move the scan to the next leaf, reading ahead the leaves after it if needed, for a key of type T.
+   * @return  False, with the scan left where it is, if the scan range ends on the current leaf
+  **/
+  template <class T>
+  bool nextLeaf();
+    /**
+   * Set nextEntry and endEntry to the entries of the current leaf inside the scan range, for a key of type T.
+  **/
+  template <class T>
+  void scanLeafRange();
+    /**
+   * Latch the current leaf SHARED, for a key of type T. If inserts changed the leaf since, the scan goes on after
+   * the last entry it returned, moving right if a split took that entry to another leaf.
+  **/
+  template <class T>
+  void latchLeaf();
+    /**
+   * Read ahead the leaves of the scan range right of child c of parent, a node of level 1, for a key of type T.
+   * The leaves are linked in key order but not numbered in it, so the parent is the one place listing the next ones.
+  **/
+  template <class T>
+  void prefetchLeaves(const typename NodeTraits<T>::NonLeaf* parent, const int c);
+    /**
+   * Descend to the parent of the leaf holding key, and read ahead the leaves of the scan range after it, for a key of type T.
+  **/
+  template <class T>
+  void prefetchLeavesAfter(const T& key);
+    /**
+   * Low and high values of the current scan, for a key of type T.
+  **/
+  template <class T>
+  T& lowVal();
+  template <class T>
+  T& highVal();
+    /**
+   * Key of the last entry returned, for a key of type T.
+  **/
+  template <class T>
+  T& lastKey();
+};
+
+
+/**
+ * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
+ * relation. The index runs one scan at a time through startScan() and scanNext(); more scans run at
+ * once through IndexCursor objects.
+*/
+class BTreeIndex {
+  friend class IndexCursor;
+
+ private:
+
+  /**
+   * File object for the index file.
+   */
+	BlobFile	*file;
+
+  /**
+   * True if the index is read-only and its nodes are addressed in a memory mapping of the file
+   * instead of being read into the buffer pool.
+   */
+	bool		mapped;
+
+  /**
+   * Buffer Manager Instance.
+   */
+	BufMgr	*bufMgr;
+
+  /**
+   * Page number of meta page.
+   */
+	PageId	headerPageNum;
+
+  /**
+   * page number of root page of B+ tree inside index file. Readers load it without a latch (see readRoot()).
+   */
+	std::atomic<PageId>	rootPageNum;
+
+  /**
+   * Held EXCLUSIVE by an insert until it knows the root will not split, so inserts never see the root
+   * replaced. Readers do not take it.
+   */
+	Latch		rootLatch;
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+	Datatype	attributeType;
+
+  /**
+   * Offset of attribute, over which index is built, inside records. 
+   */
+	int 		attrByteOffset;
+
+  /**
+   * Number of keys in leaf node, depending upon the type of key.
+   */
+	int			leafOccupancy;
+
+  /**
+   * Number of keys in non-leaf node, depending upon the type of key.
+   */
+	int			nodeOccupancy;
+
+
+  /**
+   * The scan run by startScan(), scanNext(), scanNextBatch() and endScan().
+   */
+	IndexCursor	scan;
+
+
 	
  public:
 
   /**
    * BTreeIndex Constructor. 
 	 * Check to see if the corresponding index file exists. If so, open the file.
-	 * If not, create it and insert entries for every tuple in the base relation using FileScan class.
+	 * If not, create it, collect <key, rid> pairs for every tuple in the base relation, reading and sorting
+	 * ranges of its pages in parallel (spilling sorted runs to disk once they exceed the buffer pool), and
+	 * bulk load the tree bottom up from the merged ranges.
    *
    * @param relationName        Name of file.
    * @param outIndexName        Return the name of index file.
    * @param bufMgrIn						Buffer Manager Instance
    * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
    * @param attrType						Datatype of attribute over which index is built
+   * @param fillFactor					Fraction of each node filled when a new index is bulk loaded, in (0, 1]
+   * @param mapped							Open the index read-only, for read-mostly use: once the index is opened or built, the file is
+   *													mapped into memory and scans address the nodes in place, served from the OS page cache
+   *													instead of copies in the buffer pool. Inserts and deletes then throw IndexReadOnlyException.
+   * @param buildThreads				Number of threads that read and sort the relation when a new index is built, or 0 for one per core
    * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters.
    */
 	BTreeIndex(const std::string & relationName, std::string & outIndexName,
-						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType);
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const double fillFactor = 1.0, const bool mapped = false, const unsigned buildThreads = 0);
 	
 
   /**
@@ -336,12 +914,55 @@ class BTreeIndex {
 	 * This splitting will require addition of new leaf page number entry into the parent non-leaf, which may in-turn get split.
 	 * This may continue all the way upto the root causing the root to get split. If root gets split, metapage needs to be changed accordingly.
 	 * Make sure to unpin pages as soon as you can.
+	 * Any number of threads can insert at once, and with lookups and scans. Full nodes are split on the way down, so
+	 * the insert latches each node EXCLUSIVE only until it has latched a child with room, and threads working on other
+	 * subtrees go on unhindered. deleteEntry() must not run at the same time as any other operation on the index.
    * @param key			Key to insert, pointer to integer/double/char string
    * @param rid			Record ID of a record whose entry is getting inserted into the index.
+	 * @throws  IndexReadOnlyException If the index was opened mapped.
+	 * @throws  BufferExceededException If the buffer pool has no frame for a node on the way down. The entry is not
+	 *                                  inserted, and the index stays usable.
 	**/
 	const void insertEntry(const void* key, const RecordId rid);
 
 
+  /**
+	 * Delete the entry <value,rid>.
+	 * Start from root to find the leaf holding the entry and remove it. A node left less than half full is
+	 * merged with a sibling, or takes entries from it if the two do not fit in one node. Merging removes a
+	 * separator from the parent, which may become underfull in turn. When the root is left with a single
+	 * child that child becomes the root, and the metapage is changed accordingly. Freed pages are reused by
+	 * later inserts. A scan in progress is ended first.
+   * @param key			Key to delete, pointer to integer/double/char string
+   * @param rid			Record ID of the record whose entry is getting deleted from the index.
+	 * @throws  NoSuchKeyFoundException If the index holds no entry <value,rid>.
+	 * @throws  IndexReadOnlyException If the index was opened mapped.
+	**/
+	const void deleteEntry(const void* key, const RecordId rid);
+
+
+  /**
+	 * Find every entry with the given key.
+	 * Descend once from the root to the first leaf that can hold the key and binary search it, moving right
+	 * only while duplicates of the key go on into the next leaf. No scan is set up, no page stays pinned and
+	 * a missing key is not an error, so lookups can run from several threads at once like cursors do.
+	 * A lookup latches one node at a time and follows right links past splits made by inserts running
+	 * meanwhile, so lookups scale with the threads running them.
+   * @param key			Key to look up, pointer to integer/double/char string
+   * @param callback	Called with the record id of each entry in turn; returning false stops the lookup
+   * @return				Number of entries passed to callback
+	**/
+	const std::size_t lookup(const void* key, const std::function<bool(const RecordId&)>& callback);
+
+  /**
+	 * Find every entry with the given key, as lookup() with a callback does.
+   * @param key			Key to look up, pointer to integer/double/char string
+   * @param outRids	Record ids of the entries are appended to this
+   * @return				Number of entries found
+	**/
+	const std::size_t lookup(const void* key, std::vector<RecordId>& outRids);
+
+
   /**
 	 * Begin a filtered scan of the index.  For instance, if the method is called 
 	 * using ("a",GT,"d",LTE) then we should seek all entries with a value 
@@ -371,26 +992,199 @@ class BTreeIndex {
 
 	const void scanNext(RecordId& outRid);  // returned record id
 
+  /**
+	 * Fetch the record ids of up to max next index entries that match the scan.
+	 * The entries of each leaf inside the scan range are found with one binary search per bound when the
+	 * scan reaches the leaf, and copied out as a whole, so there is no per entry check.
+   * @param outRids	Array of at least max record ids the entries are returned in
+   * @param max			Largest number of entries to return
+   * @return				Number of entries returned, less than max only once the scan is complete; 0 when no
+   *								entries are left
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	const std::size_t scanNextBatch(RecordId* outRids, const std::size_t max);
+
   /**
 	 * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
 	 * @throws ScanNotInitializedException If no scan has been initialized.
 	**/
 	const void endScan();
+
+  /**
+	 * Split a scan range into up to count disjoint subranges, each spanning about as many leaves, and start a
+	 * cursor on each. The subranges are bounded by separator keys of the highest non-leaf level that has enough
+	 * of them inside the range, so no leaf is read. The cursors are independent of each other and of the scan
+	 * of the index, so each can be handed to its own thread; together they return the entries one scan of the
+	 * whole range returns.
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @param count		Largest number of subranges, at least 1
+   * @param cursors	Started cursors are appended to this in key order, and owned by the caller
+   * @return				Number of cursors appended, fewer than count if the range spans too few leaves
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If the index is empty.
+	**/
+	const std::size_t partitionScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp,
+	                                const std::size_t count, std::vector< std::unique_ptr<IndexCursor> >& cursors);
+
   /**
-   * insert rid with key value val to the non full node
+   * insert rid with key value val to the non full node, page nodePageNo, which the caller has got with writeNode()
    * @if a node is full, recursive call splitChildren and insertNonfull to split a full node and insert deeper
+   * The node is released as soon as the child to insert into has room.
+   * @throws  BufferExceededException If a page on the way down cannot be had; every node still held is released
   **/
-	void insertNonFull(NonLeafNodeInt* node , int val, RecordId rid);
+  template <class T>
+	void insertNonFull(typename NodeTraits<T>::NonLeaf* node, const PageId nodePageNo, const T& val, RecordId rid);
     /**
    * when a node if full, split it to 2 half full nodes and modify the parent node
    * @if node->level ==1 ,we are spliting the leaf node of the parent
+   * @throws  BufferExceededException If the new page cannot be had; neither node is changed then
   **/
-  void splitChildren(NonLeafNodeInt* node, int c);
+  template <class T>
+  void splitChildren(typename NodeTraits<T>::NonLeaf* node, int c);
     /**
    * The method is designed to debugging the tree building
    * @if the tree is correctly built, the method will print the key from the left-most to the right-most
   **/
   void printall();
+
+ private:
+    /**
+   * Insert entry for a key of type T. Splits the root first if it is full.
+  **/
+  template <class T>
+  void insertKey(const T& key, const RecordId rid);
+    /**
+   * Delete entry for a key of type T. Makes the only child of the root the new root.
+   * @throws  NoSuchKeyFoundException If there is no such entry.
+  **/
+  template <class T>
+  void deleteKey(const T& key, const RecordId rid);
+    /**
+   * Delete entry <key, rid> from the subtree of node, rebalancing any child left underfull.
+   * @return  True if the entry was found
+  **/
+  template <class T>
+  bool deleteFrom(typename NodeTraits<T>::NonLeaf* node, const T& key, const RecordId rid);
+    /**
+   * Merge underfull child c of node with a sibling, or move entries over from the sibling if both do not fit in one node.
+  **/
+  template <class T>
+  void rebalance(typename NodeTraits<T>::NonLeaf* node, const int c);
+    /**
+   * Pin node pageNo in the buffer pool, or address it in place in the mapping of a mapped index.
+  **/
+  const Page* pinNode(const PageId pageNo);
+    /**
+   * Unpin a node pinned with pinNode().
+  **/
+  void unpinNode(const PageId pageNo);
+    /**
+   * Latch a pinned node in mode; nothing to do in a mapped index.
+  **/
+  void latchNode(const Page* page, const LatchMode mode);
+    /**
+   * Release the latch of a node taken with latchNode().
+  **/
+  void unlatchNode(const Page* page, const LatchMode mode);
+    /**
+   * Get node pageNo for reading: pinned and latched SHARED.
+  **/
+  const Page* readNode(const PageId pageNo);
+    /**
+   * Release a node got with readNode().
+  **/
+  void releaseNode(const PageId pageNo, const Page* page);
+    /**
+   * Get the root for reading, as readNode() does, returning its page number in pageNo.
+  **/
+  const Page* readRoot(PageId& pageNo);
+    /**
+   * Follow right links from node pageNo, got with readNode(), while key is above its high key, holding one
+   * latch at a time. Returns the node that holds key, with its page number in pageNo.
+  **/
+  template <class Node, class T>
+  const Page* moveRight(const T& key, PageId& pageNo, const Page* page);
+    /**
+   * Get the level 1 node holding key for reading, as readNode() does, returning its page number in pageNo.
+   * Readers go down B-link style: a node is let go before its child is latched, and splits raced on the
+   * way are caught up with by moveRight(), so a reader holds one latch at a time and never waits while holding one.
+  **/
+  template <class T>
+  const typename NodeTraits<T>::NonLeaf* readLeafParent(const T& key, PageId& pageNo);
+    /**
+   * Get node pageNo for writing: pinned and latched EXCLUSIVE.
+  **/
+  Page* writeNode(const PageId pageNo);
+    /**
+   * Release a node got with writeNode(), or a new page latched EXCLUSIVE.
+  **/
+  void releaseWrite(const PageId pageNo, Page* page, const bool dirty);
+    /**
+   * Pass the record id of every entry with key to callback until it returns false, for a key of type T.
+   * @return  Number of entries passed to callback
+  **/
+  template <class T, class Callback>
+  std::size_t lookupKey(const T& key, Callback& callback);
+    /**
+   * partitionScan() for a key of type T.
+  **/
+  template <class T>
+  std::size_t partitionRange(const T& low, const Operator lowOp, const T& high, const Operator highOp,
+                            const std::size_t count, std::vector< std::unique_ptr<IndexCursor> >& cursors);
+    /**
+   * Collect in seps, in ascending order, the separator keys in [low, high) of the highest non-leaf level
+   * that has at least want of them, or of the level above the leaves. Each separator bounds a child on
+   * the right, so consecutive separators of one level are apart by a subtree of the same height.
+  **/
+  template <class T>
+  void rangeSeparators(const T& low, const T& high, const std::size_t want, std::vector<T>& seps);
+    /**
+   * Call lookupKey() with key read as the key type of the index.
+  **/
+  template <class Callback>
+  std::size_t lookupAny(const void* key, Callback& callback);
+    /**
+   * Make pageNo the root page and record it in the metapage.
+  **/
+  void setRootPageNum(const PageId pageNo);
+    /**
+   * Print every key from the left-most to the right-most leaf, for a key of type T.
+  **/
+  template <class T>
+  void printall();
+    /**
+   * Collect <key, rid> pairs of type T for every tuple of the relation, sort them and bulk load the tree.
+   * The threads take morsels of the used pages of the relation from a ParallelFileScan and each collects and
+   * sorts the pairs of the morsels it took; the sorted pairs of all threads are then merged into the bulk load.
+   * @param relationName  Name of the base relation
+   * @param indexName     Name of the index file, used as prefix of the sort run files
+   * @param fillFactor    Fraction of each node to fill, in (0, 1]
+   * @param buildThreads  Number of threads, or 0 for one per core
+  **/
+  template <class T>
+  void buildIndex(const std::string & relationName, const std::string & indexName, const double fillFactor,
+                  const unsigned buildThreads);
+    /**
+   * Add the <key, rid> pairs of type T of every record scan comes across to sorter, until the scan runs out of morsels.
+   * @param scan      Worker of a parallel scan of the base relation
+   * @param sorter    Sorter the pairs are added to
+  **/
+  template <class T>
+  void collectEntries(FileScanWorker& scan, ExternalSorter< RIDKeyPair<T> >& sorter);
+    /**
+   * Build the tree bottom up from entries already sorted by key.
+   * Leaves are filled to fillFactor and written left to right, each linked to the next through rightSibPageNo,
+   * then every non-leaf level is built from the (page, highest key) pairs of the level below until one root remains.
+   * Every node gets the right link and high key of a B-link tree.
+   * @param entries     Sorted source of <key, rid> pairs
+   * @param fillFactor  Fraction of each node to fill, in (0, 1]
+  **/
+  template <class T>
+  void bulkLoad(SortedMerge< RIDKeyPair<T> >& entries, const double fillFactor);
 };
   
 }
@@ -5,6 +5,7 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <cstdlib>
 #include <memory>
 #include <iostream>
 #include "buffer.h"
@@ -15,100 +16,142 @@
 
 namespace badgerdb {
 
-int BufHashTbl::hash(const File* file, const PageId pageNo)
+std::uint64_t BufHashTbl::makeKey(const File* file, const PageId pageNo)
 {
-  int tmp, value;
-  tmp = (long)file;  // cast of pointer to the file object to an integer
-  value = (tmp + pageNo) % HTSIZE;
-  return value;
+  return ((std::uint64_t)file->id() << 32) | pageNo;
+}
+
+std::size_t BufHashTbl::hash(const std::uint64_t key) const
+{
+  // Finalizer of MurmurHash3: every bit of the key affects every bit of the hash, so consecutive
+  // pages of a file land far apart.
+  std::uint64_t h = key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h & (HTSIZE - 1);
 }
 
 BufHashTbl::BufHashTbl(int htSize)
-	: HTSIZE(htSize)
+	: HTSIZE(16), numEntries(0), version(0)
 {
-  // allocate an array of pointers to hashBuckets
-  ht = new hashBucket* [htSize];
-  for(int i=0; i < HTSIZE; i++)
-    ht[i] = NULL;
+  while (HTSIZE < 2 * (std::size_t)htSize)
+    HTSIZE *= 2;
+
+  // allocate the buckets on a cache line boundary
+  void* mem;
+  if (posix_memalign(&mem, 64, HTSIZE * sizeof(hashBucket)) != 0)
+    throw HashTableException();
+  ht = static_cast<hashBucket*>(mem);
+  for(std::size_t i = 0; i < HTSIZE; i++) {
+    ht[i].key.store(EMPTY_KEY, std::memory_order_relaxed);
+    ht[i].frameNo.store(0, std::memory_order_relaxed);
+  }
 }
 
 BufHashTbl::~BufHashTbl()
 {
-  for(int i = 0; i < HTSIZE; i++) {
-    hashBucket* tmpBuf = ht[i];
-    while (ht[i]) {
-      tmpBuf = ht[i];
-      ht[i] = ht[i]->next;
-      delete tmpBuf;
-    }
-  }
-  delete [] ht;
+  free(ht);
 }
 
 void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
 {
-  int index = hash(file, pageNo);
-
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-  		throw HashAlreadyPresentException(tmpBuc->file->filename(), tmpBuc->pageNo, tmpBuc->frameNo);
-    tmpBuc = tmpBuc->next;
+  const std::uint64_t key = makeKey(file, pageNo);
+  std::lock_guard<std::mutex> lock(writeLatch);
+
+  std::size_t index = hash(key);
+  for (; ; index = (index + 1) & (HTSIZE - 1)) {
+    const std::uint64_t bucketKey = ht[index].key.load(std::memory_order_relaxed);
+    if (bucketKey == EMPTY_KEY)
+      break;
+    if (bucketKey == key)
+  		throw HashAlreadyPresentException(file->filename(), pageNo, ht[index].frameNo.load(std::memory_order_relaxed));
   }
 
-  tmpBuc = new hashBucket;
-  if (!tmpBuc)
+  if (numEntries >= HTSIZE / 2)
   	throw HashTableException();
 
-  tmpBuc->file = (File*) file;
-  tmpBuc->pageNo = pageNo;
-  tmpBuc->frameNo = frameNo;
-  tmpBuc->next = ht[index];
-  ht[index] = tmpBuc;
+  // Publish the frame before the key, so a reader that sees the key sees the frame too.
+  ht[index].frameNo.store(frameNo, std::memory_order_relaxed);
+  ht[index].key.store(key, std::memory_order_release);
+  numEntries++;
 }
 
-void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) 
+bool BufHashTbl::find(const File* file, const PageId pageNo, FrameId &frameNo) const
 {
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-    {
-      frameNo = tmpBuc->frameNo; // return frameNo by reference
-      return;
+  const std::uint64_t key = makeKey(file, pageNo);
+  while (1) {
+    const std::uint64_t before = version.load(std::memory_order_acquire);
+    if (before & 1)
+      continue;
+
+    bool found = false;
+    FrameId frame = 0;
+    for (std::size_t index = hash(key); ; index = (index + 1) & (HTSIZE - 1)) {
+      const std::uint64_t bucketKey = ht[index].key.load(std::memory_order_acquire);
+      if (bucketKey == EMPTY_KEY)
+        break;
+      if (bucketKey == key) {
+        frame = ht[index].frameNo.load(std::memory_order_acquire);
+        found = true;
+        break;
+      }
     }
-    tmpBuc = tmpBuc->next;
+
+    // Entries moved by a remove() in the meantime may have been missed or misread: probe again.
+    if (version.load(std::memory_order_acquire) != before)
+      continue;
+    if (found)
+      frameNo = frame;
+    return found;
   }
+}
 
-  throw HashNotFoundException(file->filename(), pageNo);
+void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) 
+{
+  if (!find(file, pageNo, frameNo))
+    throw HashNotFoundException(file->filename(), pageNo);
 }
 
 void BufHashTbl::remove(const File* file, const PageId pageNo) {
 
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  hashBucket* prevBuc = NULL;
+  const std::uint64_t key = makeKey(file, pageNo);
+  std::lock_guard<std::mutex> lock(writeLatch);
 
-  while (tmpBuc)
+  const std::size_t mask = HTSIZE - 1;
+  std::size_t hole = hash(key);
+  while (1)
 	{
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-		{
-      if(prevBuc) 
-				prevBuc->next = tmpBuc->next;
-      else
-				ht[index] = tmpBuc->next;
+    const std::uint64_t bucketKey = ht[hole].key.load(std::memory_order_relaxed);
+    if (bucketKey == key)
+      break;
+    if (bucketKey == EMPTY_KEY)
+      throw HashNotFoundException(file->filename(), pageNo);
+    hole = (hole + 1) & mask;
+  }
 
-      delete tmpBuc;
-      return;
-    }
-		else
+  // Move back every later entry of the probe run whose home bucket is not between the hole and itself,
+  // so no entry ends up behind a free bucket on its probe path.
+  version.fetch_add(1, std::memory_order_acq_rel);
+  for (std::size_t index = (hole + 1) & mask; ; index = (index + 1) & mask)
+	{
+    const std::uint64_t bucketKey = ht[index].key.load(std::memory_order_relaxed);
+    if (bucketKey == EMPTY_KEY)
+      break;
+    const std::size_t home = hash(bucketKey);
+    const bool reachable = hole <= index ? (hole < home && home <= index) : (hole < home || home <= index);
+    if (!reachable)
 		{
-      prevBuc = tmpBuc;
-      tmpBuc = tmpBuc->next;
+      ht[hole].frameNo.store(ht[index].frameNo.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      ht[hole].key.store(bucketKey, std::memory_order_release);
+      hole = index;
     }
   }
-
-  throw HashNotFoundException(file->filename(), pageNo);
+  ht[hole].key.store(EMPTY_KEY, std::memory_order_release);
+  numEntries--;
+  version.fetch_add(1, std::memory_order_release);
 }
 
 }
@@ -7,7 +7,11 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
 #include "file.h"
+#include "types.h"
 
 namespace badgerdb {
 
@@ -16,56 +20,80 @@ namespace badgerdb {
 */
 struct hashBucket {
 	/**
-	 * pointer a file object (more on this below)
+	 * (file id, page number) of the entry, or EMPTY_KEY if the bucket is free
 	 */
-	File *file;
-
-	/**
-	 * page number within a file
-	 */
-	PageId pageNo;
+	std::atomic<std::uint64_t> key;
 
 	/**
 	 * frame number of page in the buffer pool
 	 */
-	FrameId frameNo;
-
-	/**
-	 * Next node in the hash table
-	 */
-	hashBucket*   next;
+	std::atomic<FrameId> frameNo;
 };
 
 
 /**
 * @brief Hash table class to keep track of pages in the buffer pool
 *
-* @warning This class is not threadsafe.
+* Open addressing with linear probing over an array of buckets aligned to cache lines, so a probe
+* usually touches a single line. Entries are keyed on the file id and page number packed in 64 bits,
+* spread over the table by a 64-bit mixing hash. Removal shifts later entries of the probe run back
+* instead of leaving tombstones, so unsuccessful lookups stay short however many pages come and go.
+*
+* find() and lookup() take no lock and can run in any number of threads at once. insert() and remove() are
+* serialized by a mutex; remove() bumps a version around the entries it moves, and a lookup that
+* overlapped it probes again.
 */
 class BufHashTbl
 {
  private:
 	/**
-	 *	Size of Hash Table
+	 * Key of a free bucket. File ids start at 1, so no entry has this key.
 	 */
-  int HTSIZE;
+	static const std::uint64_t EMPTY_KEY = 0;
+
+	/**
+	 *	Number of buckets, a power of two
+	 */
+  std::size_t HTSIZE;
+
 	/**
 	 * Actual Hash table object
 	 */
-  hashBucket**  ht;
+  hashBucket*  ht;
+
+	/**
+	 * Number of entries in the table
+	 */
+  std::size_t numEntries;
+
+	/**
+	 * Odd while remove() is moving entries; incremented before and after
+	 */
+  std::atomic<std::uint64_t> version;
 
 	/**
-	 * returns hash value between 0 and HTSIZE-1 computed using file and pageNo
+	 * Serializes insert() and remove()
+	 */
+  std::mutex writeLatch;
+
+	/**
+	 * returns the key of (file, pageNo): the file id in the high and the page number in the low 32 bits
+	 */
+  static std::uint64_t makeKey(const File* file, const PageId pageNo);
+
+	/**
+	 * returns hash value between 0 and HTSIZE-1 computed from a key
 	 *
-	 * @param file   	File object
-	 * @param pageNo  Page number in the file
+	 * @param key   	Key made by makeKey()
 	 * @return  			Hash value.
 	 */
-  int	 hash(const File* file, const PageId pageNo);
+  std::size_t hash(const std::uint64_t key) const;
 
  public:
 	/**
    * Constructor of BufHashTbl class
+	 *
+	 * @param htSize	Number of entries the table must hold; at least twice as many buckets are allocated
 	 */
 	BufHashTbl(const int htSize);  // constructor
 
@@ -81,13 +109,24 @@ class BufHashTbl
 	 * @param pageNo 	Page number in the file
 	 * @param frameNo Frame number assigned to that page of the file
    * @throws  HashAlreadyPresentException	if the corresponding page already exists in the hash table
-   * @throws  HashTableException (optional) if could not create a new bucket as running of memory
+   * @throws  HashTableException if half of the buckets are already taken
 	 */
   void insert(const File* file, const PageId pageNo, const FrameId frameNo);
 
 	/**
    * Check if (file, pageNo) is currently in the buffer pool (ie. in
-   * the hash table).
+   * the hash table). Lock free, and does not throw on a miss.
+	 *
+	 * @param file  	File object
+	 * @param pageNo	Page number in the file
+	 * @param frameNo Frame number reference, set only if the page is found
+	 * @return  True if the page entry is in the hash table
+	 */
+  bool find(const File* file, const PageId pageNo, FrameId &frameNo) const;
+
+	/**
+   * Check if (file, pageNo) is currently in the buffer pool (ie. in
+   * the hash table). Throwing wrapper around find().
 	 *
 	 * @param file  	File object
 	 * @param pageNo	Page number in the file
@@ -5,23 +5,31 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <condition_variable>
 #include <memory>
 #include <iostream>
+#include <thread>
+#include <vector>
 #include "buffer.h"
 #include "exceptions/buffer_exceeded_exception.h"
+#include "exceptions/insufficient_space_exception.h"
 #include "exceptions/page_not_pinned_exception.h"
 #include "exceptions/page_pinned_exception.h"
 #include "exceptions/bad_buffer_exception.h"
-#include "exceptions/hash_not_found_exception.h"
 
 namespace badgerdb { 
 
+const std::uint32_t BufMgr::READ_AHEAD_MIN;
+const std::uint32_t BufMgr::READ_AHEAD_MAX;
+
 //----------------------------------------
 // Constructor of the class BufMgr
 //----------------------------------------
 
-BufMgr::BufMgr(std::uint32_t bufs)
-	: numBufs(bufs) {
+BufMgr::BufMgr(std::uint32_t bufs, std::uint32_t shardCount, ReplacementPolicyType policy)
+	: numBufs(bufs), numShards(std::max(1u, std::min(shardCount, bufs))),
+	  readAheadLimit(std::min(READ_AHEAD_MAX, bufs / 4)) {
 	bufDescTable = new BufDesc[bufs];
 
   for (FrameId i = 0; i < bufs; i++) 
@@ -32,178 +40,484 @@ BufMgr::BufMgr(std::uint32_t bufs)
 
   bufPool = new Page[bufs];
 
-  int htsize = ((((int) (bufs * 1.2))*2)/2)+1;
-  hashTable = new BufHashTbl (htsize);  // allocate the buffer hash table
+  // split the frames over the shards, the first bufs % numShards shards get one extra
+  shards = new BufShard[numShards];
+  FrameId first = 0;
+  for (std::uint32_t i = 0; i < numShards; i++)
+  {
+  	BufShard& shard = shards[i];
+  	shard.firstFrame = first;
+  	shard.numFrames = bufs / numShards + (i < bufs % numShards ? 1 : 0);
+  	shard.policy = ReplacementPolicy::create(policy, bufDescTable, first, shard.numFrames);
+  	first += shard.numFrames;
+
+  	int htsize = ((((int) (shard.numFrames * 1.2))*2)/2)+1;
+  	shard.hashTable = new BufHashTbl (htsize);  // allocate the buffer hash table
+  }
 
-  clockHand = bufs - 1;
+  ioEngine = IoEngine::create(IO_QUEUE_DEPTH);
 }
 
 
 BufMgr::~BufMgr() {
+  // wait for the reads in flight
+  delete ioEngine;
+
   //Flush out all unwritten pages
   for (std::uint32_t i = 0; i < numBufs; i++) 
   {
   	BufDesc* tmpbuf = &bufDescTable[i];
   	if (tmpbuf->valid == true && tmpbuf->dirty == true)
 		{
-			tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
+			tmpbuf->file.load()->writePage(tmpbuf->pageNo, bufPool[i]);
   	}
   }
 
   delete [] bufDescTable;
   delete [] bufPool;
+  for (std::uint32_t i = 0; i < numShards; i++)
+  {
+  	delete shards[i].policy;
+  	delete shards[i].hashTable;
+  }
+  delete [] shards;
 }
 
-void BufMgr::allocBuf(FrameId & frame) 
+std::mutex& BufMgr::partitionLatch(const File* file, const PageId pageNo)
 {
-  // perform first part of clock algorithm to search for 
-  // open buffer frame
-  // Assumes non-concurrent access to buffer manager
-  std::uint32_t numScanned = 0;
-  bool found = 0;
+  // Fibonacci hashing of the (file, page) pair
+  return partitionLatches[((pageKey(file, pageNo) * 0x9e3779b97f4a7c15ULL) >> 32) % LATCH_PARTITIONS];
+}
 
-  while (numScanned < 2*numBufs)	//Need to scn twice
-  {
-    // advance the clock
-    advanceClock();
-    numScanned++;
+BufShard& BufMgr::shardOf(const File* file, const PageId pageNo)
+{
+  // Fibonacci hashing again, but from other bits than the partition latches
+  return shards[((pageKey(file, pageNo) * 0x9e3779b97f4a7c15ULL) >> 40) % numShards];
+}
 
-    // if invalid, use frame
-    if (! bufDescTable[clockHand].valid)
-    {
-      break;
-    }
+bool BufMgr::tryPinPage(const File* file, const PageId pageNo, FrameId& frameNo, bool& claimed)
+{
+  claimed = false;
+  FrameId frame = 0;
+  BufShard& shard = shardOf(file, pageNo);
+  if (!shard.hashTable->find(file, pageNo, frame))
+    return false;
+
+  BufDesc* desc = &bufDescTable[frame];
+  if (!desc->tryPin())
+  {
+    claimed = true;
+    return false;
+  }
 
-    // is valid, check referenced bit
-    if (! bufDescTable[clockHand].refbit)
-    {
-      // check to see if someone has it pinned
-      if (bufDescTable[clockHand].pinCnt == 0)
-      {
-        // hasn't been referenced and is not pinned, use it
-        // remove previous entry from hash table
-        hashTable->remove(bufDescTable[clockHand].file, bufDescTable[clockHand].pageNo);
-        found = true;
-        break;
-      }
-    }
-    else
-    {
-      // has been referenced, clear the bit
-      bufStats.accesses++;
-      bufDescTable[clockHand].refbit = false;
-    }
+  // The frame may have been given to another page between the lookup and the pin. Once pinned it
+  // cannot change any more.
+  if (desc->valid && desc->file == file && desc->pageNo == pageNo)
+  {
+    shard.policy->pageHit(frame);
+    frameNo = frame;
+    return true;
   }
-  
-  // check for full buffer pool
-  if (!found && numScanned >= 2*numBufs)
+  desc->pinCnt.fetch_sub(1, std::memory_order_release);
+  claimed = true;
+  return false;
+}
+
+void BufMgr::evictFrame(const FrameId frameNo)
+{
+  BufDesc* desc = &bufDescTable[frameNo];
+  BufShard& shard = shardOf(desc->file, desc->pageNo);
+
+  // flush any existing changes to disk if necessary. The page stays in the hash table until it is
+  // written, so a thread that wants it back waits for the claim instead of reading a stale copy.
+  if (desc->dirty)
   {
-    throw BufferExceededException();
+    shard.stats.diskwrites++;
+    desc->file.load()->writePage(desc->pageNo, bufPool[frameNo]);
   }
-  
-  // flush any existing changes to disk if necessary
-  if (bufDescTable[clockHand].dirty)
+
+  // remove previous entry from hash table
+  shard.hashTable->remove(desc->file, desc->pageNo);
+  desc->clearPage();
+}
+
+bool BufMgr::tryAllocBuf(BufShard& shard, const std::uint64_t key, FrameId & frame) 
+{
+  BufDesc* descs = bufDescTable;
+  if (!shard.policy->chooseVictim(key, [descs](FrameId frameNo) { return descs[frameNo].tryClaim(); }, frame))
+    return false;
+
+  if (bufDescTable[frame].valid)
+    evictFrame(frame);
+  return true;
+} // end tryAllocBuf
+
+void BufMgr::releaseFrame(BufShard& shard, const FrameId frameNo)
+{
+  shard.policy->pageDropped(frameNo);
+  bufDescTable[frameNo].Clear();
+}
+
+IoRequest BufMgr::loadRequest(BufShard& shard, File* file, const PageId pageNo, const FrameId frameNo,
+    const PageCallback& loaded)
+{
+  BufShard* readShard = &shard;
+  IoRequest request = { IoRequest::READ, file, pageNo, &bufPool[frameNo],
+    [this, readShard, file, pageNo, frameNo, loaded](std::exception_ptr error) {
+      if (error)
+      {
+        readShard->hashTable->remove(file, pageNo);
+        releaseFrame(*readShard, frameNo);
+        loaded(NULL, error);
+        return;
+      }
+      readShard->stats.diskreads++;
+
+      // set up the entry properly; the claim becomes a pin
+      bufDescTable[frameNo].Set(file, pageNo);
+      readShard->policy->pageLoaded(frameNo, pageKey(file, pageNo));
+      loaded(&bufPool[frameNo], error);
+    } };
+  return request;
+}
+
+void BufMgr::prefetchPage(File* file, const PageId pageNo, std::vector<IoRequest>& batch)
+{
+  BufShard& shard = shardOf(file, pageNo);
+  FrameId frameNo = 0;
+  if (shard.hashTable->find(file, pageNo, frameNo))
+    return;
+
+  std::unique_lock<std::mutex> lock(partitionLatch(file, pageNo));
+  if (shard.hashTable->find(file, pageNo, frameNo) || !tryAllocBuf(shard, pageKey(file, pageNo), frameNo))
+    return;
+  shard.hashTable->insert(file, pageNo, frameNo);
+  shard.prefetching++;
+  lock.unlock();
+  shard.stats.prefetches++;
+
+  // nobody has asked for the page yet, so it is left unpinned
+  BufDesc* desc = &bufDescTable[frameNo];
+  BufShard* prefetchShard = &shard;
+  batch.push_back(loadRequest(shard, file, pageNo, frameNo, [desc, prefetchShard](Page* page, std::exception_ptr) {
+    if (page != NULL)
+      desc->pinCnt.fetch_sub(1, std::memory_order_release);
+    prefetchShard->prefetching--;
+  }));
+}
+
+void BufMgr::readAhead(File* file, const PageId pageNo)
+{
+  ReadAheadStream& stream = streams[file->id() % READ_AHEAD_STREAMS];
+  if (stream.fileId != file->id() || stream.lastPage.exchange(pageNo) + 1 != pageNo)
   {
-    bufStats.diskwrites++;
-    //status = bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo,
-    bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo, bufPool[clockHand]);
+    // not the page after the last one: a new run may start here
+    stream.fileId = file->id();
+    stream.lastPage = pageNo;
+    stream.end = pageNo + 1;
+    stream.window = std::min(READ_AHEAD_MIN, readAheadLimit);
+    return;
   }
 
-	//Reset all the BufDesc entry for the frame before returning the frame
-  bufDescTable[clockHand].Clear();
+  // read the next window once the reader is half way through the pages read ahead
+  const std::uint32_t window = stream.window;
+  PageId end = stream.end;
+  if (pageNo + window / 2 < end)
+    return;
+  const PageId from = std::max(end, pageNo + 1);
+  const PageId to = std::min(pageNo + 1 + window, file->getEndPageNo());
+  if (from >= to || !stream.end.compare_exchange_strong(end, to))
+    return;
+  stream.window = std::min(window * 2, readAheadLimit);
+
+  std::vector<IoRequest> batch;
+  for (PageId i = from; i < to; i++)
+    prefetchPage(file, i, batch);
+  if (!batch.empty())
+    ioEngine->submit(batch);
+}
 
-  // return new frame number
-  frame = clockHand;
-} // end allocBuf
+void BufMgr::dropPage(File* file, const PageId pageNo)
+{
+  FrameId frameNo = 0;
+  BufShard& shard = shardOf(file, pageNo);
+	while (shard.hashTable->find(file, pageNo, frameNo))
+	{
+		BufDesc* desc = &bufDescTable[frameNo];
+		if (desc->tryClaim())
+		{
+			if (desc->valid && desc->file == file && desc->pageNo == pageNo)
+			{
+				// clear the page
+				shard.hashTable->remove(file, pageNo);
+				releaseFrame(shard, frameNo);
+				return;
+			}
+			// the frame went to another page in the meantime
+			desc->pinCnt = 0;
+		}
+		else if (desc->pinCnt > 0 && desc->file == file && desc->pageNo == pageNo)
+			throw PagePinnedException(file->filename(), pageNo, frameNo);
+		std::this_thread::yield();
+	}
+}
 
 	
 void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
 {
+  if (!tryReadPage(file, pageNo, page))
+    throw BufferExceededException();
+}
+
+bool BufMgr::tryReadPage(File* file, const PageId pageNo, Page*& page)
+{
+  BufShard& shard = shardOf(file, pageNo);
+  shard.stats.accesses++;
+  if (readAheadLimit > 0)
+    readAhead(file, pageNo);
+
   // check to see if it is already in the buffer pool
-  // std::cout << "readPage called on file.page " << file << "." << pageNo << endl;
   FrameId frameNo = 0;
-	try
+  bool claimed = false;
+	if (tryPinPage(file, pageNo, frameNo, claimed))
 	{
-  	hashTable->lookup(file, pageNo, frameNo);
-
-    // set the referenced bit
-    bufDescTable[frameNo].refbit = true;
-    bufDescTable[frameNo].pinCnt++;
     page = &bufPool[frameNo];
+    return true;
   }
-  catch(HashNotFoundException e) //not in the buffer pool, must allocate a new page
+
+  //not in the buffer pool, must allocate a new page. Only one thread at a time reads a page of the partition.
+  std::unique_lock<std::mutex> lock(partitionLatch(file, pageNo));
+  while (1)
   {
-    // alloc a new frame
-    allocBuf(frameNo);
+    if (tryPinPage(file, pageNo, frameNo, claimed))
+    {
+      page = &bufPool[frameNo];
+      return true;
+    }
 
-    // read the page into the new frame
-    bufStats.diskreads++;
-    //status = file->readPage(pageNo, &bufPool[frameNo]);
+    // alloc a new frame, unless the page is being evicted or read
+    if (!claimed && tryAllocBuf(shard, pageKey(file, pageNo), frameNo))
+      break;
+    // no frame is free, and no read ahead in flight will free one
+    if (!claimed && shard.prefetching == 0)
+      return false;
+    // wait until that is done
+    lock.unlock();
+    std::this_thread::yield();
+    lock.lock();
+  }
+
+  // read the page into the new frame
+  try
+  {
     bufPool[frameNo] = file->readPage(pageNo);
+  }
+  catch(...)
+  {
+    releaseFrame(shard, frameNo);
+    throw;
+  }
+  shard.stats.diskreads++;
+
+  // set up the entry properly
+  bufDescTable[frameNo].Set(file, pageNo);
+  shard.policy->pageLoaded(frameNo, pageKey(file, pageNo));
+  page = &bufPool[frameNo];
+
+  // insert in the hash table
+  shard.hashTable->insert(file, pageNo, frameNo);
+  return true;
+}
 
-    // set up the entry properly
-    bufDescTable[frameNo].Set(file, pageNo);
-    page = &bufPool[frameNo];
 
-    // insert in the hash table
-    hashTable->insert(file, pageNo, frameNo);
+void BufMgr::readPageAsync(File* file, const PageId pageNo, const PageCallback& callback)
+{
+  BufShard& shard = shardOf(file, pageNo);
+  shard.stats.accesses++;
+
+  // check to see if it is already in the buffer pool
+  FrameId frameNo = 0;
+  bool claimed = false;
+	if (tryPinPage(file, pageNo, frameNo, claimed))
+	{
+    callback(&bufPool[frameNo], std::exception_ptr());
+    return;
   }
+
+  std::unique_lock<std::mutex> lock(partitionLatch(file, pageNo));
+  while (1)
+  {
+    if (tryPinPage(file, pageNo, frameNo, claimed))
+    {
+      lock.unlock();
+      callback(&bufPool[frameNo], std::exception_ptr());
+      return;
+    }
+
+    // alloc a new frame, unless the page is being evicted or read
+    if (!claimed && tryAllocBuf(shard, pageKey(file, pageNo), frameNo))
+      break;
+    // no frame is free, and no read ahead in flight will free one
+    if (!claimed && shard.prefetching == 0)
+    {
+      lock.unlock();
+      callback(NULL, std::make_exception_ptr(BufferExceededException()));
+      return;
+    }
+    // wait until that is done
+    lock.unlock();
+    std::this_thread::yield();
+    lock.lock();
+  }
+
+  // Publish the page while its frame is still claimed, so threads asking for it wait for the read
+  shard.hashTable->insert(file, pageNo, frameNo);
+  lock.unlock();
+
+  ioEngine->submit(loadRequest(shard, file, pageNo, frameNo, callback));
 }
 
+std::future<Page*> BufMgr::readPageAsync(File* file, const PageId pageNo)
+{
+  std::shared_ptr<std::promise<Page*> > promise(new std::promise<Page*>());
+  readPageAsync(file, pageNo, [promise](Page* page, std::exception_ptr error) {
+    if (error)
+      promise->set_exception(error);
+    else
+      promise->set_value(page);
+  });
+  return promise->get_future();
+}
+
+void BufMgr::prefetchPages(File* file, const PageId* pageNos, const std::size_t count)
+{
+  const PageId endPageNo = file->getEndPageNo();
+  std::vector<IoRequest> batch;
+  for (std::size_t i = 0; i < count; i++)
+  {
+    if (pageNos[i] != Page::INVALID_NUMBER && pageNos[i] < endPageNo)
+      prefetchPage(file, pageNos[i], batch);
+  }
+  if (!batch.empty())
+    ioEngine->submit(batch);
+}
 
 void BufMgr::unPinPage(File* file, const PageId pageNo, 
 			     const bool dirty) 
 {
   // lookup in hashtable
   FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
+  shardOf(file, pageNo).hashTable->lookup(file, pageNo, frameNo);
+  BufDesc* desc = &bufDescTable[frameNo];
 
-  if (dirty == true) bufDescTable[frameNo].dirty = dirty;
+  if (dirty == true) desc->dirty = dirty;
 
   // make sure the page is actually pinned
-  if (bufDescTable[frameNo].pinCnt == 0)
+  int count = desc->pinCnt.load(std::memory_order_relaxed);
+  do
   {
-  	throw PageNotPinnedException(file->filename(), pageNo, frameNo);
-  }
-  else bufDescTable[frameNo].pinCnt--;
+    if (count <= 0)
+      throw PageNotPinnedException(file->filename(), pageNo, frameNo);
+  } while (!desc->pinCnt.compare_exchange_weak(count, count - 1, std::memory_order_release));
 }
 
 void BufMgr::flushFile(const File* file) 
 {
+  // pages read ahead land in frames of the file without anybody waiting for them
+  ioEngine->drain();
+
+  // claim every frame of the file first; if one is pinned, the file is left as it was
+  std::vector<FrameId> frames;
   for (std::uint32_t i = 0; i < numBufs; i++)
 	{
   	BufDesc* tmpbuf = &(bufDescTable[i]);
-  	if(tmpbuf->valid == true && tmpbuf->file == file)
+		while (tmpbuf->file == file)
 		{
-	    if (tmpbuf->pinCnt > 0)
+			if (tmpbuf->tryClaim())
+			{
+				if (tmpbuf->file != file)
+				{
+					// the frame went to another page in the meantime
+					tmpbuf->pinCnt = 0;
+					break;
+				}
+				if (tmpbuf->valid == false)
+				{
+					tmpbuf->pinCnt = 0;
+					for (std::size_t j = 0; j < frames.size(); j++)
+						bufDescTable[frames[j]].pinCnt = 0;
+					throw BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, tmpbuf->refbit);
+				}
+				frames.push_back(i);
+				break;
+			}
+			// A miss of another thread may have claimed the frame for a moment, to evict its page or to load
+			// one; wait for it and look at the frame again. Only a pin is kept for longer.
+			if (tmpbuf->pinCnt != BufDesc::CLAIMED && tmpbuf->file == file)
+			{
+				for (std::size_t j = 0; j < frames.size(); j++)
+					bufDescTable[frames[j]].pinCnt = 0;
   			throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
+			}
+			std::this_thread::yield();
+		}
+  }
 
-	    if (tmpbuf->dirty == true)
-			{
-				//if ((status = tmpbuf->file->writePage(tmpbuf->pageNo, &(bufPool[i]))) != OK)
-				tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
-				tmpbuf->dirty = false;
-    	}
+  // write the dirty pages all at once, and wait for the last one
+  std::mutex doneLatch;
+  std::condition_variable allDone;
+  std::size_t pending = 0;
+  std::exception_ptr error;
+  std::vector<IoRequest> batch;
+  for (std::size_t j = 0; j < frames.size(); j++)
+	{
+  	BufDesc* tmpbuf = &(bufDescTable[frames[j]]);
+    if (tmpbuf->dirty == true)
+		{
+			IoRequest request = { IoRequest::WRITE, tmpbuf->file.load(), tmpbuf->pageNo, &bufPool[frames[j]],
+				[&](std::exception_ptr writeError) {
+					std::lock_guard<std::mutex> lock(doneLatch);
+					if (writeError && !error)
+						error = writeError;
+					if (--pending == 0)
+						allDone.notify_all();
+				} };
+			batch.push_back(request);
+		}
+  }
+  pending = batch.size();
+  ioEngine->submit(batch);
+  {
+  	std::unique_lock<std::mutex> lock(doneLatch);
+  	while (pending > 0)
+  		allDone.wait(lock);
+  }
+  if (error)
+	{
+		// the pages stay in the pool, dirty
+		for (std::size_t j = 0; j < frames.size(); j++)
+			bufDescTable[frames[j]].pinCnt = 0;
+		std::rethrow_exception(error);
+	}
 
-    	hashTable->remove(file,tmpbuf->pageNo);
-    	tmpbuf->Clear();
-  	}
-		else if (tmpbuf->valid == false && tmpbuf->file == file)
-  		throw BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, tmpbuf->refbit);
+  for (std::size_t j = 0; j < frames.size(); j++)
+	{
+  	BufDesc* tmpbuf = &(bufDescTable[frames[j]]);
+		tmpbuf->dirty = false;
+   	BufShard& shard = shardOf(file, tmpbuf->pageNo);
+   	shard.hashTable->remove(file,tmpbuf->pageNo);
+   	releaseFrame(shard, frames[j]);
   }
+
+  // one fsync for all the pages written
+  file->sync();
 }
 
 void BufMgr::disposePage(File* file, const PageId pageNo) 
 {
 	//Deallocate from file altogether
   //See if it is in the buffer pool
-  FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
-
-	// clear the page
-	bufDescTable[frameNo].Clear();
-
-	hashTable->remove(file, pageNo);
+  dropPage(file, pageNo);
 
   // deallocate it in the file	
   file->deletePage(pageNo);
@@ -214,19 +528,76 @@ void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page)
 {
   FrameId frameNo;
 
-  // alloc a new frame
-  allocBuf(frameNo);
+  // allocate a new page in the file first: its number decides the shard of the frame
+  Page newPage = file->allocatePage(pageNo);
 
-  // allocate a new page in the file
-	//std::cerr << "buffer data size:" << bufPool[frameNo].data_.length() << "\n";
-  bufPool[frameNo] = file->allocatePage(pageNo);
+  // The page is read ahead, or read, only under the latch of its partition, so holding it from dropping
+  // any old copy of the page to publishing the new one keeps a second copy out of the pool.
+  BufShard& shard = shardOf(file, pageNo);
+  std::unique_lock<std::mutex> lock(partitionLatch(file, pageNo));
+  while (1)
+  {
+    // a page number given back to the file may still have its old contents in the pool, read ahead
+    try
+    {
+      dropPage(file, pageNo);
+    }
+    catch(...)
+    {
+      file->deletePage(pageNo);
+      throw;
+    }
+
+    // alloc a new frame, and give the page back to the file if there is none
+    if (tryAllocBuf(shard, pageKey(file, pageNo), frameNo))
+      break;
+    // a read ahead in flight gives its frame back once it is done
+    if (shard.prefetching == 0)
+    {
+      file->deletePage(pageNo);
+      throw BufferExceededException();
+    }
+    lock.unlock();
+    std::this_thread::yield();
+    lock.lock();
+  }
+  bufPool[frameNo] = newPage;
   page = &bufPool[frameNo];
 
   // set up the entry properly
   bufDescTable[frameNo].Set(file, pageNo);
+  shard.policy->pageLoaded(frameNo, pageKey(file, pageNo));
 
   // insert in the hash table
-  hashTable->insert(file, pageNo, frameNo);
+  shard.hashTable->insert(file, pageNo, frameNo);
+}
+
+RecordId BufMgr::insertRecord(PageFile* file, const std::string& data)
+{
+  if (data.length() + sizeof(PageSlot) > Page::DATA_SIZE)
+    throw InsufficientSpaceException(Page::INVALID_NUMBER, data.length(), Page::DATA_SIZE - sizeof(PageSlot));
+
+  while (1)
+  {
+    PageId pageNo = file->findPageWithSpace(data.length());
+    Page* page;
+    if (pageNo == Page::INVALID_NUMBER)
+      allocPage(file, pageNo, page);
+    else
+      readPage(file, pageNo, page);
+
+    latchPage(page, EXCLUSIVE);
+    const bool fits = page->hasSpaceForRecord(data);
+    RecordId rid;
+    if (fits)
+      rid = page->insertRecord(data);
+    file->updateFreeSpace(*page);
+    unlatchPage(page, EXCLUSIVE);
+    unPinPage(file, pageNo, fits);
+    if (fits)
+      return rid;
+    // the map was behind a copy of the page changed in the pool, and is up to date now
+  }
 }
 
 void BufMgr::printSelf(void) 
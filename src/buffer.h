@@ -7,9 +7,18 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <vector>
 #include "file.h"
 #include "bufHashTbl.h"
-#include <iostream>
+#include "io_engine.h"
+#include "latch.h"
+#include "replacer.h"
 
 namespace badgerdb {
 
@@ -20,21 +29,32 @@ class BufMgr;
 
 /**
 * @brief Class for maintaining information about buffer pool frames
+*
+* Fields are atomic because threads read them without a lock. pinCnt doubles as the claim on the frame:
+* the thread that sets it from 0 to CLAIMED owns the frame, and is the only one that may change file,
+* pageNo or valid until it stores a pin count again. Any other thread only pins a frame that is not
+* claimed, so a frame with a pin keeps its page.
 */
 class BufDesc {
 
 	friend class BufMgr;
+	friend class ClockPolicy;
 
  private:
 	/**
+	 * Value of pinCnt while a thread evicts, loads or clears the frame
+	 */
+	static const int CLAIMED = -1;
+
+	/**
    * Pointer to file to which corresponding frame is assigned
 	 */
-  File* file;
+  std::atomic<File*> file;
 
 	/**
    * Page within file to which corresponding frame is assigned
 	 */
-  PageId pageNo;
+  std::atomic<PageId> pageNo;
 
 	/**
    * Frame number of the frame, in the buffer pool, being used
@@ -42,41 +62,55 @@ class BufDesc {
   FrameId	frameNo;
 
 	/**
-   * Number of times this page has been pinned
+   * Number of times this page has been pinned, or CLAIMED
 	 */
-  int pinCnt;
+  std::atomic<int> pinCnt;
 
 	/**
    * True if page is dirty;  false otherwise
 	 */
-  bool dirty;
+  std::atomic<bool> dirty;
 
 	/**
    * True if page is valid
 	 */
-  bool valid;
+  std::atomic<bool> valid;
 
 	/**
    * Has this buffer frame been reference recently
 	 */
-  bool refbit;
+  std::atomic<bool> refbit;
 
 	/**
-   * Initialize buffer frame for a new user
+	 * Latch callers hold while they read (SHARED) or change (EXCLUSIVE) the page in the frame
 	 */
-  void Clear()
+  Latch latch;
+
+	/**
+   * Forget the page in the frame, but keep the pin count (or claim)
+	 */
+  void clearPage()
 	{
-    pinCnt = 0;
 		file = NULL;
 		pageNo = Page::INVALID_NUMBER;
     dirty = false;
     refbit = false;
 		valid = false;
+  }
+
+	/**
+   * Initialize buffer frame for a new user. Releases a claim on the frame.
+	 */
+  void Clear()
+	{
+		clearPage();
+    pinCnt = 0;
   };
 
 	/**
 	 * Set values of member variables corresponding to assignment of frame to a page in the file. Called when a frame 
-	 * in buffer pool is allocated to any page in the file through readPage() or allocPage()
+	 * in buffer pool is allocated to any page in the file through readPage() or allocPage(). The claim on the frame
+	 * becomes a pin of the caller.
 	 *
 	 * @param filePtr	File object
 	 * @param pageNum	Page number in the file
@@ -85,17 +119,43 @@ class BufDesc {
 	{ 
 		file = filePtr;
     pageNo = pageNum;
-    pinCnt = 1;
     dirty = false;
     valid = true;
     refbit = true;
+    pinCnt = 1;
+  }
+
+	/**
+	 * Pin the frame unless it is claimed.
+	 *
+	 * @return  False if the frame is claimed
+	 */
+  bool tryPin()
+	{
+		int count = pinCnt.load(std::memory_order_relaxed);
+		while (count != CLAIMED) {
+			if (pinCnt.compare_exchange_weak(count, count + 1, std::memory_order_acquire))
+				return true;
+		}
+		return false;
+  }
+
+	/**
+	 * Claim the frame if nobody has it pinned.
+	 *
+	 * @return  False if the frame is pinned or already claimed
+	 */
+  bool tryClaim()
+	{
+		int count = 0;
+		return pinCnt.compare_exchange_strong(count, CLAIMED, std::memory_order_acquire);
   }
 
   void Print()
 	{
 		if(file != NULL)
 		{
-			std::cout << "file:" << file->filename() << " ";
+			std::cout << "file:" << file.load()->filename() << " ";
 			std::cout << "pageNo:" << pageNo << " ";
 		}
 		else
@@ -123,26 +183,46 @@ class BufDesc {
 struct BufStats
 {
 	/**
-   * Total number of accesses to buffer pool
+   * Total number of page reads requested from the buffer pool, hits and misses
 	 */
-  int accesses;
+  std::atomic<int> accesses;
 
 	/**
    * Number of pages read from disk (including allocs)
 	 */
-  int diskreads;
+  std::atomic<int> diskreads;
 
 	/**
    * Number of pages written back to disk
 	 */
-  int diskwrites;
+  std::atomic<int> diskwrites;
+
+	/**
+   * Number of pages read ahead of being asked for (counted in diskreads once read)
+	 */
+  std::atomic<int> prefetches;
 
 	/**
    * Clear all values 
 	 */
   void clear()
   {
-		accesses = diskreads = diskwrites = 0;
+		accesses = 0;
+		diskreads = 0;
+		diskwrites = 0;
+		prefetches = 0;
+  }
+
+	/**
+   * Add the counts of other to this one
+	 */
+  BufStats& operator+=(const BufStats& other)
+  {
+		accesses += other.accesses;
+		diskreads += other.diskreads;
+		diskwrites += other.diskwrites;
+		prefetches += other.prefetches;
+		return *this;
   }
       
 	/**
@@ -151,30 +231,156 @@ struct BufStats
   BufStats()
   {
 		clear();
+  }
+
+	/**
+   * Copy constructor of BufStats class, takes a snapshot of the counts
+	 */
+  BufStats(const BufStats& other)
+  {
+		clear();
+		*this += other;
+  }
+};
+
+
+/**
+* @brief One partition of the buffer pool: a contiguous range of frames with its own replacement
+* policy, hash table and statistics. A page is only ever held by the shard its (file, page) pair hashes to.
+*/
+struct BufShard
+{
+	/**
+   * First frame of the shard in the buffer pool
+	 */
+  FrameId firstFrame;
+
+	/**
+   * Number of frames in the shard
+	 */
+  std::uint32_t numFrames;
+
+	/**
+   * Replacement policy choosing the victims among the frames of the shard
+	 */
+  ReplacementPolicy *policy;
+
+	/**
+   * Hash table mapping (File, page) to frame for the pages of the shard
+	 */
+  BufHashTbl *hashTable;
+
+	/**
+   * Buffer usage statistics of the shard
+	 */
+  BufStats stats;
+
+	/**
+   * Number of frames of the shard claimed by reads ahead in flight. A read that finds no free
+   * frame waits for them rather than fail.
+	 */
+  std::atomic<int> prefetching;
+
+	/**
+   * Constructor of BufShard class. The shard is empty until BufMgr assigns it frames.
+	 */
+  BufShard()
+		: firstFrame(0), numFrames(0), policy(NULL), hashTable(NULL), prefetching(0)
+  {
   }
 };
 
 
+/**
+* @brief Sequential read-ahead state of the reads of one File object. Threads update it without a lock:
+* it only decides which pages are worth reading early, so a lost update costs a prefetch at worst.
+*/
+struct ReadAheadStream
+{
+	/**
+   * Id of the File object the stream follows
+	 */
+  std::atomic<std::uint32_t> fileId;
+
+	/**
+   * Page read last
+	 */
+  std::atomic<PageId> lastPage;
+
+	/**
+   * First page past the ones read ahead so far
+	 */
+  std::atomic<PageId> end;
+
+	/**
+   * Number of pages to read ahead of the reader next time
+	 */
+  std::atomic<std::uint32_t> window;
+
+	/**
+   * Constructor of ReadAheadStream class. The stream follows no file until a read of one.
+	 */
+  ReadAheadStream()
+		: fileId(0), lastPage(Page::INVALID_NUMBER), end(0), window(0)
+  {
+  }
+};
+
+
+/**
+* @brief Function called when a page read by BufMgr::readPageAsync() is pinned in the buffer pool, with the
+* page, or with NULL and the exception the read failed with.
+*/
+typedef std::function<void(Page*, std::exception_ptr)> PageCallback;
+
+
 /**
 * @brief The central class which manages the buffer pool including frame allocation and deallocation to pages in the file 
+*
+* readPage(), unPinPage(), allocPage() and disposePage() can be called from many threads at once. A hit
+* takes no lock: the frame is found in the lock-free hash table and pinned with an atomic increment. A
+* miss takes the latch of the page's partition, so the page is read into a single frame. The replacement
+* policy claims its victim atomically, and no lock is held while the victim is written back. flushFile() and
+* printSelf() must not overlap other calls for the same file.
+*
+* The pool can be split into shards (see BufShard), so threads missing on different pages sweep
+* different clocks and update different hash tables. With more than one shard a page competes only for
+* the frames of its own shard, so a pool with many pinned pages runs out of frames sooner.
+*
+* The replacement policy is chosen at construction (see ReplacementPolicy). The default second chance
+* clock takes no lock; LRU-K, 2Q and ARC resist pages flushed out by sequential scans, at the cost of
+* a mutex per shard taken on every hit and miss.
+*
+* Misses of readPageAsync() and the writes of flushFile() go through an IoEngine (io_uring, or a thread
+* pool where the kernel has none), so many of them are in flight at once.
+*
+* readPage() watches for each File object whether it reads consecutive pages. Once it does, the next
+* pages are read ahead asynchronously into frames of the pool, in a window that doubles up to the
+* read-ahead limit while the run goes on. Scans that know which pages come next, in another order,
+* say so through prefetchPages(). Pages read ahead are left unpinned and are evicted like any other.
 */
 class BufMgr 
 {
  private:
 	/**
-   * Current position of clockhand in our buffer pool
+	 * Number of latches the (file, page) pairs are partitioned over
 	 */
-  FrameId clockHand;
+  static const int LATCH_PARTITIONS = 64;
 
 	/**
    * Number of frames in the buffer pool
 	 */
   std::uint32_t numBufs;
-	
+
 	/**
-   * Hash table mapping (File, page) to frame
+   * Number of shards the frames are split over
 	 */
-  BufHashTbl *hashTable;
+  std::uint32_t numShards;
+
+	/**
+   * Array of numShards shards, each owning a contiguous range of frames
+	 */
+  BufShard *shards;
 
 	/**
    * Array of BufDesc objects to hold information corresponding to every frame allocation from 'bufPool' (the buffer pool)
@@ -182,26 +388,120 @@ class BufMgr
   BufDesc *bufDescTable;
 
 	/**
-   * Maintains Buffer pool usage statistics 
+	 * Maximum number of asynchronous reads and writes in flight
 	 */
-  BufStats bufStats;
+  static const unsigned IO_QUEUE_DEPTH = 64;
 
 	/**
-	 * Allocate a free frame.  
-	 *
-	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
-	 * @throws BufferExceededException If no such buffer is found which can be allocated
+	 * Engine running the asynchronous reads and writes
+	 */
+  IoEngine *ioEngine;
+
+	/**
+	 * Number of File objects whose sequential reads are followed at once
+	 */
+  static const int READ_AHEAD_STREAMS = 16;
+
+	/**
+	 * Number of pages read ahead when a run of sequential reads starts
+	 */
+  static const std::uint32_t READ_AHEAD_MIN = 4;
+
+	/**
+	 * Default limit of the read-ahead window, in pages
+	 */
+  static const std::uint32_t READ_AHEAD_MAX = 32;
+
+	/**
+	 * Largest number of pages read ahead of a sequential reader, 0 if read-ahead is off
+	 */
+  std::uint32_t readAheadLimit;
+
+	/**
+	 * Read-ahead state of the File objects, by id
 	 */
-  void allocBuf(FrameId & frame);
+  ReadAheadStream streams[READ_AHEAD_STREAMS];
 
 	/**
-   * Advance clock to next frame in the buffer pool
+	 * Latches serializing misses of the pages in each partition, so a page is read into one frame only
 	 */
-  void advanceClock()
+  std::mutex partitionLatches[LATCH_PARTITIONS];
+
+	/**
+	 * Returns the key of (file, pageNo) in the hash tables and replacement policies
+	 */
+  static std::uint64_t pageKey(const File* file, const PageId pageNo)
   {
-		clockHand = (clockHand + 1) % numBufs;
+		return ((std::uint64_t)file->id() << 32) | pageNo;
   }
 
+	/**
+	 * Returns the latch of the partition of (file, pageNo)
+	 */
+  std::mutex& partitionLatch(const File* file, const PageId pageNo);
+
+	/**
+	 * Returns the shard holding (file, pageNo) when it is in the buffer pool
+	 */
+  BufShard& shardOf(const File* file, const PageId pageNo);
+
+	/**
+	 * Pin the frame holding (file, pageNo), if there is one.
+	 *
+	 * @param frameNo	Frame of the page, set if true is returned
+	 * @param claimed	Set to true if the page is in a frame that is being evicted
+	 * @return  True if the page was found and pinned
+	 */
+  bool tryPinPage(const File* file, const PageId pageNo, FrameId& frameNo, bool& claimed);
+
+	/**
+	 * Write the page in a claimed frame back if it is dirty, remove it from the hash table and clear the frame.
+	 * The frame stays claimed.
+	 */
+  void evictFrame(const FrameId frameNo);
+
+	/**
+	 * Allocate a free frame of a shard, without throwing if there is none. The frame is returned claimed
+	 * (see BufDesc). A dirty victim is written back with no latch held but the claim on its frame.
+	 *
+	 * @param shard   	Shard to take the frame from
+	 * @param key   	Key of the page the frame is for
+	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
+	 * @return  False if every frame of the shard is pinned
+	 */
+  bool tryAllocBuf(BufShard& shard, const std::uint64_t key, FrameId & frame);
+
+	/**
+	 * Give a claimed frame that holds no page back to the shard's policy, and release the claim
+	 */
+  void releaseFrame(BufShard& shard, const FrameId frameNo);
+
+	/**
+	 * Returns the request reading (file, pageNo) into a claimed frame that is in the hash table already.
+	 * Once the page is in, the claim becomes a pin and loaded is called with the page; if the read fails,
+	 * the frame is freed and loaded is called with NULL and the exception.
+	 */
+  IoRequest loadRequest(BufShard& shard, File* file, const PageId pageNo, const FrameId frameNo,
+		const PageCallback& loaded);
+
+	/**
+	 * Add to batch the read of a page that is not in the buffer pool into a free frame. Nothing is added
+	 * if the page is in the pool or on its way, or if no frame can be freed for it.
+	 */
+  void prefetchPage(File* file, const PageId pageNo, std::vector<IoRequest>& batch);
+
+	/**
+	 * Note a read of pageNo for the read-ahead of file, and read ahead if it continues a sequential run
+	 */
+  void readAhead(File* file, const PageId pageNo);
+
+	/**
+	 * Remove (file, pageNo) from the buffer pool if it is there, waiting for a read of it in flight
+	 *
+   * @throws  PagePinnedException If the page is pinned in the buffer pool
+	 */
+  void dropPage(File* file, const PageId pageNo);
+
 
  public:
 	/**
@@ -211,8 +511,12 @@ class BufMgr
 
 	/**
    * Constructor of BufMgr class
+	 *
+	 * @param bufs   	Number of frames in the buffer pool
+	 * @param shardCount	Number of shards the frames are split over, at most bufs
+	 * @param policy 	Replacement algorithm of every shard
 	 */
-  BufMgr(std::uint32_t bufs);
+  BufMgr(std::uint32_t bufs, std::uint32_t shardCount = 1, ReplacementPolicyType policy = CLOCK);
 	
 	/**
    * Destructor of BufMgr class
@@ -227,9 +531,64 @@ class BufMgr
 	 * @param file   	File object
 	 * @param PageNo  Page number in the file to be read
 	 * @param page  	Reference to page pointer. Used to fetch the Page object in which requested page from file is read in.
+	 * @throws BufferExceededException If the page is not in the buffer pool and every frame is pinned
 	 */
   void readPage(File* file, const PageId PageNo, Page*& page);
 
+	/**
+	 * Same as readPage(), but neither a hit nor a miss throws: returns false if the page is not in the
+	 * buffer pool and no frame can be freed for it. Errors reading the file still throw.
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number in the file to be read
+	 * @param page  	Reference to page pointer, set only if true is returned
+	 * @return  True if the page is pinned in the buffer pool
+	 */
+  bool tryReadPage(File* file, const PageId PageNo, Page*& page);
+
+	/**
+	 * Reads the given page into the buffer pool without waiting for the disk. A hit calls the callback
+	 * before returning; a miss claims a frame, starts the read and returns, and the callback is called on
+	 * an I/O thread once the page is in the frame. Either way the page is pinned for the caller. Other
+	 * threads asking for the page while it is read wait for the read to finish.
+	 *
+	 * @param file   	File object, open until the callback has been called
+	 * @param PageNo  Page number in the file to be read
+	 * @param callback	Called with the pinned page, or with the exception of the read (BufferExceededException
+	 *              	if no frame is free, or any exception of File::readPage()); must not throw or block
+	 */
+  void readPageAsync(File* file, const PageId PageNo, const PageCallback& callback);
+
+	/**
+	 * Future based readPageAsync(): the future gets the pinned page, or the exception of the read.
+	 *
+	 * @param file   	File object, open until the future is ready
+	 * @param PageNo  Page number in the file to be read
+	 */
+  std::future<Page*> readPageAsync(File* file, const PageId PageNo);
+
+	/**
+	 * Hint that the given pages will be read soon. The pages not in the buffer pool are read
+	 * asynchronously into free frames, and left unpinned. Pages past the end of the file, and pages
+	 * no frame can be freed for, are skipped. Returns without waiting for the disk.
+	 *
+	 * @param file   	File object, flushed or open until the reads are done
+	 * @param pageNos	Pages to read, in the order they will be needed
+	 * @param count  	Number of pages
+	 */
+  void prefetchPages(File* file, const PageId* pageNos, const std::size_t count);
+
+	/**
+	 * Set the largest number of pages readPage() reads ahead of a sequential reader. The window
+	 * never exceeds a quarter of the pool.
+	 *
+	 * @param maxPages	Limit of the read-ahead window, 0 to turn read-ahead off
+	 */
+  void setReadAhead(const std::uint32_t maxPages)
+  {
+		readAheadLimit = std::min(maxPages, numBufs / 4);
+  }
+
 	/**
 	 * Unpin a page from memory since it is no longer required for it to remain in memory.
 	 *
@@ -251,9 +610,23 @@ class BufMgr
   void allocPage(File* file, PageId &PageNo, Page*& page); 
 
 	/**
-	 * Writes out all dirty pages of the file to disk.
+	 * Inserts a record into the page with the lowest number that has room for it, found in the free
+	 * space map of the file, or into a new page if no page has room. The page is changed in the buffer
+	 * pool, under its EXCLUSIVE latch, and left unpinned and dirty.
+	 *
+	 * @param file   	File object
+	 * @param data  	Record to insert
+	 * @return  Id of the record
+   * @throws  InsufficientSpaceException If the record does not fit in an empty page
+	 */
+  RecordId insertRecord(PageFile* file, const std::string& data);
+
+	/**
+	 * Writes out all dirty pages of the file to disk, in one batch of asynchronous writes, and syncs the file.
+	 * Waits first for the pages read ahead that are still in flight.
 	 * All the frames assigned to the file need to be unpinned from buffer pool before this function can be successfully called.
-	 * Otherwise Error returned.
+	 * Otherwise Error returned. A frame of the file claimed for a moment by a miss of another thread, to evict its
+	 * page, is waited for and does not count as pinned.
 	 *
 	 * @param file   	File object
    * @throws  PagePinnedException If any page of the file is pinned in the buffer pool 
@@ -267,20 +640,72 @@ class BufMgr
 	 *
 	 * @param file   	File object
 	 * @param PageNo  Page number
+   * @throws  PagePinnedException If the page is pinned in the buffer pool
 	 */
   void disposePage(File* file, const PageId PageNo);
 
 	/**
+	 * Acquire the latch of a pinned page. Hold it SHARED while reading the page and EXCLUSIVE while
+	 * changing it when other threads may use the page at the same time. Pinning alone only keeps
+	 * the page in the buffer pool.
+	 *
+	 * @param page  	Page returned by readPage() or allocPage(), still pinned
+	 * @param mode  	SHARED or EXCLUSIVE
+	 */
+  void latchPage(const Page* page, const LatchMode mode)
+  {
+		bufDescTable[page - bufPool].latch.lock(mode);
+  }
+
+	/**
+	 * Release the latch of a page acquired by latchPage(), before unpinning it.
+	 *
+	 * @param page  	Page passed to latchPage()
+	 * @param mode  	Mode passed to latchPage()
+	 */
+  void unlatchPage(const Page* page, const LatchMode mode)
+  {
+		bufDescTable[page - bufPool].latch.unlock(mode);
+  }
+
+	/**
    * Print member variable values. 
 	 */
   void  printSelf();
 
 	/**
-   * Get buffer pool usage statistics
+   * Get buffer pool usage statistics, summed over the shards
+	 */
+  BufStats getBufStats() const
+  {
+		BufStats stats;
+		for (std::uint32_t i = 0; i < numShards; i++)
+			stats += shards[i].stats;
+		return stats;
+  }
+
+	/**
+   * Get usage statistics of one shard
+	 */
+  const BufStats & getShardStats(const std::uint32_t shard) const
+  {
+		return shards[shard].stats;
+  }
+
+	/**
+   * Get number of shards the buffer pool is split over
+	 */
+  std::uint32_t getNumShards() const
+  {
+		return numShards;
+  }
+
+	/**
+   * Get number of frames in the buffer pool
 	 */
-  BufStats & getBufStats()
+  std::uint32_t getNumBufs() const
   {
-		return bufStats;
+		return numBufs;
   }
 
 	/**
@@ -288,7 +713,8 @@ class BufMgr
 	 */
   void clearBufStats() 
   {
-		bufStats.clear();
+		for (std::uint32_t i = 0; i < numShards; i++)
+			shards[i].stats.clear();
   }
 };
 
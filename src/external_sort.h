@@ -0,0 +1,327 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "file.h"
+#include "page.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Entry of a k-way merge heap: the head item of one sorted input. Ordered so that
+ * std::priority_queue returns the smallest item first.
+ */
+template <class T>
+struct MergeEntry {
+  T item;
+  std::size_t input;
+  MergeEntry(const T& i, std::size_t in) : item(i), input(in) {}
+  bool operator<(const MergeEntry& rhs) const { return rhs.item < item; }
+};
+
+/**
+ * @brief Sorts a stream of fixed-size items which may not fit in memory.
+ *
+ * Items are buffered until runCapacity of them have been added. The buffer is then sorted and
+ * spilled to a temporary BlobFile as one sorted run. After the last item is added, sort() prepares
+ * a k-way merge over all runs and next() returns the items in ascending order (using operator<).
+ * If every item fits in a single run nothing is written to disk.
+ *
+ * T is stored as raw bytes inside the pages of the run files, so it must be trivially copyable.
+ *
+ * @warning This class is not threadsafe.
+ */
+template <class T>
+class ExternalSorter {
+ public:
+  /**
+   * Constructs an empty sorter.
+   *
+   * @param runPrefix     Prefix of the names of temporary run files.
+   * @param runCapacity   Maximum number of items kept in memory at once.
+   */
+  ExternalSorter(const std::string& runPrefix, const std::size_t runCapacity)
+      : runPrefix_(runPrefix),
+        runCapacity_(std::max<std::size_t>(runCapacity, ITEMS_PER_PAGE)),
+        total_(0),
+        memPos_(0),
+        sorted_(false) {
+  }
+
+  /**
+   * Destructor. Closes and removes all temporary run files.
+   */
+  ~ExternalSorter() {
+    for (std::size_t i = 0; i < runs_.size(); i++) {
+      delete runs_[i].file;
+      File::remove(runs_[i].name);
+    }
+  }
+
+  /**
+   * Adds an item. Spills a sorted run to disk if the in-memory buffer is full.
+   *
+   * @param item  Item to add.
+   */
+  void add(const T& item) {
+    if (buffer_.size() == runCapacity_) {
+      spill();
+    }
+    buffer_.push_back(item);
+    total_++;
+  }
+
+  /**
+   * Ends the input and prepares the sorted output. Must be called once, before next().
+   */
+  void sort() {
+    std::sort(buffer_.begin(), buffer_.end());
+    if (!runs_.empty()) {
+      if (!buffer_.empty()) {
+        spill();
+      }
+      for (std::size_t i = 0; i < runs_.size(); i++) {
+        T item;
+        if (readRun(runs_[i], item)) {
+          heap_.push(MergeEntry<T>(item, i));
+        }
+      }
+    }
+    sorted_ = true;
+  }
+
+  /**
+   * Returns the next item in ascending order.
+   *
+   * @param out   Next item is returned in this.
+   * @return  False if all items have been returned.
+   */
+  bool next(T& out) {
+    if (!sorted_) {
+      return false;
+    }
+    if (runs_.empty()) {
+      if (memPos_ == buffer_.size()) {
+        return false;
+      }
+      out = buffer_[memPos_++];
+      return true;
+    }
+    if (heap_.empty()) {
+      return false;
+    }
+    MergeEntry<T> top = heap_.top();
+    heap_.pop();
+    out = top.item;
+    T item;
+    if (readRun(runs_[top.input], item)) {
+      heap_.push(MergeEntry<T>(item, top.input));
+    }
+    return true;
+  }
+
+  /**
+   * Returns the total number of items added.
+   */
+  std::size_t size() const { return total_; }
+
+ private:
+  /**
+   * Number of items stored in one page of a run file.
+   */
+  static const std::size_t ITEMS_PER_PAGE = Page::SIZE / sizeof(T);
+
+  /**
+   * A sorted run on disk, along with the read position used while merging.
+   */
+  struct Run {
+    std::string name;
+    BlobFile* file;
+    std::size_t count;
+    std::size_t consumed;
+    PageId pageNo;
+    Page page;
+  };
+
+  /**
+   * Sorts the in-memory buffer and writes it out as a new run.
+   */
+  void spill() {
+    std::sort(buffer_.begin(), buffer_.end());
+
+    std::ostringstream nameStr;
+    nameStr << runPrefix_ << '.' << runs_.size();
+    Run run;
+    run.name = nameStr.str();
+    if (File::exists(run.name)) {
+      File::remove(run.name);
+    }
+    run.file = new BlobFile(run.name, true);
+    run.count = buffer_.size();
+    run.consumed = 0;
+    run.pageNo = Page::INVALID_NUMBER;
+
+    for (std::size_t i = 0; i < buffer_.size(); i += ITEMS_PER_PAGE) {
+      PageId pageNo;
+      Page page = run.file->allocatePage(pageNo);
+      std::size_t n = std::min(ITEMS_PER_PAGE, buffer_.size() - i);
+      std::copy(buffer_.begin() + i, buffer_.begin() + i + n, reinterpret_cast<T*>(&page));
+      run.file->writePage(pageNo, page);
+      if (run.pageNo == Page::INVALID_NUMBER) {
+        run.pageNo = pageNo;
+      }
+    }
+    runs_.push_back(run);
+    buffer_.clear();
+  }
+
+  /**
+   * Reads the next item of a run, fetching the next page of the run file when needed.
+   *
+   * @param run   Run to read from.
+   * @param out   Item is returned in this.
+   * @return  False if the run is exhausted.
+   */
+  bool readRun(Run& run, T& out) {
+    if (run.consumed == run.count) {
+      return false;
+    }
+    std::size_t slot = run.consumed % ITEMS_PER_PAGE;
+    if (slot == 0) {
+      run.page = run.file->readPage(run.pageNo + run.consumed / ITEMS_PER_PAGE);
+    }
+    out = reinterpret_cast<const T*>(&run.page)[slot];
+    run.consumed++;
+    return true;
+  }
+
+  /**
+   * Prefix of the names of temporary run files.
+   */
+  std::string runPrefix_;
+
+  /**
+   * Maximum number of items kept in memory at once.
+   */
+  std::size_t runCapacity_;
+
+  /**
+   * Total number of items added.
+   */
+  std::size_t total_;
+
+  /**
+   * Read position in buffer_ when no run was spilled.
+   */
+  std::size_t memPos_;
+
+  /**
+   * True once sort() has been called.
+   */
+  bool sorted_;
+
+  /**
+   * Items not yet written to a run.
+   */
+  std::vector<T> buffer_;
+
+  /**
+   * Sorted runs spilled to disk.
+   */
+  std::vector<Run> runs_;
+
+  /**
+   * Head item of every unfinished run, used for the k-way merge.
+   */
+  std::priority_queue< MergeEntry<T> > heap_;
+};
+
+template <class T>
+const std::size_t ExternalSorter<T>::ITEMS_PER_PAGE;
+
+/**
+ * @brief Merges the output of several ExternalSorters, such as sorters filled by different threads,
+ * into one stream in ascending order.
+ *
+ * Every sorter must have been sorted, and must outlive the merge.
+ *
+ * @warning This class is not threadsafe.
+ */
+template <class T>
+class SortedMerge {
+ public:
+  /**
+   * Constructs the merge and reads the first item of every sorter.
+   *
+   * @param sorters   Sorted inputs.
+   */
+  explicit SortedMerge(const std::vector<ExternalSorter<T>*>& sorters)
+      : sorters_(sorters),
+        total_(0) {
+    for (std::size_t i = 0; i < sorters_.size(); i++) {
+      total_ += sorters_[i]->size();
+      T item;
+      if (sorters_.size() > 1 && sorters_[i]->next(item)) {
+        heap_.push(MergeEntry<T>(item, i));
+      }
+    }
+  }
+
+  /**
+   * Returns the next item in ascending order.
+   *
+   * @param out   Next item is returned in this.
+   * @return  False if all items have been returned.
+   */
+  bool next(T& out) {
+    // A single input needs no heap.
+    if (sorters_.size() == 1) {
+      return sorters_[0]->next(out);
+    }
+    if (heap_.empty()) {
+      return false;
+    }
+    MergeEntry<T> top = heap_.top();
+    heap_.pop();
+    out = top.item;
+    T item;
+    if (sorters_[top.input]->next(item)) {
+      heap_.push(MergeEntry<T>(item, top.input));
+    }
+    return true;
+  }
+
+  /**
+   * Returns the total number of items of all sorters.
+   */
+  std::size_t size() const { return total_; }
+
+ private:
+  /**
+   * Sorted inputs.
+   */
+  std::vector<ExternalSorter<T>*> sorters_;
+
+  /**
+   * Total number of items of all sorters.
+   */
+  std::size_t total_;
+
+  /**
+   * Head item of every unfinished sorter.
+   */
+  std::priority_queue< MergeEntry<T> > heap_;
+};
+
+}
@@ -7,14 +7,19 @@
 
 #include "file.h"
 
-#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "exceptions/file_exists_exception.h"
+#include "exceptions/file_io_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/file_open_exception.h"
 #include "exceptions/invalid_page_exception.h"
@@ -23,8 +28,17 @@
 
 namespace badgerdb {
 
-File::StreamMap File::open_streams_;
+File::HandleMap File::open_handles_;
 File::CountMap File::open_counts_;
+std::mutex File::open_latch_;
+std::atomic<std::uint32_t> File::next_id_(1);
+
+FileHandle::~FileHandle() {
+  if (mapped != NULL) {
+    ::munmap(const_cast<char*>(mapped), mapped_length);
+  }
+  ::close(fd);
+}
 
 void File::remove(const std::string& filename) {
   if (!exists(filename)) {
@@ -40,18 +54,12 @@ bool File::isOpen(const std::string& filename) {
   if (!exists(filename)) {
     return false;
   }
+  std::lock_guard<std::mutex> lock(open_latch_);
   return open_counts_.find(filename) != open_counts_.end();
 }
 
 bool File::exists(const std::string& filename) {
-	std::fstream file(filename);
-	if(file)
-	{
-		file.close();
-		return true;
-	}
-
-	return false;
+	return ::access(filename.c_str(), F_OK) == 0;
 }
 
 File::~File() {
@@ -64,24 +72,44 @@ PageId File::getFirstPageNo() {
   return header.first_used_page;
 }
 
-File::File(const std::string& name, const bool create_new) : filename_(name) {
+PageId File::getEndPageNo() const {
+  return readHeader().num_pages;
+}
+
+void File::sync() const {
+  const std::uint64_t written = handle_->writes.load();
+  std::lock_guard<std::mutex> lock(handle_->sync_latch);
+  // An fsync that started after our writes has covered them.
+  if (handle_->synced >= written) {
+    return;
+  }
+  const std::uint64_t covered = handle_->writes.load();
+  if (::fsync(handle_->fd) != 0) {
+    throw FileIOException(filename_, "sync", errno);
+  }
+  handle_->synced = covered;
+}
+
+File::File(const std::string& name, const bool create_new)
+  : filename_(name), id_(next_id_++) {
   openIfNeeded(create_new);
 
   if (create_new) {
     // File starts with 1 page (the header).
     FileHeader header = {1 /* num_pages */, 0 /* first_used_page */,
-                         0 /* num_free_pages */, 0 /* first_free_page */};
+                         0 /* num_free_pages */, 0 /* first_free_page */,
+                         0 /* last_used_page */, 0 /* first_fsm_page */};
     writeHeader(header);
   }
 }
 
 void File::openIfNeeded(const bool create_new) {
+  std::lock_guard<std::mutex> lock(open_latch_);
   if (open_counts_.find(filename_) != open_counts_.end()) {	//exists an entry already
     ++open_counts_[filename_];
-    stream_ = open_streams_[filename_];
+    handle_ = open_handles_[filename_];
   } else {
-    std::ios_base::openmode mode =
-        std::fstream::in | std::fstream::out | std::fstream::binary;
+    int flags = O_RDWR;
     const bool already_exists = exists(filename_);
     if (create_new) {
       // Error if we try to overwrite an existing file.
@@ -89,43 +117,82 @@ void File::openIfNeeded(const bool create_new) {
         throw FileExistsException(filename_);
       }
       // New files have to be truncated on open.
-      mode = mode | std::fstream::trunc;
+      flags = flags | O_CREAT | O_TRUNC;
     } else {
       // Error if we try to open a file that doesn't exist.
       if (!already_exists) {
         throw FileNotFoundException(filename_);
       }
     }
-    stream_.reset(new std::fstream(filename_, mode));
-    open_streams_[filename_] = stream_;
+    const int fd = ::open(filename_.c_str(), flags, 0644);
+    if (fd < 0) {
+      throw FileIOException(filename_, "open", errno);
+    }
+    handle_.reset(new FileHandle(fd));
+    open_handles_[filename_] = handle_;
     open_counts_[filename_] = 1;
   }
 }
 
 void File::close() {
+  std::lock_guard<std::mutex> lock(open_latch_);
 	if(open_counts_[filename_] > 0)
   	--open_counts_[filename_];
 
-  stream_.reset();
+  handle_.reset();
 	assert(open_counts_[filename_] >= 0);
 
   if (open_counts_[filename_] == 0) {
-    open_streams_.erase(filename_);
+    open_handles_.erase(filename_);
     open_counts_.erase(filename_);
   }
 }
 
 FileHeader File::readHeader() const {
   FileHeader header;
-  stream_->seekg(0 /* pos */, std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
+  readAt(&header, sizeof(FileHeader), 0 /* pos */);
   return header;
 }
 
 void File::writeHeader(const FileHeader& header) {
-  stream_->seekp(0 /* pos */, std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
-  stream_->flush();
+  writeAt(&header, sizeof(FileHeader), 0 /* pos */);
+}
+
+void File::readAt(void* buffer, const std::size_t size, const off_t pos) const {
+  char* bytes = static_cast<char*>(buffer);
+  std::size_t done = 0;
+  while (done < size) {
+    const ssize_t n = ::pread(handle_->fd, bytes + done, size - done, pos + done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw FileIOException(filename_, "read", errno);
+    }
+    if (n == 0) {
+      // End of file.
+      std::memset(bytes + done, 0, size - done);
+      break;
+    }
+    done += n;
+  }
+  handle_->reads++;
+}
+
+void File::writeAt(const void* buffer, const std::size_t size, const off_t pos) const {
+  const char* bytes = static_cast<const char*>(buffer);
+  std::size_t done = 0;
+  while (done < size) {
+    const ssize_t n = ::pwrite(handle_->fd, bytes + done, size - done, pos + done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw FileIOException(filename_, "write", errno);
+    }
+    done += n;
+  }
+  handle_->writes++;
 }
 
 
@@ -163,9 +230,10 @@ PageFile& PageFile::operator=(const PageFile& rhs) {
 }
 
 Page PageFile::allocatePage(PageId &new_page_number) {
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
   FileHeader header = readHeader();
   Page new_page;
-  Page existing_page;
+  PageId previous_page_number;
   if (header.num_free_pages > 0) {
     new_page = readPage(header.first_free_page, true /* allow_free */);
     new_page.set_page_number(header.first_free_page);
@@ -173,29 +241,10 @@ Page PageFile::allocatePage(PageId &new_page_number) {
     header.first_free_page = new_page.next_page_number();
     --header.num_free_pages;
 
-    if (header.first_used_page == Page::INVALID_NUMBER ||
-        header.first_used_page > new_page.page_number()) {
-      // Either have no pages used or the head of the used list is a page later
-      // than the one we just allocated, so add the new page to the head.
-      if (header.first_used_page > new_page.page_number()) {
-        new_page.set_next_page_number(header.first_used_page);
-      }
-      header.first_used_page = new_page.page_number();
-    } else {
-      // New page is reused from somewhere after the beginning, so we need to
-      // find where in the used list to insert it.
-      PageId next_page_number = Page::INVALID_NUMBER;
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        next_page_number = (*iter).next_page_number();
-        if (next_page_number > new_page.page_number() ||
-            next_page_number == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      existing_page.set_next_page_number(new_page.page_number());
-      new_page.set_next_page_number(next_page_number);
-    }
+    // The used list is kept in page order, so the page goes after the used
+    // page before it, found in the page directory.
+    loadDirectory();
+    previous_page_number = previousUsedPage(new_page_number);
 
     assert((header.num_free_pages == 0) ==
            (header.first_free_page == Page::INVALID_NUMBER));
@@ -204,33 +253,28 @@ Page PageFile::allocatePage(PageId &new_page_number) {
 	{
     new_page.set_page_number(header.num_pages);
 		new_page_number = new_page.page_number();
-
-    if (header.first_used_page == Page::INVALID_NUMBER)
-		{
-      header.first_used_page = new_page.page_number();
-    }
-		else
-		{
-      // If we have pages allocated, we need to add the new page to the tail
-      // of the linked list.
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        if ((*iter).next_page_number() == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      assert(existing_page.isUsed());
-      existing_page.set_next_page_number(new_page.page_number());
-    }
+    previous_page_number = header.last_used_page;
     ++header.num_pages;
   }
-  writePage(new_page_number, new_page.header_, new_page);
-  if (existing_page.page_number() != Page::INVALID_NUMBER) {
-    // If we updated an existing page by inserting the new page into the
-    // used list, we need to write it out.
-    writePage(existing_page.page_number(), existing_page.header_, existing_page);
+
+  if (previous_page_number == Page::INVALID_NUMBER) {
+    // New head of the used list.
+    new_page.set_next_page_number(header.first_used_page);
+    header.first_used_page = new_page_number;
+  } else {
+    PageHeader previous_header = readPageHeader(previous_page_number);
+    new_page.set_next_page_number(previous_header.next_page_number);
+    previous_header.next_page_number = new_page_number;
+    writePageHeader(previous_page_number, previous_header);
   }
+  if (new_page.next_page_number() == Page::INVALID_NUMBER) {
+    header.last_used_page = new_page_number;
+  }
+  setPageUsed(new_page_number, true);
+
+  writePage(new_page_number, new_page.header_, new_page);
   writeHeader(header);
+  setFreeSpace(new_page_number, spaceClass(new_page));
 
   return new_page;
 }
@@ -247,9 +291,8 @@ Page PageFile::readPage(const PageId page_number) const {
 
 Page PageFile::readPage(const PageId page_number, const bool allow_free) const {
   Page page;
-  stream_->seekg(pagePosition(page_number), std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&page.header_), sizeof(PageHeader));
-  stream_->read(reinterpret_cast<char*>(&page.data_[0]), Page::DATA_SIZE);
+  readAt(&page.header_, sizeof(PageHeader), pagePosition(page_number));
+  readAt(&page.data_[0], Page::DATA_SIZE, pagePosition(page_number) + sizeof(PageHeader));
   if (!allow_free && !page.isUsed()) {
     throw InvalidPageException(page_number, filename_);
   }
@@ -258,6 +301,7 @@ Page PageFile::readPage(const PageId page_number, const bool allow_free) const {
 }
 
 void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
 	PageHeader header = readPageHeader(new_page_number);
 	if (header.current_page_number == Page::INVALID_NUMBER)
 	{
@@ -271,37 +315,67 @@ void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
 	header = new_page.header_;
 	header.next_page_number = next_page_number;
 	writePage(new_page_number, header, new_page);
+	setFreeSpace(new_page_number, spaceClass(new_page));
 }
 
 void PageFile::deletePage(const PageId page_number) {
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
   FileHeader header = readHeader();
 
   Page existing_page = readPage(page_number);
-  Page previous_page;
-  // If this page is the head of the used list, update the header to point to
-  // the next page in line.
-  if (page_number == header.first_used_page) {
+  // Unlink the page from the used page before it, found in the page directory.
+  loadDirectory();
+  const PageId previous_page_number = previousUsedPage(page_number);
+  if (previous_page_number == Page::INVALID_NUMBER) {
     header.first_used_page = existing_page.next_page_number();
   } else {
-    // Walk the used list so we can update the page that points to this one.
-    for (FileIterator iter = begin(); iter != end(); ++iter) {
-      previous_page = *iter;
-      if (previous_page.next_page_number() == existing_page.page_number()) {
-        previous_page.set_next_page_number(existing_page.next_page_number());
-        break;
-      }
-    }
+    PageHeader previous_header = readPageHeader(previous_page_number);
+    previous_header.next_page_number = existing_page.next_page_number();
+    writePageHeader(previous_page_number, previous_header);
+  }
+  if (header.last_used_page == page_number) {
+    header.last_used_page = previous_page_number;
   }
+  setPageUsed(page_number, false);
+
   // Clear the page and add it to the head of the free list.
   existing_page.initialize();
   existing_page.set_next_page_number(header.first_free_page);
   header.first_free_page = page_number;
   ++header.num_free_pages;
-  if (previous_page.isUsed()) {
-    writePage(previous_page.page_number(), previous_page.header_, previous_page);
-  }
   writePage(page_number, existing_page.header_, existing_page);
   writeHeader(header);
+  setFreeSpace(page_number, 0);
+}
+
+PageId PageFile::findPageWithSpace(const std::size_t record_length) {
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
+  loadFreeSpace();
+  const std::uint32_t space_class = FreeSpaceMap::classFor(record_length);
+  if (space_class > FreeSpaceMap::MAX_CLASS) {
+    return Page::INVALID_NUMBER;
+  }
+  return handle_->free_space.find(space_class);
+}
+
+void PageFile::updateFreeSpace(const Page& page) {
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
+  setFreeSpace(page.page_number(), spaceClass(page));
+}
+
+std::vector<PageId> PageFile::usedPages() const {
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
+  loadDirectory();
+  std::vector<PageId> pages;
+  const std::vector<std::uint64_t>& used_pages = handle_->used_pages;
+  for (std::size_t word = 0; word < used_pages.size(); ++word) {
+    for (PageId bit = 0; bit < 64 && used_pages[word] >> bit != 0; ++bit) {
+      if ((used_pages[word] >> bit) & 1) {
+        pages.push_back(word * 64 + bit);
+      }
+    }
+  }
+  return pages;
 }
 
 FileIterator PageFile::begin() {
@@ -315,20 +389,154 @@ FileIterator PageFile::end() {
 
 void PageFile::writePage(const PageId page_number, const PageHeader& header,
                      const Page& new_page) {
-  stream_->seekp(pagePosition(page_number), std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(PageHeader));
-  stream_->write(reinterpret_cast<const char*>(&new_page.data_[0]),
-                 Page::DATA_SIZE);
-  stream_->flush();
+  writeAt(&header, sizeof(PageHeader), pagePosition(page_number));
+  writeAt(&new_page.data_[0], Page::DATA_SIZE,
+          pagePosition(page_number) + sizeof(PageHeader));
+}
+
+void PageFile::checkPage(const PageId page_number, const Page& page) const {
+  if (!page.isUsed()) {
+    throw InvalidPageException(page_number, filename_);
+  }
 }
 
 PageHeader PageFile::readPageHeader(PageId page_number) const {
   PageHeader header;
-  stream_->seekg(pagePosition(page_number), std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(PageHeader));
+  readAt(&header, sizeof(PageHeader), pagePosition(page_number));
   return header;
 }
 
+void PageFile::writePageHeader(const PageId page_number,
+                               const PageHeader& header) {
+  writeAt(&header, sizeof(PageHeader), pagePosition(page_number));
+}
+
+void PageFile::loadDirectory() const {
+  if (handle_->directory_loaded) {
+    return;
+  }
+  const FileHeader header = readHeader();
+  std::vector<std::uint64_t> used_pages(header.num_pages / 64 + 1, 0);
+  for (PageId page_number = header.first_used_page;
+       page_number != Page::INVALID_NUMBER;
+       page_number = readPageHeader(page_number).next_page_number) {
+    used_pages[page_number / 64] |= std::uint64_t(1) << (page_number % 64);
+  }
+  handle_->used_pages.swap(used_pages);
+  handle_->directory_loaded = true;
+}
+
+void PageFile::setPageUsed(const PageId page_number, const bool used) const {
+  if (!handle_->directory_loaded) {
+    return;
+  }
+  std::vector<std::uint64_t>& used_pages = handle_->used_pages;
+  const std::size_t word = page_number / 64;
+  if (word >= used_pages.size()) {
+    used_pages.resize(word + 1, 0);
+  }
+  const std::uint64_t bit = std::uint64_t(1) << (page_number % 64);
+  if (used) {
+    used_pages[word] |= bit;
+  } else {
+    used_pages[word] &= ~bit;
+  }
+}
+
+// The free space map is stored in pages of the file that are in neither the
+// used nor the free list, and read as free pages. Map page i holds the classes
+// of pages i * Page::DATA_SIZE to (i + 1) * Page::DATA_SIZE - 1, a byte each,
+// after its page header; the header's next page number chains the map pages.
+
+std::uint8_t PageFile::spaceClass(const Page& page) {
+  std::size_t free_bytes = page.getFreeSpace();
+  if (page.header_.num_free_slots == 0) {
+    // The record needs a new slot as well.
+    free_bytes = free_bytes > sizeof(PageSlot) ? free_bytes - sizeof(PageSlot) : 0;
+  }
+  return FreeSpaceMap::classOf(free_bytes);
+}
+
+void PageFile::loadFreeSpace() {
+  if (handle_->free_space_loaded) {
+    return;
+  }
+  const FileHeader header = readHeader();
+  FreeSpaceMap free_space;
+  std::vector<PageId> fsm_pages;
+  std::vector<std::uint8_t> classes(Page::DATA_SIZE);
+  for (PageId fsm_page = header.first_fsm_page;
+       fsm_page != Page::INVALID_NUMBER;
+       fsm_page = readPageHeader(fsm_page).next_page_number) {
+    readAt(&classes[0], Page::DATA_SIZE, pagePosition(fsm_page) + sizeof(PageHeader));
+    const PageId first_page = fsm_pages.size() * Page::DATA_SIZE;
+    for (std::size_t i = 0; i < Page::DATA_SIZE; ++i) {
+      if (classes[i] != 0) {
+        free_space.set(first_page + i, classes[i]);
+      }
+    }
+    fsm_pages.push_back(fsm_page);
+  }
+  handle_->free_space = free_space;
+  handle_->fsm_pages.swap(fsm_pages);
+  handle_->free_space_loaded = true;
+}
+
+void PageFile::setFreeSpace(const PageId page_number,
+                            const std::uint8_t space_class) {
+  loadFreeSpace();
+  FileHandle& handle = *handle_;
+  if (handle.free_space.get(page_number) == space_class) {
+    return;
+  }
+
+  const std::size_t fsm_index = page_number / Page::DATA_SIZE;
+  while (handle.fsm_pages.size() <= fsm_index) {
+    // Add a map page at the end of the file, all zeros so it reads as free.
+    FileHeader header = readHeader();
+    const PageId fsm_page = header.num_pages++;
+    std::vector<char> zeros(Page::SIZE, 0);
+    writeAt(&zeros[0], Page::SIZE, pagePosition(fsm_page));
+    if (handle.fsm_pages.empty()) {
+      header.first_fsm_page = fsm_page;
+    } else {
+      PageHeader previous_header = readPageHeader(handle.fsm_pages.back());
+      previous_header.next_page_number = fsm_page;
+      writePageHeader(handle.fsm_pages.back(), previous_header);
+    }
+    writeHeader(header);
+    handle.fsm_pages.push_back(fsm_page);
+  }
+
+  handle.free_space.set(page_number, space_class);
+  writeAt(&space_class, 1, pagePosition(handle.fsm_pages[fsm_index]) +
+          sizeof(PageHeader) + page_number % Page::DATA_SIZE);
+}
+
+PageId PageFile::previousUsedPage(const PageId page_number) const {
+  const std::vector<std::uint64_t>& used_pages = handle_->used_pages;
+  if (used_pages.empty()) {
+    return Page::INVALID_NUMBER;
+  }
+  // Bits below page_number in its word, then whole words down to page 0.
+  std::size_t word = page_number / 64;
+  std::uint64_t bits;
+  if (word >= used_pages.size()) {
+    word = used_pages.size() - 1;
+    bits = used_pages[word];
+  } else {
+    bits = used_pages[word] &
+        ((std::uint64_t(1) << (page_number % 64)) - 1);
+  }
+  while (bits == 0) {
+    if (word == 0) {
+      return Page::INVALID_NUMBER;
+    }
+    bits = used_pages[--word];
+  }
+  return word * 64 + 63 - __builtin_clzll(bits);
+}
+
 
 
 
@@ -362,16 +570,26 @@ BlobFile& BlobFile::operator=(const BlobFile& rhs) {
 }
 
 Page BlobFile::allocatePage(PageId &new_page_number) {
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
   FileHeader header = readHeader();
 	Page new_page;
 
-	new_page_number = header.num_pages;
-
-	if (header.first_used_page == Page::INVALID_NUMBER) {
-		header.first_used_page = header.num_pages;
+	if (header.num_free_pages > 0) {
+		// Reuse the page at the head of the free list.
+		new_page_number = header.first_free_page;
+		const Page free_page = readPage(new_page_number);
+		header.first_free_page = *reinterpret_cast<const PageId*>(&free_page);
+		--header.num_free_pages;
 	}
+	else {
+		new_page_number = header.num_pages;
+
+		if (header.first_used_page == Page::INVALID_NUMBER) {
+			header.first_used_page = header.num_pages;
+		}
 
-	++header.num_pages;
+		++header.num_pages;
+	}
 
 	writePage(new_page_number, new_page);
 	writeHeader(header);
@@ -381,20 +599,52 @@ Page BlobFile::allocatePage(PageId &new_page_number) {
 
 Page BlobFile::readPage(const PageId page_number) const {
 	Page page;
-	stream_->seekg(pagePosition(page_number), std::ios::beg);
-	stream_->read(reinterpret_cast<char*>(&page), Page::SIZE);
+	readAt(&page, Page::SIZE, pagePosition(page_number));
 	return page;
 }
 
 void BlobFile::writePage(const PageId new_page_number, const Page& new_page) {
-	stream_->seekp(pagePosition(new_page_number), std::ios::beg);
-	stream_->write(reinterpret_cast<const char*>(&new_page), Page::SIZE);
-	stream_->flush();
+	writeAt(&new_page, Page::SIZE, pagePosition(new_page_number));
 }
 
-//delePage should not be called for a blob_file, not supported
 void BlobFile::deletePage(const PageId page_number) {
-	throw InvalidPageException(page_number, filename_);
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
+	FileHeader header = readHeader();
+	if (page_number == Page::INVALID_NUMBER || page_number >= header.num_pages ||
+			page_number == header.first_used_page) {
+		throw InvalidPageException(page_number, filename_);
+	}
+
+	// Blob pages have no header, so free pages are chained through their first bytes.
+	Page free_page;
+	*reinterpret_cast<PageId*>(&free_page) = header.first_free_page;
+	writePage(page_number, free_page);
+
+	header.first_free_page = page_number;
+	++header.num_free_pages;
+	writeHeader(header);
+}
+
+void BlobFile::map() {
+  std::lock_guard<std::recursive_mutex> lock(handle_->latch);
+  if (handle_->mapped != NULL) {
+    return;
+  }
+  const std::size_t length = pagePosition(readHeader().num_pages);
+  void* mapped = ::mmap(NULL, length, PROT_READ, MAP_SHARED, handle_->fd, 0);
+  if (mapped == MAP_FAILED) {
+    throw FileIOException(filename_, "mmap", errno);
+  }
+  handle_->mapped = static_cast<const char*>(mapped);
+  handle_->mapped_length = length;
+}
+
+const Page* BlobFile::mappedPage(const PageId page_number) const {
+  if (handle_->mapped == NULL || page_number == Page::INVALID_NUMBER ||
+      pagePosition(page_number) + Page::SIZE > handle_->mapped_length) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  return reinterpret_cast<const Page*>(handle_->mapped + pagePosition(page_number));
 }
 
 }
@@ -7,11 +7,15 @@
 
 #pragma once
 
-#include <fstream>
+#include <atomic>
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/types.h>
 
+#include "free_space_map.h"
 #include "page.h"
 
 namespace badgerdb {
@@ -42,6 +46,18 @@ struct FileHeader {
    */
   PageId first_free_page;
 
+  /**
+   * Page number of the last used page in the file, the tail of the used list,
+   * so a page added at the end of the file is linked without walking the list.
+   */
+  PageId last_used_page;
+
+  /**
+   * Page number of the first page of the free space map of a PageFile, or
+   * Page::INVALID_NUMBER while the file has none.
+   */
+  PageId first_fsm_page;
+
   /**
    * Returns true if this file header is equal to the other.
    *
@@ -52,23 +68,118 @@ struct FileHeader {
     return num_pages == rhs.num_pages &&
         num_free_pages == rhs.num_free_pages &&
         first_used_page == rhs.first_used_page &&
-        first_free_page == rhs.first_free_page;
+        first_free_page == rhs.first_free_page &&
+        last_used_page == rhs.last_used_page &&
+        first_fsm_page == rhs.first_fsm_page;
   }
 };
 
+/**
+ * @brief Descriptor of an open file, shared by all File objects open on it.
+ */
+struct FileHandle {
+  /**
+   * UNIX file descriptor, closed with the handle.
+   */
+  int fd;
+
+  /**
+   * Latch serializing the operations that change the structure of the file
+   * (header, page lists). Held by each public page operation but reads.
+   */
+  std::recursive_mutex latch;
+
+  /**
+   * Number of reads issued to the file.
+   */
+  std::atomic<std::uint64_t> reads;
+
+  /**
+   * Number of writes issued to the file.
+   */
+  std::atomic<std::uint64_t> writes;
+
+  /**
+   * Number of writes on disk after the last fsync.
+   */
+  std::uint64_t synced;
+
+  /**
+   * Serializes fsync calls, so one call covers the writes of every thread
+   * that waited for it.
+   */
+  std::mutex sync_latch;
+
+  /**
+   * In-memory page directory of a PageFile: bit i of the vector is set if page
+   * i is used. Guarded by the latch, and built from the used list the first
+   * time a page is reused or deleted.
+   */
+  std::vector<std::uint64_t> used_pages;
+
+  /**
+   * True once used_pages has been built.
+   */
+  bool directory_loaded;
+
+  /**
+   * Free space map of a PageFile, guarded by the latch and read from the
+   * map pages the first time it is needed.
+   */
+  FreeSpaceMap free_space;
+
+  /**
+   * Pages of the free space map on disk, in the order of the pages they cover.
+   */
+  std::vector<PageId> fsm_pages;
+
+  /**
+   * True once free_space and fsm_pages have been read.
+   */
+  bool free_space_loaded;
+
+  /**
+   * Read-only memory mapping of the whole file made by BlobFile::map(), or
+   * NULL. Guarded by the latch, and unmapped with the handle.
+   */
+  const char* mapped;
+
+  /**
+   * Length of the mapping in bytes.
+   */
+  std::size_t mapped_length;
+
+  /**
+   * Constructs a handle owning the given descriptor.
+   */
+  explicit FileHandle(const int descriptor)
+      : fd(descriptor), reads(0), writes(0), synced(0), directory_loaded(false),
+        free_space_loaded(false), mapped(NULL), mapped_length(0) {}
+
+  /**
+   * Unmaps the file and closes the descriptor.
+   */
+  ~FileHandle();
+};
+
 /**
  * @brief Class which represents a file in the filesystem containing database
  *        pages.
  *
- * The File class wraps a stream to an underlying file on disk.  Files contain
+ * The File class wraps a descriptor of an underlying file on disk.  Files contain
  * fixed-sized pages, and they never deallocate space (though they do reuse
  * deleted pages if possible).  If multiple File objects refer to the same
- * underlying file, they will share the stream in memory.
+ * underlying file, they will share the descriptor.
  * If a file that has already been opened (possibly by another query), then the File class
- * detects this (by looking in the open_streams_ map) and just returns a file object with
- * the already created stream for the file without actually opening the UNIX file again. 
+ * detects this (by looking in the open_handles_ map) and just returns a file object with
+ * the already created handle for the file without actually opening the UNIX file again. 
+ *
+ * Pages are read and written with positional I/O (pread/pwrite), so there is no shared
+ * file position and reads from several threads run at the same time. Writes go to the
+ * operating system's cache; they reach the disk when sync() is called.
  *
- * @warning This class is not threadsafe.
+ * @warning Opening, closing and removing files is not threadsafe. Page operations (allocating, reading,
+ *          writing and deleting pages) may be called from several threads once the file is open.
  */
 
 
@@ -157,6 +268,26 @@ class File {
    */
   const std::string& filename() const { return filename_; }
 
+  /**
+   * Returns the number identifying this File object. Every object gets its own, even when it
+   * shares the underlying file with others, so it can stand for the object in a 64-bit key.
+   *
+   * @return Id of this object, never 0.
+   */
+  std::uint32_t id() const { return id_; }
+
+  /**
+   * Returns the number of reads issued to the file so far, through any File
+   * object open on it. A page read may take more than one.
+   */
+  std::uint64_t readCount() const { return handle_->reads; }
+
+  /**
+   * Returns the number of writes issued to the file so far, through any File
+   * object open on it. A page write may take more than one.
+   */
+  std::uint64_t writeCount() const { return handle_->writes; }
+
  	/**
    * Returns pageid of first page in the file.
    *
@@ -164,6 +295,23 @@ class File {
    */
 	PageId getFirstPageNo();
 
+  /**
+   * Returns the number the next page added at the end of the file gets. Every
+   * page of the file, used or free, has a lower number.
+   *
+   * @return  Number of the first page past the end of the file.
+   */
+  PageId getEndPageNo() const;
+
+  /**
+   * Forces the pages written to the file so far, through any File object open
+   * on it, to disk. Concurrent calls are batched: a call whose writes were
+   * covered by an fsync started after them returns without one of its own.
+   *
+   * @throws  FileIOException   If the fsync fails.
+   */
+  void sync() const;
+
  protected:
   /**
    * Returns the position of the page with the given number in the file (as an
@@ -172,14 +320,14 @@ class File {
    * @param page_number   Number of page.
    * @return  Position of page in file.
    */
-  static std::streampos pagePosition(const PageId page_number) {
+  static off_t pagePosition(const PageId page_number) {
     return sizeof(FileHeader) + ((page_number - 1) * Page::SIZE);
   }
 
   /**
    * Opens the underlying file named in filename_.
    * This method only opens the file if no other File objects exist that access
-   * the same filesystem file; otherwise, it reuses the existing stream.
+   * the same filesystem file; otherwise, it reuses the existing handle.
    *
    * @param create_new  Whether to create a new file.
    * @throws  FileExistsException     If the underlying file exists and
@@ -190,7 +338,7 @@ class File {
   void openIfNeeded(const bool create_new);
 
   /**
-   * Closes the underlying file stream in <stream_>.
+   * Closes the underlying file handle in <handle_>.
    * This method only closes the file if no other File objects exist that access
    * the same file.
    */
@@ -210,30 +358,77 @@ class File {
    */
   void writeHeader(const FileHeader& header);
 
-  typedef std::map<std::string, std::shared_ptr<std::fstream> > StreamMap;
+  /**
+   * Reads size bytes at offset pos of the file. Bytes past the end of the
+   * file read as zeros.
+   *
+   * @throws  FileIOException   If the read fails.
+   */
+  void readAt(void* buffer, const std::size_t size, const off_t pos) const;
+
+  /**
+   * Writes size bytes at offset pos of the file.
+   *
+   * @throws  FileIOException   If the write fails.
+   */
+  void writeAt(const void* buffer, const std::size_t size, const off_t pos) const;
+
+  /**
+   * Returns true if a page is written by writing its Page::SIZE bytes at
+   * pagePosition(), with no change to the copy on disk needed, so writes can
+   * be issued without a latch.
+   */
+  virtual bool writesInPlace() const = 0;
+
+  /**
+   * Checks a page read as Page::SIZE bytes at pagePosition(), as readPage()
+   * does.
+   *
+   * @throws  InvalidPageException  If the page is not a page of the file.
+   */
+  virtual void checkPage(const PageId page_number, const Page& page) const = 0;
+
+  typedef std::map<std::string, std::shared_ptr<FileHandle> > HandleMap;
   typedef std::map<std::string, int> CountMap;
 
   /**
-   * Streams for opened files.
+   * Handles of opened files.
    */
-  static StreamMap open_streams_;
+  static HandleMap open_handles_;
 
   /**
    * Counts for opened files.
    */
   static CountMap open_counts_;
 
+  /**
+   * Guards open_handles_ and open_counts_, so files can be opened and closed
+   * from several threads at once.
+   */
+  static std::mutex open_latch_;
+
   /**
    * Name of the file this object represents.
    */
   std::string filename_;
 
   /**
-   * Stream for underlying filesystem object.
+   * Id of this object; see id().
+   */
+  std::uint32_t id_;
+
+  /**
+   * Id given to the next File object.
+   */
+  static std::atomic<std::uint32_t> next_id_;
+
+  /**
+   * Handle of the underlying filesystem object.
    */
-  std::shared_ptr<std::fstream> stream_;
+  std::shared_ptr<FileHandle> handle_;
 
   friend class FileIterator;
+  friend class UringEngine;
 };
 
 class PageFile : public File {
@@ -249,10 +444,10 @@ class PageFile : public File {
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
-	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
+	 * It first checks if the file is already open. If so, then the new File object created uses the same descriptor to read to or write fom
 	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the handle associated with this File object are inserted into the
+	 * open_handles_ map.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
@@ -326,6 +521,33 @@ class PageFile : public File {
    */
   void deletePage(const PageId page_number);
 
+  /**
+   * Returns a used page the free space map says has room for a record of the
+   * given length, the one with the lowest number if there are several.
+   *
+   * @param record_length   Length of the record to insert.
+   * @return  Number of the page, or Page::INVALID_NUMBER if no page has room.
+   */
+  PageId findPageWithSpace(const std::size_t record_length);
+
+  /**
+   * Records in the free space map the room left on a page changed in memory,
+   * such as a page in the buffer pool, before it is written back. Writing a
+   * page records it as well.
+   *
+   * @param page    Page, used, of this file.
+   */
+  void updateFreeSpace(const Page& page);
+
+  /**
+   * Returns the numbers of the used pages of the file in ascending order.
+   * They come from the page directory, so no page is read in full and the
+   * pages can be split between threads before any of them is read.
+   *
+   * @return  Numbers of the used pages.
+   */
+  std::vector<PageId> usedPages() const;
+
   /**
    * Returns an iterator at the first page in the file.
    *
@@ -347,8 +569,8 @@ class PageFile : public File {
    * Reads a page from the file.  If <allow_free> is not set, an exception
    * will be thrown if the page read from disk is not currently in use.
    *
-   * No bounds checking is performed; the underlying file stream will throw
-   * an exception if the page is past the end of the file.
+   * No bounds checking is performed; a page past the end of the file reads
+   * as a free page.
    *
    * @param page_number   Number of page to read.
    * @param allow_free    Whether to allow reading a free (unused) page.
@@ -379,6 +601,65 @@ class PageFile : public File {
    */
   PageHeader readPageHeader(const PageId page_number) const;
 
+  /**
+   * Writes only the header of the given page to disk.  No bounds checking is
+   * performed.
+   *
+   * @param page_number   Number of page whose header is to be written.
+   * @param header        Header to write.
+   */
+  void writePageHeader(const PageId page_number, const PageHeader& header);
+
+  /**
+   * Builds the page directory of the file from its used list, unless it is
+   * built already. The latch must be held.
+   */
+  void loadDirectory() const;
+
+  /**
+   * Marks a page used or free in the page directory, if it is built. The
+   * latch must be held.
+   */
+  void setPageUsed(const PageId page_number, const bool used) const;
+
+  /**
+   * Returns the used page with the highest number below the given one, from
+   * the page directory, which must be built.
+   *
+   * @param page_number   Number of page.
+   * @return  Number of the previous used page, or Page::INVALID_NUMBER.
+   */
+  PageId previousUsedPage(const PageId page_number) const;
+
+  /**
+   * Returns the free space class of a page: the room it has for one more
+   * record, including the slot the record may need.
+   */
+  static std::uint8_t spaceClass(const Page& page);
+
+  /**
+   * Reads the free space map of the file, unless it is read already. The
+   * latch must be held.
+   */
+  void loadFreeSpace();
+
+  /**
+   * Sets the free space class of a page in the map and on disk, adding map
+   * pages at the end of the file if the page is past the ones the map covers.
+   * The latch must be held.
+   */
+  void setFreeSpace(const PageId page_number, const std::uint8_t space_class);
+
+  /**
+   * False: writes keep the next page number of the copy on disk.
+   */
+  bool writesInPlace() const { return false; }
+
+  /**
+   * Throws InvalidPageException if the page is not in use.
+   */
+  void checkPage(const PageId page_number, const Page& page) const;
+
   friend class FileIterator;
 };
 
@@ -395,10 +676,10 @@ class BlobFile : public File {
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
-	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
+	 * It first checks if the file is already open. If so, then the new File object created uses the same descriptor to read to or write fom
 	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the handle associated with this File object are inserted into the
+	 * open_handles_ map.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
@@ -442,7 +723,7 @@ class BlobFile : public File {
   ~BlobFile();
 
   /**
-   * Allocates a new page in the file.
+   * Allocates a new page in the file, reusing a deleted page if there is one.
    *
    * @return The new page.
    */
@@ -468,11 +749,51 @@ class BlobFile : public File {
   void writePage(const PageId page_number, const Page& new_page);
 
   /**
-   * Deletes a page from the file.
+   * Deletes a page from the file. The page goes to the free list of the file
+   * and is handed out again by allocatePage().
    *
    * @param page_number   Number of page to delete.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                the first page.
    */
   void deletePage(const PageId page_number);
+
+  /**
+   * Maps the file read-only into memory, so its pages can be addressed in
+   * place with mappedPage() and are served from the OS page cache without a
+   * copy. The mapping covers the pages the file has now and is shared by all
+   * BlobFile objects open on the file; it stays until the file is closed.
+   * The file must not be written while it is mapped.
+   *
+   * @throws  FileIOException  If the file cannot be mapped.
+   */
+  void map();
+
+  /**
+   * Returns true if the file has been mapped with map().
+   */
+  bool isMapped() const { return handle_->mapped != NULL; }
+
+  /**
+   * Returns the page with the given number in the mapping made by map().
+   *
+   * @param page_number   Number of page to address.
+   * @return  The page, in place in the mapping.
+   * @throws  InvalidPageException  If the file is not mapped or the page is
+   *                                past the end of the mapping.
+   */
+  const Page* mappedPage(const PageId page_number) const;
+
+ private:
+  /**
+   * True: blob pages are stored as they are.
+   */
+  bool writesInPlace() const { return true; }
+
+  /**
+   * Any page can be read from a blob file.
+   */
+  void checkPage(const PageId page_number, const Page& page) const {}
 };
 
 }
@@ -5,6 +5,7 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
 #include "filescan.h"
 #include "exceptions/end_of_file_exception.h"
 
@@ -16,7 +17,7 @@ FileScan::FileScan(const std::string &name, BufMgr *bufferMgr)
 	bufMgr = bufferMgr;
 	curDirtyFlag = false;
   curPage = NULL;
-	filePageIter = file->begin();
+	curPageNo = file->getFirstPageNo();
 }
 
 FileScan::~FileScan()
@@ -24,10 +25,9 @@ FileScan::~FileScan()
   // generally must unpin last page of the scan
   if (curPage != NULL)
   {
-    bufMgr->unPinPage(file, (*filePageIter).page_number(), curDirtyFlag);
+    bufMgr->unPinPage(file, curPageNo, curDirtyFlag);
     curPage = NULL;
 		curDirtyFlag = false;
-    filePageIter = file->begin();
   }
   bufMgr->flushFile(file);
   delete file;
@@ -35,9 +35,7 @@ FileScan::~FileScan()
 
 void FileScan::scanNext(RecordId& outRid)
 {
-  std::string rec;
-
-  if (filePageIter == file->end())
+  if (curPageNo == Page::INVALID_NUMBER)
 	{
 		throw EndOfFileException();
 	}
@@ -45,15 +43,8 @@ void FileScan::scanNext(RecordId& outRid)
   // special case of the first record of the first page of the file
   if (curPage == NULL)
   {
-    // need to get the first page of the file
-		filePageIter = file->begin();
-    if(filePageIter == file->end())
-		{
-			throw EndOfFileException();
-		}
-	 
 		// read the first page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage); 
+    readCurPage();
 		curDirtyFlag = false;
 
 		// get the first record off the page
@@ -61,9 +52,6 @@ void FileScan::scanNext(RecordId& outRid)
 
 		if(pageRecordIter != curPage->end()) 
 		{
-		  // get pointer to record
-		  rec = *pageRecordIter;
-
 			outRid = pageRecordIter.getCurrentRecord();
 			return;
 		}
@@ -76,34 +64,41 @@ void FileScan::scanNext(RecordId& outRid)
   while (pageRecordIter == curPage->end())
   {
     // unpin the current page
-    bufMgr->unPinPage(file, (*filePageIter).page_number(), curDirtyFlag);
+    const PageId nextPageNo = curPage->next_page_number();
+    bufMgr->unPinPage(file, curPageNo, curDirtyFlag);
     curPage = NULL;
     curDirtyFlag = false;
 
-    filePageIter++;
-    if (filePageIter == file->end())
+    curPageNo = nextPageNo;
+    if (curPageNo == Page::INVALID_NUMBER)
     {
-      curPage = NULL;
 			throw EndOfFileException();
     }
 
     // read the next page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage);
+    readCurPage();
 
     // get the first record off the page
     pageRecordIter = curPage->begin(); 
   }
 
   // curRec points at a valid record
-  // see if the record satisfies the scan's predicate 
-  // get a pointer to the record
-  rec = *pageRecordIter;
-
 	// return rid of the record
 	outRid = pageRecordIter.getCurrentRecord();
 	return;
 }
 
+// read curPageNo into curPage
+void FileScan::readCurPage()
+{
+  bufMgr->readPage(file, curPageNo, curPage);
+
+  // pages in file order are read ahead by the buffer manager; ask for a page out of order early
+  const PageId nextPageNo = curPage->next_page_number();
+  if (nextPageNo != Page::INVALID_NUMBER && nextPageNo != curPageNo + 1)
+    bufMgr->prefetchPages(file, &nextPageNo, 1);
+}
+
 // returns pointer to the current record.  page is left pinned
 // and the scan logic is required to unpin the page 
 std::string FileScan::getRecord()
@@ -111,10 +106,96 @@ std::string FileScan::getRecord()
   return *pageRecordIter;
 }
 
+// returns the current record in place, without copying it.  valid while
+// the scan stays on its page, i.e. until the next call to scanNext
+RecordView FileScan::getRecordView() const
+{
+  return pageRecordIter.getRecordView();
+}
+
 // mark current page of scan dirty
 void FileScan::markDirty()
 {
   curDirtyFlag = true;
 }
 
+ParallelFileScan::ParallelFileScan(const std::string &name, BufMgr *bufferMgr, const std::size_t morselPagesIn)
+  : nextPage(0)
+{
+  file = new PageFile(name, false);	//dont create new file
+  bufMgr = bufferMgr;
+  pageNos = file->usedPages();
+  morselPages = std::max<std::size_t>(1, morselPagesIn);
+}
+
+ParallelFileScan::~ParallelFileScan()
+{
+  bufMgr->flushFile(file);
+  delete file;
+}
+
+bool ParallelFileScan::nextMorsel(std::size_t& begin, std::size_t& end)
+{
+  begin = nextPage.fetch_add(morselPages);
+  if (begin >= pageNos.size())
+    return false;
+  end = std::min(begin + morselPages, pageNos.size());
+  return true;
+}
+
+FileScanWorker::FileScanWorker(ParallelFileScan *scanIn)
+  : scan(scanIn), curPage(NULL), curIndex(0), morselEnd(0)
+{
+}
+
+FileScanWorker::~FileScanWorker()
+{
+  if (curPage != NULL)
+    scan->bufMgr->unPinPage(scan->file, scan->pageNos[curIndex], false);
+}
+
+void FileScanWorker::scanNext(RecordId& outRid)
+{
+  if (curPage != NULL)
+    pageRecordIter++;
+
+  while (curPage == NULL || pageRecordIter == curPage->end())
+  {
+    if (curPage != NULL)
+    {
+      scan->bufMgr->unPinPage(scan->file, scan->pageNos[curIndex], false);
+      curPage = NULL;
+      curIndex++;
+    }
+
+    if (curIndex == morselEnd)
+    {
+      if (!scan->nextMorsel(curIndex, morselEnd))
+      {
+        curIndex = morselEnd = 0;
+        throw EndOfFileException();
+      }
+      // other workers read elsewhere in the file, so the buffer manager cannot tell the morsel is read in
+      // order: ask for the rest of it up front
+      if (morselEnd - curIndex > 1)
+        scan->bufMgr->prefetchPages(scan->file, &scan->pageNos[curIndex + 1], morselEnd - curIndex - 1);
+    }
+
+    scan->bufMgr->readPage(scan->file, scan->pageNos[curIndex], curPage);
+    pageRecordIter = curPage->begin();
+  }
+
+  outRid = pageRecordIter.getCurrentRecord();
+}
+
+std::string FileScanWorker::getRecord()
+{
+  return *pageRecordIter;
+}
+
+RecordView FileScanWorker::getRecordView() const
+{
+  return pageRecordIter.getRecordView();
+}
+
 }
@@ -8,7 +8,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <vector>
 #include "types.h"
 #include "page.h"
 #include "buffer.h"
@@ -31,13 +33,19 @@ class FileScan
   //return RecordId of next record that satisfies the scan 
   void scanNext(RecordId& outRid);
 
-  //read current record, returning pointer and length
+  //read current record, returning a copy of it
   std::string getRecord();
 
+  //read current record in place, valid until the next call to scanNext
+  RecordView getRecordView() const;
+
   //marks current page of scan dirty
   void markDirty();
 
  private:
+  //reads curPageNo into curPage
+  void readCurPage();
+
   /**
    * File which is being scanned.
    */
@@ -53,7 +61,13 @@ class FileScan
    */
   Page*         curPage;
 
-  FileIterator  filePageIter;
+  /**
+   * Number of the current page, or the first page of the file before the scan starts.
+   * The next page is found in the buffered current page, so the scan reads every page from
+   * disk at most once, through the buffer manager.
+   */
+  PageId        curPageNo;
+
   PageIterator  pageRecordIter;
 
   /**
@@ -62,4 +76,110 @@ class FileScan
   bool  	      curDirtyFlag;
 };
 
+/**
+ * @brief Morsel-driven scan of the records of a relation by several threads.
+ *
+ * The used pages of the relation, taken from its page directory, are handed out in morsels of consecutive
+ * pages to FileScanWorker objects, one per thread. A worker takes the next morsel once it is through with
+ * its own, so threads that get through their pages sooner take more of them.
+ */
+class ParallelFileScan
+{
+ public:
+  /**
+   * Number of pages in a morsel unless the constructor is told otherwise.
+   */
+  static const std::size_t MORSEL_PAGES = 16;
+
+  ParallelFileScan(const std::string &name, BufMgr *bufMgr, const std::size_t morselPages = MORSEL_PAGES);
+
+  // flushes the pages of the relation from the pool; every worker must be destroyed first
+  ~ParallelFileScan();
+
+  /**
+   * Hand out the next morsel, entries [begin, end) of the used pages. Can be called from any thread.
+   *
+   * @return  False once every page has been handed out
+   */
+  bool nextMorsel(std::size_t& begin, std::size_t& end);
+
+  /**
+   * Returns the number of used pages of the relation.
+   */
+  std::size_t pageCount() const { return pageNos.size(); }
+
+ private:
+  friend class FileScanWorker;
+
+  /**
+   * File which is being scanned.
+   */
+  PageFile      *file;
+
+  /**
+   * Buffer Manager instance used to read pages into the buffer pool.
+   */
+  BufMgr        *bufMgr;
+
+  /**
+   * Numbers of the used pages of the file, in ascending order.
+   */
+  std::vector<PageId> pageNos;
+
+  /**
+   * Number of pages in a morsel.
+   */
+  std::size_t   morselPages;
+
+  /**
+   * Entry of pageNos the next morsel starts at.
+   */
+  std::atomic<std::size_t> nextPage;
+};
+
+/**
+ * @brief The part of a ParallelFileScan run by one thread. Scans the records of the morsels it takes, one
+ * pinned page at a time, as FileScan does for the whole relation.
+ */
+class FileScanWorker
+{
+ public:
+
+  explicit FileScanWorker(ParallelFileScan *scan);
+
+  ~FileScanWorker();
+
+  //return RecordId of the next record of the morsels of this worker; throws EndOfFileException once no morsel is left
+  void scanNext(RecordId& outRid);
+
+  //read current record, returning a copy of it
+  std::string getRecord();
+
+  //read current record in place, valid until the next call to scanNext
+  RecordView getRecordView() const;
+
+ private:
+  /**
+   * Scan the worker takes its morsels from.
+   */
+  ParallelFileScan *scan;
+
+  /**
+   * Current page, pinned, or NULL between morsels.
+   */
+  Page*         curPage;
+
+  /**
+   * Entry of the pages of the scan the current page is at.
+   */
+  std::size_t   curIndex;
+
+  /**
+   * Entry of the pages of the scan past the end of the current morsel.
+   */
+  std::size_t   morselEnd;
+
+  PageIterator  pageRecordIter;
+};
+
 }
@@ -0,0 +1,56 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include "free_space_map.h"
+#include "page.h"
+
+namespace badgerdb {
+
+void FreeSpaceMap::set(const PageId page_number, const std::uint8_t space_class)
+{
+	if (page_number >= leaves)
+	{
+		if (space_class == 0)
+			return;
+
+		// Double the leaves until the page fits, and rebuild the inner nodes over the old ones.
+		std::size_t new_leaves = std::max<std::size_t>(leaves, 64);
+		while (new_leaves <= page_number)
+			new_leaves *= 2;
+		std::vector<std::uint8_t> new_tree(2 * new_leaves, 0);
+		std::copy(tree.begin() + leaves, tree.end(), new_tree.begin() + new_leaves);
+		for (std::size_t i = new_leaves - 1; i > 0; i--)
+			new_tree[i] = std::max(new_tree[2 * i], new_tree[2 * i + 1]);
+		tree.swap(new_tree);
+		leaves = new_leaves;
+	}
+
+	std::size_t node = leaves + page_number;
+	tree[node] = space_class;
+	for (node /= 2; node > 0; node /= 2)
+	{
+		const std::uint8_t largest = std::max(tree[2 * node], tree[2 * node + 1]);
+		if (tree[node] == largest)
+			break;
+		tree[node] = largest;
+	}
+}
+
+PageId FreeSpaceMap::find(const std::uint32_t space_class) const
+{
+	if (leaves == 0 || tree[1] < space_class)
+		return Page::INVALID_NUMBER;
+
+	// Go down to the left-most leaf with the class.
+	std::size_t node = 1;
+	while (node < leaves)
+		node = tree[2 * node] >= space_class ? 2 * node : 2 * node + 1;
+	return node - leaves;
+}
+
+}
@@ -0,0 +1,95 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+ * @brief In-memory copy of the free space map of a PageFile: for every page, the room a new record
+ * has on it, as a one byte class of UNIT bytes.
+ *
+ * The classes are the leaves of a complete binary tree whose inner nodes hold the largest class below
+ * them, so the first page with room for a record is found, and a class changed, in one pass down or
+ * up the tree. Pages the map has never been told about have class 0, no room.
+ */
+class FreeSpaceMap
+{
+ public:
+	/**
+	 * Number of bytes of free space per class.
+	 */
+	static const std::uint32_t UNIT = 32;
+
+	/**
+	 * Largest class, for UNIT * MAX_CLASS bytes of free space or more.
+	 */
+	static const std::uint32_t MAX_CLASS = 255;
+
+	/**
+	 * Returns the class of a page with free_bytes bytes of room for a new record, rounded down so
+	 * the page is never thought to have more room than it has.
+	 */
+	static std::uint8_t classOf(const std::size_t free_bytes)
+	{
+		return free_bytes / UNIT < MAX_CLASS ? free_bytes / UNIT : MAX_CLASS;
+	}
+
+	/**
+	 * Returns the lowest class whose pages surely have room for a record of record_length bytes,
+	 * or MAX_CLASS + 1 if no class is sure to.
+	 */
+	static std::uint32_t classFor(const std::size_t record_length)
+	{
+		const std::size_t units = (record_length + UNIT - 1) / UNIT;
+		return units < 1 ? 1 : (units > MAX_CLASS ? MAX_CLASS + 1 : units);
+	}
+
+	/**
+	 * Constructor of FreeSpaceMap class. The map starts with no page.
+	 */
+	FreeSpaceMap() : leaves(0) {}
+
+	/**
+	 * Returns the class of a page.
+	 */
+	std::uint8_t get(const PageId page_number) const
+	{
+		return page_number < leaves ? tree[leaves + page_number] : 0;
+	}
+
+	/**
+	 * Sets the class of a page, growing the map if the page is past its end.
+	 */
+	void set(const PageId page_number, const std::uint8_t space_class);
+
+	/**
+	 * Returns the page with the lowest number whose class is at least space_class, or
+	 * Page::INVALID_NUMBER if there is none.
+	 *
+	 * @param space_class	Class needed, at least 1
+	 */
+	PageId find(const std::uint32_t space_class) const;
+
+ private:
+	/**
+	 * Number of leaves of the tree, a power of two, or 0 while the map is empty.
+	 */
+	std::size_t leaves;
+
+	/**
+	 * Tree stored as an array: the root is element 1, the children of node i are 2i and 2i + 1, and the
+	 * class of page p is element leaves + p.
+	 */
+	std::vector<std::uint8_t> tree;
+};
+
+}
@@ -0,0 +1,421 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "io_engine.h"
+#include "exceptions/file_io_exception.h"
+
+// io_uring is used through its system calls, so only the kernel headers are needed
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BADGERDB_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace badgerdb {
+
+IoEngine* IoEngine::create(const unsigned queueDepth, const IoBackend backend)
+{
+  if (backend == IO_URING)
+  {
+    IoEngine* engine = UringEngine::create(queueDepth);
+    if (engine != NULL)
+      return engine;
+  }
+  return new ThreadPoolEngine(std::max(1u, std::min(queueDepth, 8u)), queueDepth);
+}
+
+void IoEngine::execute(const IoRequest& request)
+{
+  std::exception_ptr error;
+  try
+  {
+    if (request.op == IoRequest::READ)
+      *request.page = request.file->readPage(request.pageNo);
+    else
+      request.file->writePage(request.pageNo, *request.page);
+  }
+  catch(...)
+  {
+    error = std::current_exception();
+  }
+  request.done(error);
+}
+
+// -----------------------------------------------------------------------------
+// ThreadPoolEngine
+// -----------------------------------------------------------------------------
+
+ThreadPoolEngine::ThreadPoolEngine(const unsigned numThreads, const unsigned queueDepth)
+	: inFlight(0), queueDepth(std::max(1u, queueDepth)), stopping(false)
+{
+  for (unsigned i = 0; i < numThreads; i++)
+    workers.push_back(std::thread(&ThreadPoolEngine::work, this));
+}
+
+ThreadPoolEngine::~ThreadPoolEngine()
+{
+  drain();
+  {
+    std::lock_guard<std::mutex> lock(latch);
+    stopping = true;
+  }
+  requestQueued.notify_all();
+  for (std::size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+void ThreadPoolEngine::work()
+{
+  while (1)
+  {
+    IoRequest request;
+    {
+      std::unique_lock<std::mutex> lock(latch);
+      while (queue.empty() && !stopping)
+        requestQueued.wait(lock);
+      if (queue.empty())
+        return;
+      request = queue.front();
+      queue.pop_front();
+    }
+
+    execute(request);
+
+    std::lock_guard<std::mutex> lock(latch);
+    inFlight--;
+    requestDone.notify_all();
+  }
+}
+
+void ThreadPoolEngine::submit(const std::vector<IoRequest>& batch)
+{
+  std::unique_lock<std::mutex> lock(latch);
+  for (std::size_t i = 0; i < batch.size(); i++)
+  {
+    while (inFlight >= queueDepth)
+      requestDone.wait(lock);
+    queue.push_back(batch[i]);
+    inFlight++;
+    requestQueued.notify_one();
+  }
+}
+
+void ThreadPoolEngine::drain()
+{
+  std::unique_lock<std::mutex> lock(latch);
+  while (inFlight > 0)
+    requestDone.wait(lock);
+}
+
+// -----------------------------------------------------------------------------
+// UringEngine
+// -----------------------------------------------------------------------------
+
+#ifdef BADGERDB_IO_URING
+
+/**
+ * A request on the ring, and how much of its page has been transferred
+ */
+struct UringEngine::Pending
+{
+  IoRequest request;
+  struct iovec iov;
+  std::size_t done;
+};
+
+UringEngine* UringEngine::create(const unsigned queueDepth)
+{
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  const int fd = syscall(__NR_io_uring_setup, std::max(1u, queueDepth), &params);
+  if (fd < 0)
+    return NULL;
+
+  UringEngine* engine = new UringEngine(fd, params.sq_entries);
+  engine->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  engine->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    engine->sqRingSize = engine->cqRingSize = std::max(engine->sqRingSize, engine->cqRingSize);
+  engine->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  engine->sqRing = mmap(NULL, engine->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+      IORING_OFF_SQ_RING);
+  engine->cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? engine->sqRing :
+      mmap(NULL, engine->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  engine->sqes = mmap(NULL, engine->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+      IORING_OFF_SQES);
+  if (engine->sqRing == MAP_FAILED || engine->cqRing == MAP_FAILED || engine->sqes == MAP_FAILED)
+  {
+    delete engine;
+    return NULL;
+  }
+
+  char* sq = static_cast<char*>(engine->sqRing);
+  engine->sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  engine->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  engine->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  engine->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  char* cq = static_cast<char*>(engine->cqRing);
+  engine->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  engine->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  engine->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  engine->cqes = cq + params.cq_off.cqes;
+
+  engine->reaper = std::thread(&UringEngine::reap, engine);
+  return engine;
+}
+
+UringEngine::UringEngine(const int ringFd, const unsigned entries)
+	: ringFd(ringFd), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(MAP_FAILED), sqRingSize(0), cqRingSize(0),
+	  sqesSize(0), entries(entries), inFlight(0), stopping(false), fileWrites(2, entries)
+{
+}
+
+UringEngine::~UringEngine()
+{
+  if (reaper.joinable())
+  {
+    drain();
+
+    // wake the completion thread with a no-op, so it sees it must exit
+    std::lock_guard<std::mutex> lock(latch);
+    stopping = true;
+    const unsigned tail = *sqTail;
+    const unsigned index = tail & *sqMask;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_NOP;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    unsigned toSubmit = 1;
+    enter(toSubmit);
+  }
+  if (reaper.joinable())
+    reaper.join();
+
+  if (sqes != MAP_FAILED)
+    munmap(sqes, sqesSize);
+  if (cqRing != MAP_FAILED && cqRing != sqRing)
+    munmap(cqRing, cqRingSize);
+  if (sqRing != MAP_FAILED)
+    munmap(sqRing, sqRingSize);
+  close(ringFd);
+}
+
+void UringEngine::queue(Pending* pending)
+{
+  const IoRequest& request = pending->request;
+  pending->iov.iov_base = reinterpret_cast<char*>(request.page) + pending->done;
+  pending->iov.iov_len = Page::SIZE - pending->done;
+
+  // only submitters write the tail, and they hold the latch
+  const unsigned tail = *sqTail;
+  const unsigned index = tail & *sqMask;
+  struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = request.op == IoRequest::READ ? IORING_OP_READV : IORING_OP_WRITEV;
+  sqe->fd = request.file->handle_->fd;
+  sqe->off = File::pagePosition(request.pageNo) + pending->done;
+  sqe->addr = reinterpret_cast<std::uint64_t>(&pending->iov);
+  sqe->len = 1;
+  sqe->user_data = reinterpret_cast<std::uint64_t>(pending);
+  sqArray[index] = index;
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void UringEngine::enter(unsigned& toSubmit)
+{
+  while (toSubmit > 0)
+  {
+    const int ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, 0, 0, NULL, 0);
+    if (ret < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        continue;
+      throw FileIOException("io_uring", "submit to", errno);
+    }
+    toSubmit -= std::min<unsigned>(toSubmit, ret);
+  }
+}
+
+void UringEngine::submit(const std::vector<IoRequest>& batch)
+{
+  std::unique_lock<std::mutex> lock(latch);
+  unsigned toSubmit = 0;
+  try
+  {
+    for (std::size_t i = 0; i < batch.size(); i++)
+    {
+      // Writes that must merge with the page on disk take the file's latch, and go to threads
+      if (batch[i].op == IoRequest::WRITE && !batch[i].file->writesInPlace())
+      {
+        fileWrites.submit(batch[i]);
+        continue;
+      }
+
+      while (inFlight >= entries)
+      {
+        // the kernel must see the queued requests before any can complete
+        enter(toSubmit);
+        requestDone.wait(lock);
+      }
+      Pending* pending = new Pending();
+      pending->request = batch[i];
+      pending->done = 0;
+      queue(pending);
+      toSubmit++;
+      inFlight++;
+    }
+    enter(toSubmit);
+  }
+  catch(...)
+  {
+    // The kernel takes entries from the head of the ring, so the ones it did not take are the last ones.
+    // Take them back off, or the next enter() would pass them on in place of its own, and stop counting
+    // them, so drain() does not wait for requests that will never complete.
+    const unsigned tail = *sqTail - toSubmit;
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i < toSubmit; i++)
+    {
+      const struct io_uring_sqe* sqe = static_cast<const struct io_uring_sqe*>(sqes) + ((tail + i) & *sqMask);
+      delete reinterpret_cast<Pending*>(sqe->user_data);
+    }
+    inFlight -= toSubmit;
+    requestDone.notify_all();
+    throw;
+  }
+}
+
+void UringEngine::complete(Pending* pending, const int res)
+{
+  const IoRequest& request = pending->request;
+  std::exception_ptr error;
+  if (res < 0)
+  {
+    error = std::make_exception_ptr(FileIOException(request.file->filename(),
+        request.op == IoRequest::READ ? "read" : "write", -res));
+  }
+  else
+  {
+    pending->done += res;
+    if (pending->done < Page::SIZE)
+    {
+      if (request.op == IoRequest::READ && res == 0)
+      {
+        // End of file.
+        std::memset(reinterpret_cast<char*>(request.page) + pending->done, 0, Page::SIZE - pending->done);
+        pending->done = Page::SIZE;
+      }
+      else
+      {
+        // short transfer: queue the rest, the request stays in flight
+        std::lock_guard<std::mutex> lock(latch);
+        queue(pending);
+        unsigned toSubmit = 1;
+        try
+        {
+          enter(toSubmit);
+          return;
+        }
+        catch(...)
+        {
+          __atomic_store_n(sqTail, *sqTail - 1, __ATOMIC_RELEASE);
+          error = std::current_exception();
+        }
+      }
+    }
+
+    if (!error && request.op == IoRequest::READ)
+    {
+      request.file->handle_->reads++;
+      try
+      {
+        request.file->checkPage(request.pageNo, *request.page);
+      }
+      catch(...)
+      {
+        error = std::current_exception();
+      }
+    }
+    else if (!error)
+      request.file->handle_->writes++;
+  }
+
+  request.done(error);
+  delete pending;
+
+  std::lock_guard<std::mutex> lock(latch);
+  inFlight--;
+  requestDone.notify_all();
+}
+
+void UringEngine::reap()
+{
+  while (1)
+  {
+    const unsigned head = *cqHead;
+    const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+    {
+      {
+        std::lock_guard<std::mutex> lock(latch);
+        if (stopping && inFlight == 0)
+          return;
+      }
+      syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      continue;
+    }
+
+    const struct io_uring_cqe* cqe = static_cast<const struct io_uring_cqe*>(cqes) + (head & *cqMask);
+    Pending* pending = reinterpret_cast<Pending*>(cqe->user_data);
+    const int res = cqe->res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+    // the no-op sent at shutdown has no request
+    if (pending != NULL)
+      complete(pending, res);
+  }
+}
+
+void UringEngine::drain()
+{
+  fileWrites.drain();
+  std::unique_lock<std::mutex> lock(latch);
+  while (inFlight > 0)
+    requestDone.wait(lock);
+}
+
+#else
+
+UringEngine* UringEngine::create(const unsigned queueDepth)
+{
+  return NULL;
+}
+
+UringEngine::~UringEngine()
+{
+}
+
+void UringEngine::submit(const std::vector<IoRequest>& batch)
+{
+}
+
+void UringEngine::drain()
+{
+}
+
+#endif
+
+}
@@ -0,0 +1,308 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "file.h"
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Function called when an asynchronous page operation has completed, with a null pointer or
+ * the exception the operation failed with. Called on an I/O thread, so it must not throw, block, or
+ * submit requests to the engine that runs it.
+ */
+typedef std::function<void(std::exception_ptr)> IoCallback;
+
+/**
+ * @brief A page read or write submitted to an IoEngine.
+ */
+struct IoRequest
+{
+	/**
+	 * Operation of a request
+	 */
+	enum Op { READ, WRITE };
+
+	/**
+	 * Read or write
+	 */
+	Op op;
+
+	/**
+	 * File of the page; must stay open until the request completes
+	 */
+	File* file;
+
+	/**
+	 * Number of the page in the file
+	 */
+	PageId pageNo;
+
+	/**
+	 * Page read into, or written from; must stay valid until the request completes
+	 */
+	Page* page;
+
+	/**
+	 * Called once the request has completed
+	 */
+	IoCallback done;
+};
+
+/**
+ * @brief Backends an IoEngine can be created with.
+ */
+enum IoBackend
+{
+	IO_URING,
+	THREAD_POOL
+};
+
+/**
+ * @brief Runs page reads and writes asynchronously, many at a time, completing them in any order.
+ *
+ * Requests are submitted in batches and each one reports its completion through its callback.
+ * Reads have the semantics of File::readPage() and writes those of File::writePage(), including
+ * their exceptions. submit() can be called from any number of threads; it blocks only while as many
+ * requests as the queue depth are in flight.
+ */
+class IoEngine
+{
+ public:
+	/**
+	 * Returns a new engine keeping at most queueDepth requests in flight. An io_uring engine falls back
+	 * to a thread pool if the kernel does not provide io_uring.
+	 *
+	 * @param queueDepth	Maximum number of requests in flight
+	 * @param backend 	Preferred backend
+	 */
+	static IoEngine* create(const unsigned queueDepth, const IoBackend backend = IO_URING);
+
+	/**
+	 * Destructor of IoEngine class. Waits for the requests in flight.
+	 */
+	virtual ~IoEngine() {}
+
+	/**
+	 * Returns the backend the engine runs on.
+	 */
+	virtual IoBackend backend() const = 0;
+
+	/**
+	 * Start a batch of requests. If it throws, the requests it had not started yet never complete, and
+	 * drain() does not wait for them; the others complete as usual.
+	 */
+	virtual void submit(const std::vector<IoRequest>& batch) = 0;
+
+	/**
+	 * Start one request.
+	 */
+	void submit(const IoRequest& request)
+	{
+		submit(std::vector<IoRequest>(1, request));
+	}
+
+	/**
+	 * Wait until every request submitted so far has completed.
+	 */
+	virtual void drain() = 0;
+
+ protected:
+	/**
+	 * Run a request synchronously in the calling thread and call its callback.
+	 */
+	static void execute(const IoRequest& request);
+};
+
+/**
+ * @brief Engine running each request on one of a fixed set of worker threads, with the blocking
+ * File calls.
+ */
+class ThreadPoolEngine : public IoEngine
+{
+ private:
+	/**
+	 * Worker threads
+	 */
+	std::vector<std::thread> workers;
+
+	/**
+	 * Requests waiting for a worker
+	 */
+	std::deque<IoRequest> queue;
+
+	/**
+	 * Number of requests submitted and not completed
+	 */
+	unsigned inFlight;
+
+	/**
+	 * Maximum number of requests in flight
+	 */
+	unsigned queueDepth;
+
+	/**
+	 * Set when the workers must exit
+	 */
+	bool stopping;
+
+	/**
+	 * Guards queue, inFlight and stopping
+	 */
+	std::mutex latch;
+
+	/**
+	 * Signalled when a request is queued or the workers must exit
+	 */
+	std::condition_variable requestQueued;
+
+	/**
+	 * Signalled when a request completes
+	 */
+	std::condition_variable requestDone;
+
+	/**
+	 * Body of the worker threads
+	 */
+	void work();
+
+ public:
+	/**
+	 * Constructor of ThreadPoolEngine class
+	 *
+	 * @param numThreads	Number of worker threads
+	 * @param queueDepth	Maximum number of requests in flight
+	 */
+	ThreadPoolEngine(const unsigned numThreads, const unsigned queueDepth);
+	~ThreadPoolEngine();
+	IoBackend backend() const { return THREAD_POOL; }
+	using IoEngine::submit;
+	void submit(const std::vector<IoRequest>& batch);
+	void drain();
+};
+
+/**
+ * @brief Engine submitting reads, and writes of pages stored as they are in memory, to an io_uring
+ * of the kernel, and reaping their completions on one thread. Writes of files that must merge the
+ * page with its copy on disk (PageFile) go to a small thread pool.
+ */
+class UringEngine : public IoEngine
+{
+ private:
+	struct Pending;
+
+	/**
+	 * io_uring file descriptor
+	 */
+	int ringFd;
+
+	/**
+	 * Mapped submission queue ring, completion queue ring and submission queue entries
+	 */
+	void* sqRing;
+	void* cqRing;
+	void* sqes;
+
+	/**
+	 * Sizes of the mappings
+	 */
+	std::size_t sqRingSize;
+	std::size_t cqRingSize;
+	std::size_t sqesSize;
+
+	/**
+	 * Fields of the rings, inside the mappings
+	 */
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	void* cqes;
+
+	/**
+	 * Number of submission queue entries
+	 */
+	unsigned entries;
+
+	/**
+	 * Number of requests submitted to the ring and not completed
+	 */
+	unsigned inFlight;
+
+	/**
+	 * Set when the completion thread must exit
+	 */
+	bool stopping;
+
+	/**
+	 * Guards the submission queue, inFlight and stopping
+	 */
+	std::mutex latch;
+
+	/**
+	 * Signalled when a request completes
+	 */
+	std::condition_variable requestDone;
+
+	/**
+	 * Thread reaping completions
+	 */
+	std::thread reaper;
+
+	/**
+	 * Engine for the writes that cannot go to the ring
+	 */
+	ThreadPoolEngine fileWrites;
+
+	/**
+	 * Queue one request on the ring; the latch is held and there is room
+	 */
+	void queue(Pending* pending);
+
+	/**
+	 * Pass the last toSubmit queued requests to the kernel; the latch is held. Throws FileIOException if
+	 * the kernel refuses them, with toSubmit left at the number of requests it did not take.
+	 */
+	void enter(unsigned& toSubmit);
+
+	/**
+	 * Finish a request whose ring operation completed with result res
+	 */
+	void complete(Pending* pending, const int res);
+
+	/**
+	 * Body of the completion thread
+	 */
+	void reap();
+
+	UringEngine(const int ringFd, const unsigned entries);
+
+ public:
+	/**
+	 * Returns a new engine, or NULL if the kernel does not provide io_uring.
+	 */
+	static UringEngine* create(const unsigned queueDepth);
+	~UringEngine();
+	IoBackend backend() const { return IO_URING; }
+	using IoEngine::submit;
+	void submit(const std::vector<IoRequest>& batch);
+	void drain();
+};
+
+}
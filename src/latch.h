@@ -0,0 +1,143 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+namespace badgerdb {
+
+/**
+ * @brief Mode in which a latch is held.
+ */
+enum LatchMode
+{
+	SHARED,
+	EXCLUSIVE
+};
+
+/**
+ * @brief Reader/writer latch for short critical sections, such as the time a thread works on a page
+ * of the buffer pool.
+ *
+ * Any number of threads can hold it in SHARED mode, or one thread in EXCLUSIVE mode. A waiting
+ * writer keeps new readers out, so writers are not starved by a stream of readers. Waiting threads
+ * yield instead of sleeping, which suits latches held for microseconds; C++11 has no shared mutex.
+ *
+ * @warning Not recursive: a thread must not acquire a latch it already holds.
+ */
+class Latch
+{
+ private:
+	/**
+	 * Set while a thread holds the latch in EXCLUSIVE mode.
+	 */
+	static const unsigned WRITER = 1u << 31;
+
+	/**
+	 * Set while a thread waits for EXCLUSIVE mode.
+	 */
+	static const unsigned WAITING = 1u << 30;
+
+	/**
+	 * WRITER and WAITING bits, and in the remaining bits the number of SHARED holders.
+	 */
+	std::atomic<unsigned> state;
+
+ public:
+	/**
+	 * Constructor of Latch class. The latch starts free.
+	 */
+	Latch() : state(0) {}
+
+	/**
+	 * Returns true if the latch was free for a SHARED holder, and acquires it.
+	 */
+	bool tryLockShared()
+	{
+		unsigned s = state.load(std::memory_order_relaxed);
+		while ((s & (WRITER | WAITING)) == 0) {
+			if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire))
+				return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Acquire the latch in SHARED mode.
+	 */
+	void lockShared()
+	{
+		while (!tryLockShared())
+			std::this_thread::yield();
+	}
+
+	/**
+	 * Release a SHARED hold on the latch.
+	 */
+	void unlockShared()
+	{
+		state.fetch_sub(1, std::memory_order_release);
+	}
+
+	/**
+	 * Returns true if the latch was free, and acquires it in EXCLUSIVE mode.
+	 */
+	bool tryLockExclusive()
+	{
+		unsigned s = state.load(std::memory_order_relaxed);
+		while ((s & ~WAITING) == 0) {
+			if (state.compare_exchange_weak(s, WRITER, std::memory_order_acquire))
+				return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Acquire the latch in EXCLUSIVE mode.
+	 */
+	void lockExclusive()
+	{
+		while (!tryLockExclusive()) {
+			state.fetch_or(WAITING, std::memory_order_relaxed);
+			std::this_thread::yield();
+		}
+	}
+
+	/**
+	 * Release an EXCLUSIVE hold on the latch.
+	 */
+	void unlockExclusive()
+	{
+		state.store(0, std::memory_order_release);
+	}
+
+	/**
+	 * Acquire the latch in the given mode.
+	 */
+	void lock(const LatchMode mode)
+	{
+		if (mode == SHARED)
+			lockShared();
+		else
+			lockExclusive();
+	}
+
+	/**
+	 * Release a hold on the latch in the given mode.
+	 */
+	void unlock(const LatchMode mode)
+	{
+		if (mode == SHARED)
+			unlockShared();
+		else
+			unlockExclusive();
+	}
+};
+
+}
@@ -5,20 +5,34 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <new>
+#include <set>
+#include <thread>
 #include <vector>
 #include "btree.h"
+#include "bufHashTbl.h"
+#include "node_search.h"
 #include "page.h"
 #include "filescan.h"
 #include "page_iterator.h"
 #include "file_iterator.h"
+#include "exceptions/badgerdb_exception.h"
 #include "exceptions/insufficient_space_exception.h"
+#include "exceptions/page_pinned_exception.h"
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/no_such_key_found_exception.h"
 #include "exceptions/bad_scanrange_exception.h"
 #include "exceptions/bad_opcodes_exception.h"
+#include "exceptions/bad_index_info_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/buffer_exceeded_exception.h"
+#include "exceptions/index_read_only_exception.h"
 
 #define checkPassFail(a, b) 																				\
 {																																		\
@@ -69,6 +83,12 @@ void createRelationBackward();
 void createRelationRandom();
 void intTests();
 int intScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+void doubleTests();
+int doubleScan(BTreeIndex *index, double lowVal, Operator lowOp, double highVal, Operator highOp);
+void stringTests();
+int stringScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+int printScan(BTreeIndex *index);
+int batchScan(BTreeIndex *index, const void *lowVal, Operator lowOp, const void *highVal, Operator highOp, std::size_t batchSize);
 void indexTests();
 void test1();
 void test2();
@@ -76,6 +96,18 @@ void test3();
 void test4();
 void test5();
 void test6();
+void test7();
+void test8();
+void test9();
+int deleteEntries(BTreeIndex *intIndex, BTreeIndex *stringIndex, int parity);
+void longStringTests();
+void searchTests();
+void hashTableTests();
+void pageFileTests();
+void bufMgrTests();
+void replacementTests();
+void asyncIoTests();
+void threadTests();
 void errorTests();
 void deleteRelation();
 void indexTests3();
@@ -87,6 +119,7 @@ int main(int argc, char **argv)
 {
 	
   std::cout << "leaf size:" << INTARRAYLEAFSIZE << " non-leaf size:" << INTARRAYNONLEAFSIZE << std::endl;
+  std::cout << "node search kernel:" << nodeSearchKernel() << std::endl;
 
   // Clean up from any previous runs that crashed.
   try
@@ -129,8 +162,7 @@ int main(int argc, char **argv)
 			{
 				fscan.scanNext(scanRid);
 				//Assuming RECORD.i is our key, lets extract the key, which we know is INTEGER and whose byte offset is also know inside the record. 
-				std::string recordStr = fscan.getRecord();
-				const char *record = recordStr.c_str();
+				const char *record = fscan.getRecordView().data();
 				int key = *((int *)(record + offsetof (RECORD, i)));
 				std::cout << "Extracted : " << key << std::endl;
 			}
@@ -144,12 +176,23 @@ int main(int argc, char **argv)
 
 	File::remove(relationName);
 
+	searchTests();
+	hashTableTests();
+	pageFileTests();
+	bufMgrTests();
+	replacementTests();
+	asyncIoTests();
 	test1();
 	test2();
 	test3();
 	test6();
 	test4();
 	test5();
+	test7();
+	test8();
+	test9();
+	longStringTests();
+	threadTests();
 	errorTests();
 	File::remove(intIndexName);
 
@@ -273,8 +316,1754 @@ void test6() {
 	std::cout << "test6 passed" << std::endl;
 }
 
+void test7()
+{
+	// Bulk load half-full nodes over a random relation and perform the usual integer scans
+	std::cout << "--------------------" << std::endl;
+	std::cout << "createRelationRandom, fill factor 0.5" << std::endl;
+	createRelationRandom();
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.5);
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+		checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+		checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+	}
+	{
+		// The same index read-only from a mapping of the file: the pool only sees the record reads of printScan
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.5, true);
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		const int accesses = bufMgr->getBufStats().accesses;
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(bufMgr->getBufStats().accesses - accesses, 1000)
+
+		int key = 7;
+		RecordId rid;
+		rid.page_number = 1;
+		rid.slot_number = 1;
+		try
+		{
+			index.insertEntry(&key, rid);
+			std::cout << "Inserted into a read-only index" << std::endl;
+			exit(1);
+		}
+		catch(const IndexReadOnlyException&)
+		{
+			std::cout << "Test passed at line no:" << __LINE__ << std::endl;
+		}
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+	std::cout << "============test7 pass===========" << std::endl;
+}
+
+void test8()
+{
+	// Start from empty indexes on all three attributes and add a random relation through insertEntry,
+	// large enough to split the root of the string index
+	std::cout << "--------------------" << std::endl;
+	std::cout << "insertEntry into empty indexes" << std::endl;
+	{
+		// A new root has no first child, whatever the memory it is built in held before
+		std::vector<char> memory(sizeof(NonLeafNode<double>), 0x5a);
+		const NonLeafNode<double>* root = new (&memory[0]) NonLeafNode<double>();
+		const bool emptyRoot = root->k == 0 && root->child(0) == Page::INVALID_NUMBER;
+		checkPassFail(emptyRoot, true)
+	}
+	relationSize = 0;
+	createRelationForward();
+	relationSize = 20000;
+	{
+		BTreeIndex intIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeIndex doubleIndex(relationName, doubleIndexName, bufMgr, offsetof(tuple,d), DOUBLE);
+		BTreeIndex stringIndex(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+
+		std::vector<int> intvec(relationSize);
+		for( int i = 0; i < relationSize; i++ )
+		{
+			intvec[i] = i;
+		}
+		for( int i = relationSize - 1; i > 0; i-- )
+		{
+			std::swap(intvec[i], intvec[random() % (i + 1)]);
+		}
+
+		memset(record1.s, ' ', sizeof(record1.s));
+		PageId new_page_number;
+		Page new_page = file1->allocatePage(new_page_number);
+		for( int i = 0; i < relationSize; i++ )
+		{
+			sprintf(record1.s, "%05d string record", intvec[i]);
+			record1.i = intvec[i];
+			record1.d = intvec[i];
+			std::string new_data(reinterpret_cast<char*>(&record1), sizeof(RECORD));
+
+			RecordId insertRid;
+			while(1)
+			{
+				try
+				{
+					insertRid = new_page.insertRecord(new_data);
+					break;
+				}
+				catch(const InsufficientSpaceException&)
+				{
+					file1->writePage(new_page_number, new_page);
+					new_page = file1->allocatePage(new_page_number);
+				}
+			}
+			intIndex.insertEntry(&record1.i, insertRid);
+			doubleIndex.insertEntry(&record1.d, insertRid);
+			stringIndex.insertEntry(record1.s, insertRid);
+		}
+		file1->writePage(new_page_number, new_page);
+
+		checkPassFail(intScan(&intIndex,25,GT,40,LT), 14)
+		checkPassFail(intScan(&intIndex,-3,GT,3,LT), 3)
+		checkPassFail(intScan(&intIndex,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&intIndex,19990,GTE,30000,LT), 10)
+		checkPassFail(doubleScan(&doubleIndex,20,GTE,35,LTE), 16)
+		checkPassFail(doubleScan(&doubleIndex,996,GT,1001,LT), 4)
+		checkPassFail(stringScan(&stringIndex,300,GT,400,LT), 99)
+		checkPassFail(stringScan(&stringIndex,10000,GTE,20000,LT), 10000)
+
+		int low = 25, high = 19000;
+		checkPassFail(batchScan(&intIndex, &low, GT, &high, LTE, 1024), 18975)
+		checkPassFail(batchScan(&intIndex, &low, GT, &high, LTE, 7), 18975)
+		const char lowStr[] = "00300 string record";
+		const char highStr[] = "09000 string record";
+		checkPassFail(batchScan(&stringIndex, lowStr, GTE, highStr, LT, 1024), 8700)
+
+		// Point lookups find the one entry of a key, none for a missing key, and duplicates across leaves
+		std::vector<RecordId> rids;
+		int key = 4321;
+		checkPassFail(intIndex.lookup(&key, rids), 1)
+		const char keyStr[] = "04321 string record";
+		checkPassFail(stringIndex.lookup(keyStr, rids), 1)
+		const bool sameRecord = rids[0] == rids[1];
+		checkPassFail(sameRecord, true)
+		key = relationSize;
+		checkPassFail(intIndex.lookup(&key, rids), 0)
+
+		key = 7;
+		for (int i = 0; i < 2000; i++)
+		{
+			RecordId rid;
+			rid.page_number = 1;
+			rid.slot_number = i + 1;
+			intIndex.insertEntry(&key, rid);
+		}
+		rids.clear();
+		checkPassFail(intIndex.lookup(&key, rids), 2001)
+		int visited = 0;
+		const std::size_t found = intIndex.lookup(&key, [&visited](const RecordId&) { return ++visited < 10; });
+		checkPassFail(found, 10)
+	}
+	File::remove(intIndexName);
+	File::remove(doubleIndexName);
+	File::remove(stringIndexName);
+	deleteRelation();
+
+	// An insert that finds no frame for a node on its way down throws and gives back every latch and pin it
+	// took, so inserts go on once frames are free again and the entries that did go in are all there
+	std::cout << "insertEntry with the buffer pool full" << std::endl;
+	relationSize = 0;
+	createRelationForward();
+	const std::string otherName = relationName + ".other";
+	{
+		const int poolSize = 16;
+		const int numKeys = 20000;
+		BufMgr pool(poolSize);
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple,i), INTEGER);
+		PageFile other = PageFile::create(otherName);
+		// all frames but two stay with pages of another file: room for a node and its child, none for a split
+		std::vector<PageId> otherNos(poolSize);
+		for (int i = 0; i < poolSize; i++)
+		{
+			other.allocatePage(otherNos[i]);
+		}
+
+		std::vector<int> keys(numKeys);
+		for (int i = 0; i < numKeys; i++)
+		{
+			keys[i] = i;
+		}
+		for (int i = numKeys - 1; i > 0; i--)
+		{
+			std::swap(keys[i], keys[random() % (i + 1)]);
+		}
+		int failed = 0;
+		for (int start = 0; start < numKeys; start += 500)
+		{
+			Page* page;
+			for (int i = 0; i < poolSize - 2; i++)
+			{
+				pool.readPage(&other, otherNos[i], page);
+			}
+			std::vector<int> retry;
+			for (int i = start; i < start + 500; i++)
+			{
+				RecordId rid;
+				rid.page_number = 1;
+				rid.slot_number = keys[i] + 1;
+				try
+				{
+					index.insertEntry(&keys[i], rid);
+				}
+				catch(const BufferExceededException&)
+				{
+					retry.push_back(keys[i]);
+				}
+			}
+			for (int i = 0; i < poolSize - 2; i++)
+			{
+				pool.unPinPage(&other, otherNos[i], false);
+			}
+			failed += retry.size();
+			for (std::size_t i = 0; i < retry.size(); i++)
+			{
+				RecordId rid;
+				rid.page_number = 1;
+				rid.slot_number = retry[i] + 1;
+				index.insertEntry(&retry[i], rid);
+			}
+		}
+		// the first insert, the leaf splits and the root splits all need a third frame
+		const bool someFailed = failed > 0;
+		checkPassFail(someFailed, true)
+
+		// every key is found once, in order
+		int lowVal = 0, highVal = numKeys;
+		index.startScan(&lowVal, GTE, &highVal, LT);
+		int numFound = 0, outOfOrder = 0;
+		try
+		{
+			while (1)
+			{
+				RecordId rid;
+				index.scanNext(rid);
+				if ((int) rid.slot_number != numFound + 1)
+					outOfOrder++;
+				numFound++;
+			}
+		}
+		catch(const IndexScanCompletedException&)
+		{
+		}
+		index.endScan();
+		checkPassFail(numFound, numKeys)
+		checkPassFail(outOfOrder, 0)
+
+		// no frame is left pinned by the inserts that threw
+		int pinned = 0;
+		for (int i = 0; i < poolSize; i++)
+		{
+			Page* page;
+			if (!pool.tryReadPage(&other, otherNos[i], page))
+				pinned++;
+		}
+		checkPassFail(pinned, 0)
+		for (int i = 0; i < poolSize; i++)
+		{
+			pool.unPinPage(&other, otherNos[i], false);
+		}
+		pool.flushFile(&other);
+	}
+	File::remove(intIndexName);
+	File::remove(otherName);
+	deleteRelation();
+	relationSize = 5000;
+	std::cout << "============test8 pass===========" << std::endl;
+}
+
+
+void test9()
+{
+	// Delete the even keys, then the odd ones, from bulk loaded indexes; every leaf underflows, so
+	// leaves and non-leaves get merged and redistributed until the root collapses
+	std::cout << "--------------------" << std::endl;
+	std::cout << "deleteEntry" << std::endl;
+	createRelationRandom();
+	{
+		BTreeIndex intIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeIndex stringIndex(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+
+		checkPassFail(deleteEntries(&intIndex, &stringIndex, 0), relationSize / 2)
+		checkPassFail(intScan(&intIndex,25,GT,40,LT), 7)
+		checkPassFail(intScan(&intIndex,3000,GTE,4000,LT), 500)
+		checkPassFail(stringScan(&stringIndex,300,GT,400,LT), 50)
+
+		int key = 26;
+		RecordId rid;
+		rid.page_number = 1;
+		rid.slot_number = 1;
+		try
+		{
+			intIndex.deleteEntry(&key, rid);
+			std::cout << "Deleted a missing entry" << std::endl;
+			exit(1);
+		}
+		catch(const NoSuchKeyFoundException&)
+		{
+			std::cout << "Test passed at line no:" << __LINE__ << std::endl;
+		}
+
+		checkPassFail(deleteEntries(&intIndex, &stringIndex, 1), relationSize / 2)
+		checkPassFail(intScan(&intIndex,-1,GT,relationSize,LT), 0)
+		checkPassFail(stringScan(&stringIndex,0,GTE,relationSize,LT), 0)
+
+		// Insert everything again into the pages that were freed.
+		FileScan fscan(relationName, bufMgr);
+		try
+		{
+			RecordId scanRid;
+			while(1)
+			{
+				fscan.scanNext(scanRid);
+				const RECORD* record = reinterpret_cast<const RECORD*>(fscan.getRecordView().data());
+				intIndex.insertEntry(&record->i, scanRid);
+				stringIndex.insertEntry(record->s, scanRid);
+			}
+		}
+		catch(const EndOfFileException&)
+		{
+		}
+		checkPassFail(intScan(&intIndex,25,GT,40,LT), 14)
+		checkPassFail(stringScan(&stringIndex,300,GT,400,LT), 99)
+	}
+	File::remove(intIndexName);
+	File::remove(stringIndexName);
+	deleteRelation();
+	std::cout << "============test9 pass===========" << std::endl;
+}
+
+// Delete the entries of every record whose key has the given parity. Returns the number deleted.
+int deleteEntries(BTreeIndex *intIndex, BTreeIndex *stringIndex, int parity)
+{
+	int numDeleted = 0;
+	FileScan fscan(relationName, bufMgr);
+	try
+	{
+		RecordId scanRid;
+		while(1)
+		{
+			fscan.scanNext(scanRid);
+			const RECORD* record = reinterpret_cast<const RECORD*>(fscan.getRecordView().data());
+			if (record->i % 2 == parity) {
+				intIndex->deleteEntry(&record->i, scanRid);
+				stringIndex->deleteEntry(record->s, scanRid);
+				numDeleted++;
+			}
+		}
+	}
+	catch(const EndOfFileException&)
+	{
+	}
+	return numDeleted;
+}
+
+// -----------------------------------------------------------------------------
+// longStringTests
+// -----------------------------------------------------------------------------
+
+void longStringTests()
+{
+	// STRING keys much longer than the characters that tell them apart: keys of a group share their first
+	// 56 characters, keys longer than STRINGSIZE are cut to it and so fall together, and one key has
+	// thousands of entries. Leaves and separators keep the shared prefixes once, so the index needs far
+	// fewer pages than fixed width keys would, and it is still large enough to split nodes at every level.
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Long STRING keys with shared prefixes" << std::endl;
+	const char filler[] = "customers/europe/accounts/checking/transactions/2024";
+	const int numGroups = 40, perGroup = 1500, numTruncated = 2000, numDuplicates = 3000;
+	const int numEntries = numGroups * perGroup + numTruncated + numDuplicates;
+	char duplicateKey[80];
+	memset(duplicateKey, 'z', 70);
+	duplicateKey[70] = '\0';
+
+	relationSize = 0;
+	createRelationForward();
+	relationSize = 5000;
+	{
+		BTreeIndex stringIndex(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+		std::vector<int> order(numEntries);
+		for (int i = 0; i < numEntries; i++)
+			order[i] = i;
+		for (int i = numEntries - 1; i > 0; i--)
+			std::swap(order[i], order[random() % (i + 1)]);
+		for (int i = 0; i < numEntries; i++)
+		{
+			// entries [0, numGroups * perGroup) are grouped keys, then the truncated keys, then the duplicates
+			const int n = order[i];
+			char key[80];
+			if (n < numGroups * perGroup)
+				sprintf(key, "%04d/%.50s/%06d", n / perGroup, filler, n % perGroup);
+			else if (n < numGroups * perGroup + numTruncated)
+				sprintf(key, "truncated/%.49s/%06d", filler, n - numGroups * perGroup);
+			else
+				strcpy(key, duplicateKey);
+			RecordId rid;
+			rid.page_number = n / 100 + 1;
+			rid.slot_number = n % 100 + 1;
+			stringIndex.insertEntry(key, rid);
+		}
+
+		char low[80], high[80];
+		strcpy(low, "0007/");
+		strcpy(high, "0008/");
+		checkPassFail(batchScan(&stringIndex, low, GTE, high, LT, 256), perGroup)
+		sprintf(low, "0007/%.50s/%06d", filler, 100);
+		sprintf(high, "0007/%.50s/%06d", filler, 400);
+		checkPassFail(batchScan(&stringIndex, low, GT, high, LTE, 256), 300)
+
+		// truncated keys keep the first 4 of their 6 digits, so every 100 of them are one key; longer
+		// search keys are cut the same way
+		std::vector<RecordId> rids;
+		sprintf(low, "truncated/%.49s/%06d", filler, 1234);
+		checkPassFail(stringIndex.lookup(low, rids), 100)
+		sprintf(low, "truncated/%.49s/%06d", filler, 0);
+		sprintf(high, "truncated/%.49s/%06dxyz", filler, numTruncated - 1);
+		checkPassFail(batchScan(&stringIndex, low, GTE, high, LTE, 256), numTruncated)
+
+		rids.clear();
+		checkPassFail(stringIndex.lookup(duplicateKey, rids), numDuplicates)
+		checkPassFail(batchScan(&stringIndex, duplicateKey, GTE, duplicateKey, LTE, 256), numDuplicates)
+		checkPassFail(batchScan(&stringIndex, "", GTE, "~", LTE, 1024), numEntries)
+	}
+
+	{
+		// non-leaf nodes of level 0 are above other non-leaf nodes, so a root of level 0 means nodes split at
+		// the leaves and at the level above them
+		BlobFile indexFile(stringIndexName, false);
+		const Page metaPage = indexFile.readPage(indexFile.getFirstPageNo());
+		const IndexMetaInfo* meta = reinterpret_cast<const IndexMetaInfo*>(&metaPage);
+		const Page rootPage = indexFile.readPage(meta->rootPageNo);
+		const int rootLevel = reinterpret_cast<const NonLeafNodeString*>(&rootPage)->level;
+		const bool splitAbove = rootLevel == 0;
+		checkPassFail(splitAbove, true)
+	}
+	// A leaf of fixed width keys holds no more than fixedLeafEntries entries even when full. The whole index,
+	// filled by random inserts, takes fewer pages than the leaves of fixed width keys would if all were full.
+	std::ifstream indexStream(stringIndexName.c_str(), std::ios::binary | std::ios::ate);
+	const int indexPages = (int)(indexStream.tellg() / Page::SIZE);
+	const int fixedLeafEntries = Page::SIZE / (STRINGSIZE + sizeof(RecordId));
+	std::cout << "index pages: " << indexPages << ", fixed width leaves: " << numEntries / fixedLeafEntries << std::endl;
+	const bool compact = indexPages < numEntries / fixedLeafEntries;
+	checkPassFail(compact, true)
+	indexStream.close();
+
+	File::remove(stringIndexName);
+	deleteRelation();
+}
+
+// -----------------------------------------------------------------------------
+// searchTests
+// -----------------------------------------------------------------------------
+
+void searchTests()
+{
+	// Compare the node search kernels against a linear walk, on sorted arrays with duplicates, of every size up to a full node
+	std::cout << "Node search tests" << std::endl;
+	std::vector<int> keys;
+	int mismatches = 0;
+	for (int n = 0; n <= INTARRAYNONLEAFSIZE; n += (n < 64 ? 1 : 37))
+	{
+		keys.resize(n);
+		int val = -50;
+		for (int i = 0; i < n; i++)
+		{
+			val += random() % 3;
+			keys[i] = val;
+		}
+		for (int key = -52; key <= val + 2; key++)
+		{
+			int lower = 0, upper = 0;
+			while (lower < n && keys[lower] < key) lower++;
+			while (upper < n && keys[upper] <= key) upper++;
+			if (nodeLowerBound(keys.data(), n, key) != lower || nodeUpperBound(keys.data(), n, key) != upper)
+				mismatches++;
+		}
+	}
+	checkPassFail(mismatches, 0)
+}
+
+// -----------------------------------------------------------------------------
+// hashTableTests
+// -----------------------------------------------------------------------------
+
+void hashTableTests()
+{
+	// Insert and remove pages of a buffer pool hash table at random; every page must stay findable
+	// through the entries moved back by each removal, and removed pages must be gone
+	std::cout << "Buffer hash table tests" << std::endl;
+	int mismatches = 0;
+	{
+		const int numPages = 1000;
+		PageFile file = PageFile::create(relationName);
+		BufHashTbl table(numPages);
+		std::vector<int> frames(numPages, -1);
+		for (int round = 0; round < 20000; round++)
+		{
+			const PageId pageNo = random() % numPages;
+			if (frames[pageNo] < 0) {
+				table.insert(&file, pageNo, round);
+				frames[pageNo] = round;
+			}
+			else {
+				table.remove(&file, pageNo);
+				frames[pageNo] = -1;
+			}
+			if (round % 1000 != 0)
+				continue;
+			for (PageId i = 0; i < (PageId)numPages; i++)
+			{
+				FrameId frameNo = 0;
+				const bool found = table.find(&file, i, frameNo);
+				if (found != (frames[i] >= 0) || (found && frames[i] != (int)frameNo))
+					mismatches++;
+			}
+		}
+	}
+	checkPassFail(mismatches, 0)
+	File::remove(relationName);
+}
+
+// -----------------------------------------------------------------------------
+// bufMgrTests
+// -----------------------------------------------------------------------------
+
+void pageFileTests()
+{
+	// The used list stays in page order through deletes and reuse, and its tail survives reopening the file
+	std::cout << "Page file tests" << std::endl;
+	const int numPages = 100;
+	std::set<PageId> used;
+	PageId lastPageNo;
+	{
+		PageFile file = PageFile::create(relationName);
+		for (int i = 0; i < numPages; i++)
+		{
+			file.allocatePage(lastPageNo);
+			used.insert(lastPageNo);
+		}
+		// the head, the tail and every third page in between
+		const std::vector<PageId> pageNos(used.begin(), used.end());
+		for (int i = 0; i < numPages; i += 3)
+		{
+			file.deletePage(pageNos[i]);
+			used.erase(pageNos[i]);
+		}
+	}
+	{
+		PageFile file = PageFile::open(relationName);
+		for (int i = 0; i < numPages; i += 3)
+		{
+			PageId pageNo;
+			file.allocatePage(pageNo);
+			used.insert(pageNo);
+		}
+		// the free pages are used up, so this one goes at the end
+		PageId pageNo;
+		file.allocatePage(pageNo);
+		used.insert(pageNo);
+		checkPassFail(pageNo, lastPageNo + 1)
+
+		std::vector<PageId> listed;
+		for (FileIterator iter = file.begin(); iter != file.end(); ++iter)
+		{
+			listed.push_back((*iter).page_number());
+		}
+		const bool inOrder = listed == std::vector<PageId>(used.begin(), used.end());
+		checkPassFail(inOrder, true)
+	}
+	File::remove(relationName);
+
+	// Adding, deleting and reusing a page read and write a few page headers, however many pages the file has,
+	// and do not walk the used list
+	std::cout << "Page allocation cost" << std::endl;
+	{
+		PageFile file = PageFile::create(relationName);
+		const int numAppended = 20000;
+		std::vector<PageId> pageNos(numAppended);
+		std::uint64_t maxAppend = 0, maxDelete = 0, maxReuse = 0;
+		for (int i = 0; i < numAppended; i++)
+		{
+			const std::uint64_t ios = file.readCount() + file.writeCount();
+			file.allocatePage(pageNos[i]);
+			maxAppend = std::max(maxAppend, file.readCount() + file.writeCount() - ios);
+		}
+		// the first delete builds the page directory from the used list, once
+		file.deletePage(pageNos[0]);
+		for (int i = numAppended - 1; i > 0; i -= 7)
+		{
+			const std::uint64_t ios = file.readCount() + file.writeCount();
+			file.deletePage(pageNos[i]);
+			maxDelete = std::max(maxDelete, file.readCount() + file.writeCount() - ios);
+		}
+		for (int i = 0; i < numAppended / 7; i++)
+		{
+			const std::uint64_t ios = file.readCount() + file.writeCount();
+			PageId pageNo;
+			file.allocatePage(pageNo);
+			maxReuse = std::max(maxReuse, file.readCount() + file.writeCount() - ios);
+		}
+		std::cout << "most reads and writes of an append: " << maxAppend << ", a delete: " << maxDelete
+			<< ", a reuse: " << maxReuse << std::endl;
+		const bool bounded = maxAppend <= 16 && maxDelete <= 16 && maxReuse <= 16;
+		checkPassFail(bounded, true)
+	}
+	File::remove(relationName);
+
+	// Inserts fill the pages with room before the file grows, also after the file is reopened
+	std::cout << "Free space map" << std::endl;
+	{
+		BufMgr pool(32);
+		const std::string record(100, 'r');
+		const int numRecords = 2000;
+		std::vector<RecordId> rids;
+		PageId endPageNo;
+		{
+			PageFile file = PageFile::create(relationName);
+			for (int i = 0; i < numRecords; i++)
+			{
+				rids.push_back(pool.insertRecord(&file, record));
+			}
+			// the pages were filled one after the other
+			bool inOrder = true;
+			for (int i = 1; i < numRecords; i++)
+			{
+				if (rids[i].page_number < rids[i - 1].page_number)
+					inOrder = false;
+			}
+			checkPassFail(inOrder, true)
+
+			// free every other record of the first pages
+			for (int i = 0; i < 200; i += 2)
+			{
+				Page* page;
+				pool.readPage(&file, rids[i].page_number, page);
+				page->deleteRecord(rids[i]);
+				pool.unPinPage(&file, rids[i].page_number, true);
+			}
+			pool.flushFile(&file);
+			endPageNo = file.getEndPageNo();
+		}
+
+		PageFile file = PageFile::open(relationName);
+		int reused = 0;
+		for (int i = 0; i < 100; i++)
+		{
+			const RecordId rid = pool.insertRecord(&file, record);
+			if (rid.page_number <= rids[199].page_number)
+				reused++;
+		}
+		checkPassFail(reused, 100)
+		checkPassFail(file.getEndPageNo(), endPageNo)
+		pool.flushFile(&file);
+	}
+	File::remove(relationName);
+
+	// Record views point into the page and hold the same bytes as a copy of the record
+	std::cout << "Record views" << std::endl;
+	{
+		Page page;
+		for (int i = 0; i < 10; i++)
+		{
+			page.insertRecord(std::string(i + 1, 'a' + i));
+		}
+		int mismatches = 0;
+		for (PageIterator iter = page.begin(); iter != page.end(); iter++)
+		{
+			const RecordView view = iter.getRecordView();
+			const char* pageBytes = reinterpret_cast<const char*>(&page);
+			if (view != *iter || view.data() < pageBytes || view.data() + view.size() > pageBytes + Page::SIZE)
+				mismatches++;
+		}
+		checkPassFail(mismatches, 0)
+	}
+}
+
+void bufMgrTests()
+{
+	// A miss with every frame pinned: tryReadPage reports it, readPage throws
+	std::cout << "Buffer manager tests" << std::endl;
+	{
+		BufMgr pool(3);
+		PageFile file = PageFile::create(relationName);
+		PageId pageNos[4];
+		Page* pages[4];
+		for (int i = 0; i < 4; i++)
+		{
+			file.allocatePage(pageNos[i]);
+		}
+		for (int i = 0; i < 3; i++)
+		{
+			pool.readPage(&file, pageNos[i], pages[i]);
+		}
+		checkPassFail(pool.tryReadPage(&file, pageNos[3], pages[3]), false)
+		const bool hit = pool.tryReadPage(&file, pageNos[0], pages[3]);
+		checkPassFail(hit, true)
+		checkPassFail(pages[3], pages[0])
+		try
+		{
+			pool.readPage(&file, pageNos[3], pages[3]);
+			std::cout << "readPage did not throw with every frame pinned" << std::endl;
+			exit(1);
+		}
+		catch(const BufferExceededException&)
+		{
+			std::cout << "Test passed at line no:" << __LINE__ << std::endl;
+		}
+		pool.unPinPage(&file, pageNos[0], false);
+		pool.unPinPage(&file, pageNos[0], false);
+		checkPassFail(pool.tryReadPage(&file, pageNos[3], pages[3]), true)
+		pool.unPinPage(&file, pageNos[1], false);
+		pool.unPinPage(&file, pageNos[2], false);
+		pool.unPinPage(&file, pageNos[3], false);
+		pool.flushFile(&file);
+	}
+	File::remove(relationName);
+}
+
+// -----------------------------------------------------------------------------
+// replacementTests
+// -----------------------------------------------------------------------------
+
+void replacementTests()
+{
+	// Benchmark of the replacement policies on a trace mixing skewed lookups of a small hot set of pages,
+	// like the inner nodes of an index, with sequential scans of a relation larger than the pool
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Replacement policy hit ratios" << std::endl;
+	const int numHot = 40;
+	const int numCold = 300;
+	const int numFrames = 64;
+	const ReplacementPolicyType policies[] = { CLOCK, LRU_K, TWO_Q, ARC };
+	double hitRatios[4];
+	{
+		PageFile file = PageFile::create(relationName);
+		std::vector<PageId> pageNos(numHot + numCold);
+		for (int i = 0; i < numHot + numCold; i++)
+		{
+			file.allocatePage(pageNos[i]);
+		}
+
+		for (int p = 0; p < 4; p++)
+		{
+			BufMgr pool(numFrames, 1, policies[p]);
+			unsigned seed = 1;
+			for (int round = 0; round < 20; round++)
+			{
+				// every page of the scan is followed by two lookups
+				for (int i = numHot; i < numHot + numCold; i++)
+				{
+					Page* page;
+					pool.readPage(&file, pageNos[i], page);
+					pool.unPinPage(&file, pageNos[i], false);
+					for (int lookup = 0; lookup < 2; lookup++)
+					{
+						seed = seed * 1103515245 + 12345;
+						const int r = (seed >> 8) % numHot;
+						pool.readPage(&file, pageNos[r * r / numHot], page);
+						pool.unPinPage(&file, pageNos[r * r / numHot], false);
+					}
+				}
+			}
+			const BufStats stats = pool.getBufStats();
+			hitRatios[p] = 1.0 - (double)stats.diskreads / stats.accesses;
+			std::cout << ReplacementPolicy::name(policies[p]) << ": hit ratio " << hitRatios[p] << " ("
+				<< stats.accesses << " reads, " << stats.diskreads << " misses)" << std::endl;
+		}
+	}
+	File::remove(relationName);
+
+	// the scans flush the hot pages out of the clock, but not out of the scan resistant policies
+	for (int p = 1; p < 4; p++)
+	{
+		const bool better = hitRatios[p] > hitRatios[0];
+		checkPassFail(better, true)
+	}
+}
+
+// -----------------------------------------------------------------------------
+// asyncIoTests
+// -----------------------------------------------------------------------------
+
+void asyncIoTests()
+{
+	// Batches of page writes and reads through both engines complete, in any order, with the data
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Asynchronous I/O tests" << std::endl;
+	const int numPages = 32;
+	const IoBackend backends[] = { IO_URING, THREAD_POOL };
+	for (int b = 0; b < 2; b++)
+	{
+		IoEngine* engine = IoEngine::create(8, backends[b]);
+		std::atomic<int> completed(0);
+		std::atomic<int> failed(0);
+		{
+			BlobFile file = BlobFile::create(relationName);
+			std::vector<Page> pages(numPages);
+			std::vector<IoRequest> batch;
+			for (int i = 0; i < numPages; i++)
+			{
+				PageId pageNo;
+				file.allocatePage(pageNo);
+				memset(reinterpret_cast<char*>(&pages[i]), 'a' + i % 26, Page::SIZE);
+				IoRequest request = { IoRequest::WRITE, &file, pageNo, &pages[i],
+					[&](std::exception_ptr error) { error ? failed++ : completed++; } };
+				batch.push_back(request);
+			}
+			engine->submit(batch);
+			engine->drain();
+
+			std::vector<Page> readBack(numPages);
+			for (int i = 0; i < numPages; i++)
+			{
+				batch[i].op = IoRequest::READ;
+				batch[i].page = &readBack[i];
+			}
+			engine->submit(batch);
+			engine->drain();
+			int mismatches = 0;
+			for (int i = 0; i < numPages; i++)
+			{
+				if (memcmp(&pages[i], &readBack[i], Page::SIZE) != 0)
+					mismatches++;
+			}
+			checkPassFail(completed, 2 * numPages)
+			checkPassFail(mismatches, 0)
+		}
+		File::remove(relationName);
+
+		// a read of a page that is not in use fails like PageFile::readPage
+		{
+			PageFile file = PageFile::create(relationName);
+			Page page;
+			IoRequest request = { IoRequest::READ, &file, 5, &page,
+				[&](std::exception_ptr error) { error ? failed++ : completed++; } };
+			engine->submit(request);
+			engine->drain();
+			checkPassFail(failed, 1)
+		}
+		File::remove(relationName);
+		delete engine;
+	}
+
+	// readPageAsync: misses complete on I/O threads, and reads of one page share its frame
+	{
+		BufMgr pool(16);
+		PageFile file = PageFile::create(relationName);
+		std::vector<PageId> pageNos(numPages);
+		std::vector<RecordId> rids(numPages);
+		for (int i = 0; i < numPages; i++)
+		{
+			Page page = file.allocatePage(pageNos[i]);
+			char buf[12];
+			sprintf(buf, "%08d", i);
+			rids[i] = page.insertRecord(buf);
+			file.writePage(pageNos[i], page);
+		}
+
+		std::vector<std::future<Page*> > futures;
+		for (int i = 0; i < 8; i++)
+		{
+			futures.push_back(pool.readPageAsync(&file, pageNos[i]));
+		}
+		futures.push_back(pool.readPageAsync(&file, pageNos[0]));
+		std::vector<Page*> pages;
+		for (std::size_t i = 0; i < futures.size(); i++)
+		{
+			pages.push_back(futures[i].get());
+		}
+		int mismatches = 0;
+		for (int i = 0; i < 8; i++)
+		{
+			char buf[12];
+			sprintf(buf, "%08d", i);
+			if (pages[i]->getRecord(rids[i]) != buf)
+				mismatches++;
+		}
+		checkPassFail(mismatches, 0)
+		checkPassFail(pages[8], pages[0])
+		for (int i = 0; i < 8; i++)
+		{
+			pool.unPinPage(&file, pageNos[i], false);
+		}
+		pool.unPinPage(&file, pageNos[0], false);
+		pool.flushFile(&file);
+	}
+	File::remove(relationName);
+
+	// Read-ahead: a sequential reader and the pages hinted by prefetchPages() find their pages in the pool
+	std::cout << "Read-ahead" << std::endl;
+	{
+		PageFile file = PageFile::create(relationName);
+		std::vector<PageId> pageNos(numPages);
+		std::vector<RecordId> rids(numPages);
+		for (int i = 0; i < numPages; i++)
+		{
+			Page page = file.allocatePage(pageNos[i]);
+			char buf[12];
+			sprintf(buf, "%08d", i);
+			rids[i] = page.insertRecord(buf);
+			file.writePage(pageNos[i], page);
+		}
+
+		for (int readAhead = 1; readAhead >= 0; readAhead--)
+		{
+			BufMgr pool(64);
+			if (!readAhead)
+				pool.setReadAhead(0);
+			int mismatches = 0;
+			for (int i = 0; i < numPages; i++)
+			{
+				Page* page;
+				char buf[12];
+				sprintf(buf, "%08d", i);
+				pool.readPage(&file, pageNos[i], page);
+				if (page->getRecord(rids[i]) != buf)
+					mismatches++;
+				pool.unPinPage(&file, pageNos[i], false);
+			}
+			const BufStats stats = pool.getBufStats();
+			checkPassFail(mismatches, 0)
+			checkPassFail(stats.diskreads, numPages)
+			const bool readAheadUsed = stats.prefetches > numPages / 2;
+			const bool readAheadOn = readAhead == 1;
+			checkPassFail(readAheadUsed, readAheadOn)
+			pool.flushFile(&file);
+		}
+
+		// hinted pages, backwards, are read once and without a demand miss
+		BufMgr pool(64);
+		std::vector<PageId> hint(pageNos.rbegin(), pageNos.rbegin() + 8);
+		pool.prefetchPages(&file, &hint[0], hint.size());
+		int mismatches = 0;
+		for (std::size_t i = 0; i < hint.size(); i++)
+		{
+			Page* page;
+			char buf[12];
+			sprintf(buf, "%08d", numPages - 1 - (int)i);
+			pool.readPage(&file, hint[i], page);
+			if (page->getRecord(rids[numPages - 1 - i]) != buf)
+				mismatches++;
+			pool.unPinPage(&file, hint[i], false);
+		}
+		checkPassFail(mismatches, 0)
+		checkPassFail(pool.getBufStats().diskreads, (int)hint.size())
+		checkPassFail(pool.getBufStats().prefetches, (int)hint.size())
+		pool.flushFile(&file);
+	}
+	File::remove(relationName);
+
+	// a free page read ahead is dropped from the pool when the file hands its number out again
+	{
+		BufMgr pool(16);
+		BlobFile file = BlobFile::create(relationName);
+		PageId pageNos[3];
+		Page* page;
+		for (int i = 0; i < 3; i++)
+		{
+			pool.allocPage(&file, pageNos[i], page);
+			pool.unPinPage(&file, pageNos[i], true);
+		}
+		pool.disposePage(&file, pageNos[1]);
+		pool.prefetchPages(&file, &pageNos[1], 1);
+		PageId reused;
+		pool.allocPage(&file, reused, page);
+		checkPassFail(reused, pageNos[1])
+		pool.unPinPage(&file, reused, false);
+		pool.flushFile(&file);
+	}
+	File::remove(relationName);
+}
+
+// -----------------------------------------------------------------------------
+// threadTests
+// -----------------------------------------------------------------------------
+
+void threadTests()
+{
+	// Threads increment counters kept on the pages of one file through a pool too small to hold them, so
+	// frames are evicted and written back while other threads pin them; no increment may be lost
+	std::cout << "--------------------" << std::endl;
+	std::cout << "Concurrent buffer pool tests" << std::endl;
+	const int numPages = 64;
+	const int numThreads = 4;
+	const int numOps = 5000;
+	std::atomic<int> mismatches(0);
+	for (std::uint32_t numShards = 1; numShards <= 4; numShards *= 4)
+	{
+		std::atomic<int> numUpdates(0);
+		{
+			BufMgr pool(16, numShards);
+			PageFile file = PageFile::create(relationName);
+			std::vector<PageId> pageNos(numPages);
+			std::vector<RecordId> rids(numPages);
+			for (int i = 0; i < numPages; i++)
+			{
+				Page page = file.allocatePage(pageNos[i]);
+				rids[i] = page.insertRecord("00000000");
+				file.writePage(pageNos[i], page);
+			}
+
+			std::vector<std::thread> threads;
+			for (int t = 0; t < numThreads; t++)
+			{
+				threads.push_back(std::thread([&, t]() {
+					unsigned seed = t + 1;
+					for (int op = 0; op < numOps; op++)
+					{
+						seed = seed * 1103515245 + 12345;
+						const int i = (seed >> 8) % numPages;
+						const bool update = (seed >> 4) % 4 == 0;
+						Page* page;
+						pool.readPage(&file, pageNos[i], page);
+						pool.latchPage(page, update ? EXCLUSIVE : SHARED);
+						const std::string counter = page->getRecord(rids[i]);
+						if (counter.size() != 8)
+							mismatches++;
+						if (update)
+						{
+							char buf[12];
+							sprintf(buf, "%08d", atoi(counter.c_str()) + 1);
+							page->updateRecord(rids[i], buf);
+							numUpdates++;
+						}
+						pool.unlatchPage(page, update ? EXCLUSIVE : SHARED);
+						pool.unPinPage(&file, pageNos[i], update);
+					}
+				}));
+			}
+			for (int t = 0; t < numThreads; t++)
+			{
+				threads[t].join();
+			}
+
+			int sum = 0;
+			for (int i = 0; i < numPages; i++)
+			{
+				Page* page;
+				pool.readPage(&file, pageNos[i], page);
+				sum += atoi(page->getRecord(rids[i]).c_str());
+				pool.unPinPage(&file, pageNos[i], false);
+			}
+			checkPassFail(mismatches, 0)
+			checkPassFail(sum, numUpdates)
+
+			// every shard took a share of the misses
+			int shardsUsed = 0;
+			for (std::uint32_t i = 0; i < pool.getNumShards(); i++)
+			{
+				if (pool.getShardStats(i).diskreads > 0)
+					shardsUsed++;
+			}
+			checkPassFail(shardsUsed, (int)numShards)
+			pool.flushFile(&file);
+		}
+		File::remove(relationName);
+	}
+
+	// One thread allocates pages at the end of a file while another reads ahead the last pages of it, so
+	// read ahead races allocPage for the page it has just added; each page must end up once in the pool,
+	// holding what the allocating thread wrote to it
+	std::cout << "Allocation alongside read ahead" << std::endl;
+	{
+		const int numAllocs = 2000;
+		BufMgr pool(16, 4);
+		BlobFile file = BlobFile::create(relationName);
+		std::vector<PageId> pageNos(numAllocs);
+		std::vector<RecordId> rids(numAllocs);
+		std::atomic<bool> allocating(true);
+		std::atomic<int> errors(0);
+		std::thread reader([&]() {
+			while (allocating)
+			{
+				const PageId end = file.getEndPageNo();
+				PageId last[4];
+				for (int i = 0; i < 4; i++)
+					last[i] = end > (PageId)(4 - i) ? end - 4 + i : Page::INVALID_NUMBER;
+				pool.prefetchPages(&file, last, 4);
+			}
+		});
+		for (int i = 0; i < numAllocs; i++)
+		{
+			Page* page;
+			char buf[12];
+			sprintf(buf, "%08d", i);
+			try
+			{
+				pool.allocPage(&file, pageNos[i], page);
+			}
+			catch(const BadgerDbException&)
+			{
+				errors++;
+				pageNos[i] = Page::INVALID_NUMBER;
+				continue;
+			}
+			rids[i] = page->insertRecord(buf);
+			pool.unPinPage(&file, pageNos[i], true);
+		}
+		allocating = false;
+		reader.join();
+		checkPassFail(errors, 0)
+
+		int mismatches = 0;
+		for (int i = 0; i < numAllocs; i++)
+		{
+			if (pageNos[i] == Page::INVALID_NUMBER)
+				continue;
+			Page* page;
+			char buf[12];
+			sprintf(buf, "%08d", i);
+			pool.readPage(&file, pageNos[i], page);
+			if (page->getRecord(rids[i]) != buf)
+				mismatches++;
+			pool.unPinPage(&file, pageNos[i], false);
+		}
+		checkPassFail(mismatches, 0)
+		pool.flushFile(&file);
+	}
+	File::remove(relationName);
+
+	// Threads miss on the pages of one file through a pool too small for it, evicting the pages of another
+	// file while that one is flushed; a frame claimed for a moment to evict its page is no pinned page
+	std::cout << "Flush alongside misses of another file" << std::endl;
+	const std::string otherName = relationName + ".other";
+	{
+		const int numFlushed = 8;
+		BufMgr pool(8);
+		BlobFile flushed = BlobFile::create(relationName);
+		BlobFile other = BlobFile::create(otherName);
+		std::vector<PageId> flushedNos(numFlushed), otherNos(4 * numFlushed);
+		Page* page;
+		for (int i = 0; i < numFlushed; i++)
+		{
+			pool.allocPage(&flushed, flushedNos[i], page);
+			pool.unPinPage(&flushed, flushedNos[i], true);
+		}
+		for (std::size_t i = 0; i < otherNos.size(); i++)
+		{
+			pool.allocPage(&other, otherNos[i], page);
+			pool.unPinPage(&other, otherNos[i], true);
+		}
+		pool.flushFile(&other);
+
+		std::atomic<bool> flushing(true);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads.push_back(std::thread([&, t]() {
+				for (std::size_t i = t; flushing; i += numThreads)
+				{
+					Page* otherPage;
+					if (pool.tryReadPage(&other, otherNos[i % otherNos.size()], otherPage))
+						pool.unPinPage(&other, otherNos[i % otherNos.size()], false);
+				}
+			}));
+		}
+		int spurious = 0;
+		for (int round = 0; round < 500; round++)
+		{
+			// bring pages of the flushed file back, dirty, for the misses to evict
+			for (int i = 0; i < numFlushed; i += 2)
+			{
+				Page* flushedPage;
+				if (pool.tryReadPage(&flushed, flushedNos[i], flushedPage))
+					pool.unPinPage(&flushed, flushedNos[i], true);
+			}
+			try
+			{
+				pool.flushFile(&flushed);
+			}
+			catch(const PagePinnedException&)
+			{
+				spurious++;
+			}
+		}
+		flushing = false;
+		for (std::size_t t = 0; t < threads.size(); t++)
+		{
+			threads[t].join();
+		}
+		checkPassFail(spurious, 0)
+		pool.flushFile(&other);
+	}
+	File::remove(relationName);
+	File::remove(otherName);
+
+	// Threads read pages of one file directly while another rewrites and syncs its own pages
+	std::cout << "Concurrent file reads" << std::endl;
+	{
+		PageFile file = PageFile::create(relationName);
+		std::vector<PageId> pageNos(numPages);
+		for (int i = 0; i < numPages; i++)
+		{
+			Page page = file.allocatePage(pageNos[i]);
+			char buf[12];
+			sprintf(buf, "%08d", i);
+			page.insertRecord(buf);
+			file.writePage(pageNos[i], page);
+		}
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads.push_back(std::thread([&, t]() {
+				for (int round = 0; round < 50; round++)
+				{
+					for (int i = t; i < numPages; i += numThreads)
+					{
+						Page page = file.readPage(pageNos[i]);
+						if (t == 0)
+						{
+							file.writePage(pageNos[i], page);
+							continue;
+						}
+						char buf[12];
+						sprintf(buf, "%08d", i);
+						if (page.begin() == page.end() || *page.begin() != buf)
+							mismatches++;
+					}
+					if (t == 0)
+						file.sync();
+				}
+			}));
+		}
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads[t].join();
+		}
+		checkPassFail(mismatches, 0)
+	}
+	File::remove(relationName);
+
+	// Scans of one index run in parallel, each through its own BTreeIndex, against the shared pool
+	std::cout << "Parallel index scans" << std::endl;
+	createRelationRandom();
+	{
+		// build the index and flush it, so the instances below all open the same file contents
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+	}
+	{
+		std::vector<BTreeIndex*> indexes;
+		for (int t = 0; t < numThreads; t++)
+		{
+			indexes.push_back(new BTreeIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER));
+		}
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads.push_back(std::thread([&, t]() {
+				for (int round = 0; round < 20; round++)
+				{
+					int lowVal = (round * 250 + t * 50) % relationSize;
+					int highVal = lowVal + 1000;
+					indexes[t]->startScan(&lowVal, GTE, &highVal, LT);
+					int numResults = 0;
+					try
+					{
+						RecordId rid;
+						while(1)
+						{
+							indexes[t]->scanNext(rid);
+							numResults++;
+						}
+					}
+					catch(const IndexScanCompletedException&)
+					{
+					}
+					indexes[t]->endScan();
+					if (numResults != std::min(highVal, relationSize) - lowVal)
+						mismatches++;
+				}
+			}));
+		}
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads[t].join();
+			delete indexes[t];
+		}
+		checkPassFail(mismatches, 0)
+	}
+
+	// Scans of one BTreeIndex run at once through cursors, interleaved in one thread and in parallel threads
+	std::cout << "Index cursors" << std::endl;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		{
+			IndexCursor up(&index);
+			IndexCursor down(&index);
+			int lowVal = 100, highVal = 200;
+			up.startScan(&lowVal, GTE, &highVal, LT);
+			lowVal = 300;
+			highVal = 400;
+			down.startScan(&lowVal, GTE, &highVal, LT);
+			int numResults = 0;
+			try
+			{
+				RecordId upRid, downRid;
+				while(1)
+				{
+					up.scanNext(upRid);
+					down.scanNext(downRid);
+					numResults++;
+				}
+			}
+			catch(const IndexScanCompletedException&)
+			{
+			}
+			checkPassFail(numResults, 100)
+			// down is left open; its leaf is unpinned when the cursor goes out of scope
+			up.endScan();
+		}
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads.push_back(std::thread([&, t]() {
+				IndexCursor cursor(&index);
+				std::vector<RecordId> batch(1024);
+				for (int round = 0; round < 20; round++)
+				{
+					int lowVal = (round * 250 + t * 50) % relationSize;
+					int highVal = lowVal + 1000;
+					cursor.startScan(&lowVal, GTE, &highVal, LT);
+					int numResults = 0;
+					std::size_t n;
+					while ((n = cursor.scanNextBatch(&batch[0], batch.size())) > 0)
+						numResults += n;
+					if (numResults != std::min(highVal, relationSize) - lowVal)
+						mismatches++;
+				}
+			}));
+		}
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads[t].join();
+		}
+		checkPassFail(mismatches, 0)
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+
+	// Inserts between the calls of a scan shift the entries of its leaf and split it; the scan goes on
+	// after the last entry it returned, and returns every entry that was there from the start once
+	std::cout << "Scans alongside inserts" << std::endl;
+	relationSize = 0;
+	createRelationForward();
+	relationSize = 5000;
+	{
+		BTreeIndex intIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		RecordId rid;
+		for (int key = 0; key < 4000; key += 2)
+		{
+			rid.page_number = key / 100 + 1;
+			rid.slot_number = key % 100 + 1;
+			intIndex.insertEntry(&key, rid);
+		}
+		IndexCursor cursor(&intIndex);
+		int low = 0, high = 4000;
+		cursor.startScan(&low, GTE, &high, LT);
+		int evenKeys = 0, prevKey = -1, nextOdd = 1;
+		bool increasing = true;
+		std::vector<RecordId> batch(5);
+		for (int call = 0; ; call++)
+		{
+			std::size_t n = 1;
+			if (call % 2 == 0)
+			{
+				try
+				{
+					cursor.scanNext(batch[0]);
+				}
+				catch(const IndexScanCompletedException&)
+				{
+					break;
+				}
+			}
+			else if ((n = cursor.scanNextBatch(&batch[0], batch.size())) == 0)
+				break;
+			for (std::size_t i = 0; i < n; i++)
+			{
+				const int key = (batch[i].page_number - 1) * 100 + batch[i].slot_number - 1;
+				increasing = increasing && key > prevKey;
+				prevKey = key;
+				evenKeys += key % 2 == 0;
+			}
+			// odd keys not inserted yet, before the last key returned and right after it, enough to split its leaf
+			if (call % 50 == 10)
+			{
+				for (int key = std::max(nextOdd, (prevKey - 600) | 1); key < prevKey + 600 && key < 4000; key += 2)
+				{
+					rid.page_number = key / 100 + 1;
+					rid.slot_number = key % 100 + 1;
+					intIndex.insertEntry(&key, rid);
+					nextOdd = key + 2;
+				}
+			}
+		}
+		checkPassFail(increasing, true)
+		checkPassFail(evenKeys, 2000)
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+
+	// Threads insert into the same indexes at once, splitting nodes up to the root, while other threads
+	// look keys up and scan; every entry must end up in place, and scans return entries in key order
+	std::cout << "Concurrent index inserts" << std::endl;
+	relationSize = 0;
+	createRelationForward();
+	relationSize = 5000;
+	{
+		const int numKeys = 20000;
+		BTreeIndex intIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeIndex stringIndex(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+		std::atomic<int> writersDone(0);
+		std::atomic<int> disordered(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads.push_back(std::thread([&, t]() {
+				std::vector<RecordId> rids;
+				for (int key = t; key < numKeys; key += numThreads)
+				{
+					RecordId rid;
+					rid.page_number = key / 100 + 1;
+					rid.slot_number = key % 100 + 1;
+					char keyStr[STRINGSIZE + 1];
+					sprintf(keyStr, "%05d string record", key);
+					intIndex.insertEntry(&key, rid);
+					stringIndex.insertEntry(keyStr, rid);
+
+					// a key this thread inserted earlier is found while the others keep splitting nodes
+					int oldKey = key - (key / 2 / numThreads) * numThreads;
+					rids.clear();
+					if (intIndex.lookup(&oldKey, rids) != 1)
+						mismatches++;
+				}
+				writersDone++;
+			}));
+		}
+		threads.push_back(std::thread([&]() {
+			IndexCursor cursor(&stringIndex);
+			std::vector<RecordId> batch(256);
+			const char lowStr[] = "00000 string record";
+			const char highStr[] = "99999 string record";
+			while (writersDone < numThreads)
+			{
+				try
+				{
+					cursor.startScan(lowStr, GTE, highStr, LTE);
+				}
+				catch(const NoSuchKeyFoundException&)
+				{
+					continue;
+				}
+				std::size_t n;
+				int prevKey = -1, call = 0;
+				while ((n = cursor.scanNextBatch(&batch[0], ++call % 2 ? batch.size() : 3)) > 0)
+				{
+					for (std::size_t i = 0; i < n; i++)
+					{
+						const int key = (batch[i].page_number - 1) * 100 + batch[i].slot_number - 1;
+						if (key <= prevKey)
+							disordered++;
+						prevKey = key;
+					}
+				}
+			}
+		}));
+		for (std::size_t t = 0; t < threads.size(); t++)
+		{
+			threads[t].join();
+		}
+		checkPassFail(mismatches, 0)
+		checkPassFail(disordered, 0)
+
+		int missing = 0;
+		for (int key = 0; key < numKeys; key++)
+		{
+			std::vector<RecordId> rids;
+			char keyStr[STRINGSIZE + 1];
+			sprintf(keyStr, "%05d string record", key);
+			if (intIndex.lookup(&key, rids) != 1 || stringIndex.lookup(keyStr, rids) != 1 ||
+					rids[0] != rids[1] || rids[0].page_number != (PageId)(key / 100 + 1))
+				missing++;
+		}
+		checkPassFail(missing, 0)
+		int low = -1, high = numKeys;
+		checkPassFail(batchScan(&intIndex, &low, GT, &high, LT, 1024), numKeys)
+	}
+	File::remove(intIndexName);
+	File::remove(stringIndexName);
+	deleteRelation();
 
+	// Lookups of keys already in the indexes race inserts that split the nodes they are going down to,
+	// and must follow the right links to every one of them
+	std::cout << "B-link lookups" << std::endl;
+	relationSize = 0;
+	createRelationForward();
+	relationSize = 5000;
+	{
+		const int numKeys = 4000;
+		BTreeIndex intIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeIndex stringIndex(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+		RecordId rid;
+		rid.page_number = 1;
+		rid.slot_number = 1;
+		char keyStr[STRINGSIZE + 1];
+		for (int key = 0; key < numKeys; key += 2)
+		{
+			sprintf(keyStr, "%05d string record", key);
+			intIndex.insertEntry(&key, rid);
+			stringIndex.insertEntry(keyStr, rid);
+		}
+
+		std::atomic<int> writersDone(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++)
+		{
+			// Odd keys go in all over the key range, so nodes split at every level
+			threads.push_back(std::thread([&, t]() {
+				char str[STRINGSIZE + 1];
+				for (int key = 2 * t + 1; key < numKeys; key += 2 * numThreads)
+				{
+					sprintf(str, "%05d string record", key);
+					intIndex.insertEntry(&key, rid);
+					stringIndex.insertEntry(str, rid);
+				}
+				writersDone++;
+			}));
+			threads.push_back(std::thread([&, t]() {
+				char str[STRINGSIZE + 1];
+				std::vector<RecordId> rids;
+				for (int key = 2 * t; writersDone < numThreads; key = (key + 2 * numThreads + 2) % numKeys)
+				{
+					sprintf(str, "%05d string record", key);
+					rids.clear();
+					if (intIndex.lookup(&key, rids) != 1 || stringIndex.lookup(str, rids) != 1)
+						mismatches++;
+				}
+			}));
+		}
+		for (std::size_t t = 0; t < threads.size(); t++)
+		{
+			threads[t].join();
+		}
+		checkPassFail(mismatches, 0)
+		int low = 0, high = numKeys;
+		checkPassFail(batchScan(&intIndex, &low, GTE, &high, LT, 256), numKeys)
+	}
+	File::remove(intIndexName);
+	File::remove(stringIndexName);
+	deleteRelation();
+
+	// Threads taking morsels of pages from one parallel scan come across every record once between them
+	std::cout << "Parallel file scans" << std::endl;
+	createRelationRandom();
+	for (std::size_t morselPages = 1; morselPages <= 64; morselPages *= 8)
+	{
+		ParallelFileScan scan(relationName, bufMgr, morselPages);
+		std::vector<long long> keySums(4, 0);
+		std::vector<int> counts(4, 0);
+		std::vector<std::thread> threads;
+		for (std::size_t t = 0; t < keySums.size(); t++)
+		{
+			threads.push_back(std::thread([&, t]() {
+				FileScanWorker worker(&scan);
+				RecordId rid;
+				try
+				{
+					while(1)
+					{
+						worker.scanNext(rid);
+						int key;
+						memcpy(&key, worker.getRecordView().data() + offsetof(tuple,i), sizeof(int));
+						keySums[t] += key;
+						counts[t]++;
+					}
+				}
+				catch(const EndOfFileException&)
+				{
+				}
+			}));
+		}
+		long long keySum = 0;
+		int count = 0;
+		for (std::size_t t = 0; t < threads.size(); t++)
+		{
+			threads[t].join();
+			keySum += keySums[t];
+			count += counts[t];
+		}
+		checkPassFail(count, relationSize)
+		const long long expectedSum = (long long)relationSize * (relationSize - 1) / 2;
+		const bool sumMatches = keySum == expectedSum;
+		checkPassFail(sumMatches, true)
+	}
+
+	// Indexes built by several threads, each reading and sorting the morsels of the relation it takes,
+	// must hold every record once, also with more threads than pages
+	std::cout << "Parallel index build" << std::endl;
+	for (unsigned buildThreads = 1; buildThreads <= 256; buildThreads *= 16)
+	{
+		{
+			BTreeIndex intIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 1.0, false, buildThreads);
+			BTreeIndex stringIndex(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING, 0.7, false, buildThreads);
+			int missing = 0;
+			for (int key = 0; key < relationSize; key++)
+			{
+				std::vector<RecordId> rids;
+				char keyStr[STRINGSIZE + 1];
+				sprintf(keyStr, "%05d string record", key);
+				if (intIndex.lookup(&key, rids) != 1 || stringIndex.lookup(keyStr, rids) != 1 || rids[0] != rids[1])
+					missing++;
+			}
+			checkPassFail(missing, 0)
+			int low = -1, high = relationSize;
+			checkPassFail(batchScan(&intIndex, &low, GT, &high, LT, 1024), relationSize)
+		}
+		File::remove(intIndexName);
+		File::remove(stringIndexName);
+	}
+
+	// A range split into subranges scanned by one thread each returns every entry of the range once
+	std::cout << "Partitioned index scans" << std::endl;
+	{
+		BTreeIndex intIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.5);
+		BTreeIndex stringIndex(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+		const std::size_t counts[] = {1, 4, 1000};
+		for (std::size_t c = 0; c < 3; c++)
+		{
+			int lowVal = 25, highVal = 4990;
+			std::vector< std::unique_ptr<IndexCursor> > cursors;
+			const std::size_t numCursors = intIndex.partitionScan(&lowVal, GT, &highVal, LTE, counts[c], cursors);
+			const bool sized = numCursors == cursors.size() && numCursors <= counts[c] && (counts[c] == 1 || numCursors > 1);
+			checkPassFail(sized, true)
+			std::vector< std::vector<RecordId> > found(cursors.size());
+			std::vector<std::thread> threads;
+			for (std::size_t t = 0; t < cursors.size(); t++)
+			{
+				threads.push_back(std::thread([&, t]() {
+					std::vector<RecordId> batch(128);
+					std::size_t n;
+					while ((n = cursors[t]->scanNextBatch(&batch[0], batch.size())) > 0)
+						found[t].insert(found[t].end(), batch.begin(), batch.begin() + n);
+				}));
+			}
+			std::set< std::pair<PageId, SlotId> > rids;
+			std::size_t total = 0;
+			for (std::size_t t = 0; t < threads.size(); t++)
+			{
+				threads[t].join();
+				total += found[t].size();
+				for (std::size_t i = 0; i < found[t].size(); i++)
+					rids.insert(std::make_pair(found[t][i].page_number, found[t][i].slot_number));
+			}
+			const std::size_t expected = highVal - lowVal;
+			checkPassFail(total, expected)
+			checkPassFail(rids.size(), total)
+		}
+
+		const char lowStr[] = "01000 string record";
+		const char highStr[] = "03000 string record";
+		std::vector< std::unique_ptr<IndexCursor> > cursors;
+		stringIndex.partitionScan(lowStr, GTE, highStr, LT, 3, cursors);
+		std::size_t total = 0;
+		for (std::size_t t = 0; t < cursors.size(); t++)
+		{
+			RecordId rid;
+			try
+			{
+				while (1)
+				{
+					cursors[t]->scanNext(rid);
+					total++;
+				}
+			}
+			catch(const IndexScanCompletedException&)
+			{
+			}
+		}
+		checkPassFail(total, 2000)
+	}
+	File::remove(intIndexName);
+	File::remove(stringIndexName);
+	deleteRelation();
 
+	// Over an index of many non-leaf nodes, the subranges come out about the same size, and each cursor
+	// returns keys of its own subrange only, in order
+	std::cout << "Partitioned index scans over many non-leaf nodes" << std::endl;
+	relationSize = 20000;
+	createRelationRandom();
+	relationSize = 5000;
+	{
+		// a low fill factor makes leaves of 34 entries under non-leaf nodes of 51 children
+		BTreeIndex intIndex(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.05);
+		std::map< std::pair<PageId, SlotId>, int > keyOf;
+		{
+			FileScan fscan(relationName, bufMgr);
+			try
+			{
+				while (1)
+				{
+					RecordId rid;
+					fscan.scanNext(rid);
+					keyOf[std::make_pair(rid.page_number, rid.slot_number)] = *((int *)(fscan.getRecordView().data() + offsetof(RECORD, i)));
+				}
+			}
+			catch(const EndOfFileException&)
+			{
+			}
+		}
+		const std::size_t counts[] = {8, 32};
+		for (std::size_t c = 0; c < 2; c++)
+		{
+			int lowVal = 25, highVal = 19990;
+			std::vector< std::unique_ptr<IndexCursor> > cursors;
+			const std::size_t numCursors = intIndex.partitionScan(&lowVal, GT, &highVal, LTE, counts[c], cursors);
+			checkPassFail(numCursors, counts[c])
+			std::vector< std::vector<RecordId> > found(cursors.size());
+			std::vector<std::thread> threads;
+			for (std::size_t t = 0; t < cursors.size(); t++)
+			{
+				threads.push_back(std::thread([&, t]() {
+					std::vector<RecordId> batch(128);
+					std::size_t n;
+					while ((n = cursors[t]->scanNextBatch(&batch[0], batch.size())) > 0)
+						found[t].insert(found[t].end(), batch.begin(), batch.begin() + n);
+				}));
+			}
+			std::size_t total = 0, minSize = found.size() > 0 ? (std::size_t) -1 : 0, maxSize = 0;
+			int previousKey = lowVal, misplaced = 0;
+			for (std::size_t t = 0; t < threads.size(); t++)
+			{
+				threads[t].join();
+				total += found[t].size();
+				minSize = std::min(minSize, found[t].size());
+				maxSize = std::max(maxSize, found[t].size());
+				// the cursors cover consecutive subranges, so their keys taken one after the other increase
+				for (std::size_t i = 0; i < found[t].size(); i++)
+				{
+					const int key = keyOf[std::make_pair(found[t][i].page_number, found[t][i].slot_number)];
+					if (key <= previousKey || key > highVal)
+						misplaced++;
+					previousKey = key;
+				}
+			}
+			checkPassFail(total, (std::size_t) (highVal - lowVal))
+			checkPassFail(misplaced, 0)
+			// within 7% of each other
+			const bool balanced = maxSize * 100 <= minSize * 107;
+			checkPassFail(balanced, true)
+		}
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
 
 // -----------------------------------------------------------------------------
 // createRelationForward
@@ -296,10 +2085,8 @@ void createRelationForward()
 
   // initialize all of record1.s to keep purify happy
   memset(record1.s, ' ', sizeof(record1.s));
-	PageId new_page_number;
-  Page new_page = file1->allocatePage(new_page_number);
 
-  // Insert a bunch of tuples into the relation.
+  // Insert a bunch of tuples into the relation, through the buffer pool into pages with room.
   for(int i = 0; i < relationSize; i++ )
 	{
     sprintf(record1.s, "%05d string record", i);
@@ -307,22 +2094,10 @@ void createRelationForward()
     record1.d = (double)i;
     std::string new_data(reinterpret_cast<char*>(&record1), sizeof(record1));
 
-		while(1)
-		{
-			try
-			{
-    		new_page.insertRecord(new_data);
-				break;
-			}
-			catch(InsufficientSpaceException e)
-			{
-				file1->writePage(new_page_number, new_page);
-  			new_page = file1->allocatePage(new_page_number);
-			}
-		}
+		bufMgr->insertRecord(file1, new_data);
   }
 
-	file1->writePage(new_page_number, new_page);
+	bufMgr->flushFile(file1);
 }
 
 // -----------------------------------------------------------------------------
@@ -454,6 +2229,24 @@ void indexTests()
   	catch(FileNotFoundException e)
   	{
   	}
+
+    doubleTests();
+		try
+		{
+			File::remove(doubleIndexName);
+		}
+  	catch(const FileNotFoundException&)
+  	{
+  	}
+
+    stringTests();
+		try
+		{
+			File::remove(stringIndexName);
+		}
+  	catch(const FileNotFoundException&)
+  	{
+  	}
   }
 }
 
@@ -499,17 +2292,53 @@ void intTests()
 
 int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
 {
-  RecordId scanRid;
-	Page *curPage;
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowVal << "," << highVal;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+	try
+	{
+  	index->startScan(&lowVal, lowOp, &highVal, highOp);
+	}
+	catch(const NoSuchKeyFoundException&)
+	{
+    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
+		return 0;
+	}
+
+	return printScan(index);
+}
+
+// -----------------------------------------------------------------------------
+// doubleTests
+// -----------------------------------------------------------------------------
+
+void doubleTests()
+{
+  std::cout << "Create a B+ Tree index on the double field" << std::endl;
+  BTreeIndex index(relationName, doubleIndexName, bufMgr, offsetof(tuple,d), DOUBLE);
 
+	// run some tests
+	checkPassFail(doubleScan(&index,25,GT,40,LT), 14)
+	checkPassFail(doubleScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(doubleScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(doubleScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(doubleScan(&index,0,GT,1,LT), 0)
+	checkPassFail(doubleScan(&index,300,GT,400,LT), 99)
+	checkPassFail(doubleScan(&index,3000,GTE,4000,LT), 1000)
+	checkPassFail(doubleScan(&index,24.5,GT,25.5,LT), 1)
+}
+
+int doubleScan(BTreeIndex * index, double lowVal, Operator lowOp, double highVal, Operator highOp)
+{
   std::cout << "Scan for ";
   if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
   std::cout << lowVal << "," << highVal;
   if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
   std::cout << std::endl;
 
-  int numResults = 0;
-	
 	try
 	{
   	index->startScan(&lowVal, lowOp, &highVal, highOp);
@@ -520,13 +2349,72 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 		return 0;
 	}
 
+	return printScan(index);
+}
+
+// -----------------------------------------------------------------------------
+// stringTests
+// -----------------------------------------------------------------------------
+
+void stringTests()
+{
+  std::cout << "Create a B+ Tree index on the string field" << std::endl;
+  BTreeIndex index(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+
+	// run some tests
+	checkPassFail(stringScan(&index,25,GT,40,LT), 14)
+	checkPassFail(stringScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(stringScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(stringScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(stringScan(&index,0,GT,1,LT), 0)
+	checkPassFail(stringScan(&index,300,GT,400,LT), 99)
+	checkPassFail(stringScan(&index,3000,GTE,4000,LT), 1000)
+}
+
+int stringScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+	// The bounds are formatted like the string field of the relation.
+  char lowValStr[STRINGSIZE + 1];
+  char highValStr[STRINGSIZE + 1];
+  sprintf(lowValStr, "%05d string record", lowVal);
+  sprintf(highValStr, "%05d string record", highVal);
+
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowValStr << "," << highValStr;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+	try
+	{
+  	index->startScan(lowValStr, lowOp, highValStr, highOp);
+	}
+	catch(const NoSuchKeyFoundException&)
+	{
+    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
+		return 0;
+	}
+
+	return printScan(index);
+}
+
+// -----------------------------------------------------------------------------
+// printScan
+// -----------------------------------------------------------------------------
+
+int printScan(BTreeIndex * index)
+{
+  RecordId scanRid;
+	Page *curPage;
+  int numResults = 0;
+
 	while(1)
 	{
 		try
 		{
 			index->scanNext(scanRid);
 			bufMgr->readPage(file1, scanRid.page_number, curPage);
-			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecordView(scanRid).data()));
 			bufMgr->unPinPage(file1, scanRid.page_number, false);
 
 			if( numResults < 5 )
@@ -557,6 +2445,51 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 	return numResults;
 }
 
+// -----------------------------------------------------------------------------
+// batchScan
+// -----------------------------------------------------------------------------
+
+// Scan the range once with scanNext and once with scanNextBatch in batches of batchSize.
+// Returns the number of results, or -1 if the two scans do not return the same record ids in the same order.
+int batchScan(BTreeIndex * index, const void *lowVal, Operator lowOp, const void *highVal, Operator highOp, std::size_t batchSize)
+{
+	std::vector<RecordId> single;
+	try
+	{
+		index->startScan(lowVal, lowOp, highVal, highOp);
+	}
+	catch(const NoSuchKeyFoundException&)
+	{
+		return 0;
+	}
+	try
+	{
+		RecordId scanRid;
+		while(1)
+		{
+			index->scanNext(scanRid);
+			single.push_back(scanRid);
+		}
+	}
+	catch(const IndexScanCompletedException&)
+	{
+	}
+	index->endScan();
+
+	std::vector<RecordId> batched;
+	std::vector<RecordId> batch(batchSize);
+	index->startScan(lowVal, lowOp, highVal, highOp);
+	std::size_t n;
+	while ((n = index->scanNextBatch(&batch[0], batchSize)) > 0)
+	{
+		batched.insert(batched.end(), batch.begin(), batch.begin() + n);
+	}
+	index->endScan();
+
+	std::cout << "Batch scan of " << batched.size() << " results in batches of " << batchSize << std::endl;
+	return batched == single ? (int)batched.size() : -1;
+}
+
 
 // -----------------------------------------------------------------------------
 // errorTests
@@ -671,6 +2604,17 @@ void errorTests()
 		std::cout << "BadScanrangeException Test 1 Passed." << std::endl;
 	}
 
+	std::cout << "Open index with a different attribute type" << std::endl;
+	try
+	{
+		BTreeIndex other(relationName, intIndexName, bufMgr, offsetof(tuple,i), DOUBLE);
+		std::cout << "BadIndexInfoException Test 1 Failed." << std::endl;
+	}
+	catch(const BadIndexInfoException&)
+	{
+		std::cout << "BadIndexInfoException Test 1 Passed." << std::endl;
+	}
+
 	deleteRelation();
 }
 
@@ -0,0 +1,267 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "node_search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NODE_SEARCH_X86
+#endif
+
+namespace badgerdb {
+
+/**
+ * Binary search stops once this many keys are left and the rest is counted.
+ */
+static const int SEARCH_WINDOW = 32;
+
+/**
+ * Counting kernels. Each returns the number of keys in keys[0..n) that are < key (less)
+ * or <= key (lessEqual).
+ */
+struct CountKernel {
+	int (*less)(const int* keys, const int n, const int key);
+	int (*lessEqual)(const int* keys, const int n, const int key);
+	int (*lessDouble)(const double* keys, const int n, const double key);
+	int (*lessEqualDouble)(const double* keys, const int n, const double key);
+	const char* name;
+};
+
+static int countLessScalar(const int* keys, const int n, const int key)
+{
+	int count = 0;
+	for (int i = 0; i < n; i++)
+		count += keys[i] < key;
+	return count;
+}
+
+static int countLessEqualScalar(const int* keys, const int n, const int key)
+{
+	int count = 0;
+	for (int i = 0; i < n; i++)
+		count += keys[i] <= key;
+	return count;
+}
+
+static int countLessDoubleScalar(const double* keys, const int n, const double key)
+{
+	int count = 0;
+	for (int i = 0; i < n; i++)
+		count += keys[i] < key;
+	return count;
+}
+
+static int countLessEqualDoubleScalar(const double* keys, const int n, const double key)
+{
+	int count = 0;
+	for (int i = 0; i < n; i++)
+		count += keys[i] <= key;
+	return count;
+}
+
+#ifdef NODE_SEARCH_X86
+
+__attribute__((target("sse4.2,popcnt")))
+static int countLessSse4(const int* keys, const int n, const int key)
+{
+	const __m128i k = _mm_set1_epi32(key);
+	int count = 0;
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+		count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v))));
+	}
+	for (; i < n; i++)
+		count += keys[i] < key;
+	return count;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static int countLessEqualSse4(const int* keys, const int n, const int key)
+{
+	const __m128i k = _mm_set1_epi32(key);
+	int count = 0;
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		// v <= key is !(v > key)
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+		count += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k))));
+	}
+	for (; i < n; i++)
+		count += keys[i] <= key;
+	return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int countLessAvx2(const int* keys, const int n, const int key)
+{
+	const __m256i k = _mm256_set1_epi32(key);
+	int count = 0;
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+		count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v))));
+	}
+	for (; i < n; i++)
+		count += keys[i] < key;
+	return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int countLessEqualAvx2(const int* keys, const int n, const int key)
+{
+	const __m256i k = _mm256_set1_epi32(key);
+	int count = 0;
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+		count += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k))));
+	}
+	for (; i < n; i++)
+		count += keys[i] <= key;
+	return count;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static int countLessDoubleSse4(const double* keys, const int n, const double key)
+{
+	const __m128d k = _mm_set1_pd(key);
+	int count = 0;
+	int i = 0;
+	for (; i + 2 <= n; i += 2)
+		count += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(keys + i), k)));
+	for (; i < n; i++)
+		count += keys[i] < key;
+	return count;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static int countLessEqualDoubleSse4(const double* keys, const int n, const double key)
+{
+	const __m128d k = _mm_set1_pd(key);
+	int count = 0;
+	int i = 0;
+	for (; i + 2 <= n; i += 2)
+		count += __builtin_popcount(_mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(keys + i), k)));
+	for (; i < n; i++)
+		count += keys[i] <= key;
+	return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int countLessDoubleAvx2(const double* keys, const int n, const double key)
+{
+	const __m256d k = _mm256_set1_pd(key);
+	int count = 0;
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		count += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), k, _CMP_LT_OQ)));
+	for (; i < n; i++)
+		count += keys[i] < key;
+	return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int countLessEqualDoubleAvx2(const double* keys, const int n, const double key)
+{
+	const __m256d k = _mm256_set1_pd(key);
+	int count = 0;
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		count += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), k, _CMP_LE_OQ)));
+	for (; i < n; i++)
+		count += keys[i] <= key;
+	return count;
+}
+
+#endif
+
+static CountKernel selectKernel()
+{
+	CountKernel kernel = {countLessScalar, countLessEqualScalar,
+		countLessDoubleScalar, countLessEqualDoubleScalar, "scalar"};
+#ifdef NODE_SEARCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		kernel.less = countLessAvx2;
+		kernel.lessEqual = countLessEqualAvx2;
+		kernel.lessDouble = countLessDoubleAvx2;
+		kernel.lessEqualDouble = countLessEqualDoubleAvx2;
+		kernel.name = "avx2";
+	}
+	else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+		kernel.less = countLessSse4;
+		kernel.lessEqual = countLessEqualSse4;
+		kernel.lessDouble = countLessDoubleSse4;
+		kernel.lessEqualDouble = countLessEqualDoubleSse4;
+		kernel.name = "sse4";
+	}
+#endif
+	return kernel;
+}
+
+static const CountKernel& countKernel()
+{
+	static const CountKernel kernel = selectKernel();
+	return kernel;
+}
+
+int nodeLowerBound(const int* keys, const int n, const int key)
+{
+	// The answer stays in [lo, lo + len]; each step drops the half that cannot hold it, without a branch.
+	int lo = 0;
+	int len = n;
+	while (len > SEARCH_WINDOW) {
+		const int half = len >> 1;
+		lo = (keys[lo + half - 1] < key) ? lo + half : lo;
+		len -= half;
+	}
+	return lo + countKernel().less(keys + lo, len, key);
+}
+
+int nodeUpperBound(const int* keys, const int n, const int key)
+{
+	int lo = 0;
+	int len = n;
+	while (len > SEARCH_WINDOW) {
+		const int half = len >> 1;
+		lo = (keys[lo + half - 1] <= key) ? lo + half : lo;
+		len -= half;
+	}
+	return lo + countKernel().lessEqual(keys + lo, len, key);
+}
+
+int nodeLowerBound(const double* keys, const int n, const double key)
+{
+	int lo = 0;
+	int len = n;
+	while (len > SEARCH_WINDOW) {
+		const int half = len >> 1;
+		lo = (keys[lo + half - 1] < key) ? lo + half : lo;
+		len -= half;
+	}
+	return lo + countKernel().lessDouble(keys + lo, len, key);
+}
+
+int nodeUpperBound(const double* keys, const int n, const double key)
+{
+	int lo = 0;
+	int len = n;
+	while (len > SEARCH_WINDOW) {
+		const int half = len >> 1;
+		lo = (keys[lo + half - 1] <= key) ? lo + half : lo;
+		len -= half;
+	}
+	return lo + countKernel().lessEqualDouble(keys + lo, len, key);
+}
+
+const char* nodeSearchKernel()
+{
+	return countKernel().name;
+}
+
+}
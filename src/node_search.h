@@ -0,0 +1,107 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+namespace badgerdb {
+
+/**
+ * @brief Search kernels over the sorted key array of a B+Tree node.
+ *
+ * A branchless binary search narrows the array down to a small window, which is then finished by
+ * counting matching keys. For INTEGER and DOUBLE keys the count is vectorized with AVX2 or SSE4 when the CPU
+ * supports them; the variant is picked once, at the first call, through CPU feature detection.
+ */
+
+/**
+ * Returns the number of keys strictly less than key, i.e. the position of the first key >= key.
+ *
+ * @param keys  Sorted key array
+ * @param n     Number of keys in the array
+ * @param key   Key to search for
+ * @return  Position in [0, n]
+ */
+int nodeLowerBound(const int* keys, const int n, const int key);
+
+/**
+ * Returns the number of keys less than or equal to key, i.e. the position of the first key > key.
+ *
+ * @param keys  Sorted key array
+ * @param n     Number of keys in the array
+ * @param key   Key to search for
+ * @return  Position in [0, n]
+ */
+int nodeUpperBound(const int* keys, const int n, const int key);
+
+/**
+ * Returns the number of keys strictly less than key, i.e. the position of the first key >= key.
+ *
+ * @param keys  Sorted key array
+ * @param n     Number of keys in the array
+ * @param key   Key to search for
+ * @return  Position in [0, n]
+ */
+int nodeLowerBound(const double* keys, const int n, const double key);
+
+/**
+ * Returns the number of keys less than or equal to key, i.e. the position of the first key > key.
+ *
+ * @param keys  Sorted key array
+ * @param n     Number of keys in the array
+ * @param key   Key to search for
+ * @return  Position in [0, n]
+ */
+int nodeUpperBound(const double* keys, const int n, const double key);
+
+/**
+ * Branchless binary search for key types without a vectorized kernel. Only operator< is used.
+ *
+ * @param keys  Sorted key array
+ * @param n     Number of keys in the array
+ * @param key   Key to search for
+ * @return  Number of keys strictly less than key
+ */
+template <class T>
+int nodeLowerBound(const T* keys, const int n, const T& key)
+{
+	const T* base = keys;
+	int len = n;
+	while (len > 1) {
+		const int half = len >> 1;
+		base = (base[half - 1] < key) ? base + half : base;
+		len -= half;
+	}
+	return (base - keys) + (len == 1 && *base < key);
+}
+
+/**
+ * Branchless binary search for key types without a vectorized kernel. Only operator< is used.
+ *
+ * @param keys  Sorted key array
+ * @param n     Number of keys in the array
+ * @param key   Key to search for
+ * @return  Number of keys less than or equal to key
+ */
+template <class T>
+int nodeUpperBound(const T* keys, const int n, const T& key)
+{
+	const T* base = keys;
+	int len = n;
+	while (len > 1) {
+		const int half = len >> 1;
+		base = !(key < base[half - 1]) ? base + half : base;
+		len -= half;
+	}
+	return (base - keys) + (len == 1 && !(key < *base));
+}
+
+/**
+ * Returns the name of the counting kernel selected for this CPU ("avx2", "sse4" or "scalar").
+ */
+const char* nodeSearchKernel();
+
+}
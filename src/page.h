@@ -93,6 +93,60 @@ struct PageSlot {
   std::uint16_t item_length;
 };
 
+/**
+ * @brief Read-only view of the bytes of a record, in place in the page that holds it.
+ *
+ * A view does not copy the record, so it is only valid while the page is not changed and, for a page
+ * in the buffer pool, while the page stays pinned.
+ */
+class RecordView {
+ public:
+  /**
+   * Constructs an empty view.
+   */
+  RecordView() : data_(NULL), size_(0) {}
+
+  /**
+   * Constructs a view of size bytes starting at data.
+   */
+  RecordView(const char* data, const std::size_t size) : data_(data), size_(size) {}
+
+  /**
+   * Returns a pointer to the first byte of the record.
+   */
+  const char* data() const { return data_; }
+
+  /**
+   * Returns the length of the record in bytes.
+   */
+  std::size_t size() const { return size_; }
+
+  /**
+   * Returns a copy of the record, which stays valid after the page is unpinned.
+   */
+  std::string str() const { return std::string(data_, size_); }
+
+  /**
+   * Returns true if the record holds the same bytes as the given string.
+   */
+  bool operator==(const std::string& rhs) const {
+    return rhs.compare(0, std::string::npos, data_, size_) == 0;
+  }
+
+  bool operator!=(const std::string& rhs) const { return !(*this == rhs); }
+
+ private:
+  /**
+   * First byte of the record.
+   */
+  const char* data_;
+
+  /**
+   * Length of the record in bytes.
+   */
+  std::size_t size_;
+};
+
 class PageIterator;
 
 /**
@@ -151,6 +205,15 @@ class Page {
    */
   std::string getRecord(const RecordId& record_id) const;
 
+  /**
+   * Returns a view of the record with the given ID, without copying it.  The
+   * view is valid until the page is changed or unpinned.
+   *
+   * @param record_id  ID of the record to return.
+   * @return  View of the record on the page.
+   */
+  RecordView getRecordView(const RecordId& record_id) const;
+
   /**
    * Updates the record with the given ID, replacing its data with a new
    * version.  This is equivalent to deleting the old record and inserting a
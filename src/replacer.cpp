@@ -0,0 +1,426 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include "replacer.h"
+#include "buffer.h"
+
+namespace badgerdb {
+
+ReplacementPolicy* ReplacementPolicy::create(const ReplacementPolicyType type, BufDesc* descs,
+		const FrameId firstFrame, const std::uint32_t numFrames)
+{
+  switch (type)
+  {
+    case LRU_K:
+      return new LRUKPolicy(firstFrame, numFrames);
+    case TWO_Q:
+      return new TwoQPolicy(firstFrame, numFrames);
+    case ARC:
+      return new ARCPolicy(firstFrame, numFrames);
+    default:
+      return new ClockPolicy(descs, firstFrame, numFrames);
+  }
+}
+
+const char* ReplacementPolicy::name(const ReplacementPolicyType type)
+{
+  switch (type)
+  {
+    case LRU_K:
+      return "LRU-2";
+    case TWO_Q:
+      return "2Q";
+    case ARC:
+      return "ARC";
+    default:
+      return "CLOCK";
+  }
+}
+
+// -----------------------------------------------------------------------------
+// ClockPolicy
+// -----------------------------------------------------------------------------
+
+ClockPolicy::ClockPolicy(BufDesc* descs, const FrameId firstFrame, const std::uint32_t numFrames)
+	: descs(descs), firstFrame(firstFrame), numFrames(numFrames), clockHand(numFrames - 1)
+{
+}
+
+void ClockPolicy::pageHit(const FrameId frame)
+{
+  // set the referenced bit
+  descs[frame].refbit = true;
+}
+
+void ClockPolicy::pageLoaded(const FrameId frame, const std::uint64_t key)
+{
+  // BufDesc::Set() sets the referenced bit
+}
+
+void ClockPolicy::pageDropped(const FrameId frame)
+{
+}
+
+bool ClockPolicy::chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame)
+{
+  for (std::uint32_t numScanned = 0; numScanned < 2*numFrames; numScanned++)	//Need to scn twice
+  {
+    // advance the clock
+    const FrameId frameNo = advanceClock();
+    BufDesc* desc = &descs[frameNo];
+
+    // is valid, check referenced bit
+    if (desc->valid && desc->refbit)
+    {
+      // has been referenced, clear the bit
+      desc->refbit = false;
+      continue;
+    }
+
+    // invalid, or hasn't been referenced: use it unless someone has it pinned
+    if (claim(frameNo))
+    {
+      frame = frameNo;
+      return true;
+    }
+  }
+  return false;
+}
+
+// -----------------------------------------------------------------------------
+// ListPolicy
+// -----------------------------------------------------------------------------
+
+ListPolicy::ListPolicy(const FrameId firstFrame, const std::uint32_t numFrames)
+	: firstFrame(firstFrame), numFrames(numFrames), isFree(numFrames, true)
+{
+  // hand out the frames in order
+  for (std::uint32_t i = numFrames; i > 0; i--)
+    freeFrames.push_back(firstFrame + i - 1);
+}
+
+bool ListPolicy::takeFreeFrame(const ClaimFunc& claim, FrameId& frame)
+{
+  for (std::size_t i = freeFrames.size(); i > 0; i--)
+  {
+    if (claim(freeFrames[i - 1]))
+    {
+      frame = freeFrames[i - 1];
+      freeFrames.erase(freeFrames.begin() + (i - 1));
+      isFree[frame - firstFrame] = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ListPolicy::addFreeFrame(const FrameId frame)
+{
+  if (isFree[frame - firstFrame])
+    return;
+  isFree[frame - firstFrame] = true;
+  freeFrames.push_back(frame);
+}
+
+// -----------------------------------------------------------------------------
+// LRUKPolicy
+// -----------------------------------------------------------------------------
+
+LRUKPolicy::LRUKPolicy(const FrameId firstFrame, const std::uint32_t numFrames)
+	: ListPolicy(firstFrame, numFrames), now(0), keys(numFrames, 0), histories(numFrames)
+{
+}
+
+std::pair<std::pair<std::uint64_t, std::uint64_t>, FrameId> LRUKPolicy::rank(const FrameId frame) const
+{
+  const History& history = histories[frame - firstFrame];
+  return std::make_pair(std::make_pair(history.times[K - 1], history.times[0]), frame);
+}
+
+void LRUKPolicy::reference(History& history)
+{
+  for (int i = K - 1; i > 0; i--)
+    history.times[i] = history.times[i - 1];
+  history.times[0] = ++now;
+}
+
+void LRUKPolicy::pageHit(const FrameId frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  order.erase(rank(frame));
+  reference(histories[frame - firstFrame]);
+  order.insert(rank(frame));
+}
+
+void LRUKPolicy::pageLoaded(const FrameId frame, const std::uint64_t key)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  History& history = histories[frame - firstFrame];
+  std::fill(history.times, history.times + K, 0);
+
+  // a page seen before picks up its old references
+  auto old = retained.find(key);
+  if (old != retained.end())
+  {
+    history = old->second.first;
+    retainedOrder.erase(old->second.second);
+    retained.erase(old);
+  }
+  reference(history);
+  keys[frame - firstFrame] = key;
+  order.insert(rank(frame));
+}
+
+void LRUKPolicy::pageDropped(const FrameId frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  order.erase(rank(frame));
+  addFreeFrame(frame);
+}
+
+bool LRUKPolicy::chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  if (takeFreeFrame(claim, frame))
+    return true;
+
+  for (auto it = order.begin(); it != order.end(); ++it)
+  {
+    if (!claim(it->second))
+      continue;
+    frame = it->second;
+    order.erase(it);
+
+    // remember the history of the evicted page, forgetting the oldest one if there are too many
+    const std::uint64_t victimKey = keys[frame - firstFrame];
+    retainedOrder.push_back(victimKey);
+    retained[victimKey] = std::make_pair(histories[frame - firstFrame], --retainedOrder.end());
+    if (retained.size() > numFrames)
+    {
+      retained.erase(retainedOrder.front());
+      retainedOrder.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+// -----------------------------------------------------------------------------
+// TwoQPolicy
+// -----------------------------------------------------------------------------
+
+TwoQPolicy::TwoQPolicy(const FrameId firstFrame, const std::uint32_t numFrames)
+	: ListPolicy(firstFrame, numFrames), kin(std::max<std::size_t>(1, numFrames / 4)),
+	  kout(std::max<std::size_t>(1, numFrames / 2)), keys(numFrames, 0), queues(numFrames, NONE),
+	  positions(numFrames)
+{
+}
+
+void TwoQPolicy::unlink(const FrameId frame)
+{
+  const std::size_t i = frame - firstFrame;
+  if (queues[i] == A1IN)
+    a1in.erase(positions[i]);
+  else if (queues[i] == AM)
+    am.erase(positions[i]);
+  queues[i] = NONE;
+}
+
+bool TwoQPolicy::claimFrom(std::list<FrameId>& queue, const ClaimFunc& claim, FrameId& frame)
+{
+  for (auto it = queue.rbegin(); it != queue.rend(); ++it)
+  {
+    if (!claim(*it))
+      continue;
+    frame = *it;
+
+    // pages leaving A1in are remembered in A1out
+    const std::size_t i = frame - firstFrame;
+    if (queues[i] == A1IN)
+    {
+      a1out.push_front(keys[i]);
+      a1outIndex[keys[i]] = a1out.begin();
+      if (a1out.size() > kout)
+      {
+        a1outIndex.erase(a1out.back());
+        a1out.pop_back();
+      }
+    }
+    unlink(frame);
+    return true;
+  }
+  return false;
+}
+
+void TwoQPolicy::pageHit(const FrameId frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  const std::size_t i = frame - firstFrame;
+
+  // hits in A1in are correlated references, left where they are
+  if (queues[i] == AM)
+    am.splice(am.begin(), am, positions[i]);
+}
+
+void TwoQPolicy::pageLoaded(const FrameId frame, const std::uint64_t key)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  const std::size_t i = frame - firstFrame;
+  keys[i] = key;
+
+  auto ghost = a1outIndex.find(key);
+  if (ghost != a1outIndex.end())
+  {
+    a1out.erase(ghost->second);
+    a1outIndex.erase(ghost);
+    am.push_front(frame);
+    queues[i] = AM;
+    positions[i] = am.begin();
+  }
+  else
+  {
+    a1in.push_front(frame);
+    queues[i] = A1IN;
+    positions[i] = a1in.begin();
+  }
+}
+
+void TwoQPolicy::pageDropped(const FrameId frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  unlink(frame);
+  addFreeFrame(frame);
+}
+
+bool TwoQPolicy::chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  if (takeFreeFrame(claim, frame))
+    return true;
+
+  if (a1in.size() > kin || am.empty())
+    return claimFrom(a1in, claim, frame) || claimFrom(am, claim, frame);
+  return claimFrom(am, claim, frame) || claimFrom(a1in, claim, frame);
+}
+
+// -----------------------------------------------------------------------------
+// ARCPolicy
+// -----------------------------------------------------------------------------
+
+ARCPolicy::ARCPolicy(const FrameId firstFrame, const std::uint32_t numFrames)
+	: ListPolicy(firstFrame, numFrames), p(0), keys(numFrames, 0), lists(numFrames, NONE),
+	  positions(numFrames)
+{
+}
+
+void ARCPolicy::unlink(const FrameId frame)
+{
+  const std::size_t i = frame - firstFrame;
+  if (lists[i] == T1)
+    t1.erase(positions[i]);
+  else if (lists[i] == T2)
+    t2.erase(positions[i]);
+  lists[i] = NONE;
+}
+
+bool ARCPolicy::claimFrom(const Where where, const ClaimFunc& claim, FrameId& frame)
+{
+  std::list<FrameId>& list = where == T1 ? t1 : t2;
+  std::list<std::uint64_t>& ghostList = where == T1 ? b1 : b2;
+  for (auto it = list.rbegin(); it != list.rend(); ++it)
+  {
+    if (!claim(*it))
+      continue;
+    frame = *it;
+    const std::uint64_t key = keys[frame - firstFrame];
+    ghostList.push_front(key);
+    ghosts[key] = std::make_pair(where, ghostList.begin());
+    unlink(frame);
+    return true;
+  }
+  return false;
+}
+
+void ARCPolicy::dropGhost(std::list<std::uint64_t>& ghostList)
+{
+  ghosts.erase(ghostList.back());
+  ghostList.pop_back();
+}
+
+void ARCPolicy::pageHit(const FrameId frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  const std::size_t i = frame - firstFrame;
+  if (lists[i] == NONE)
+    return;
+  std::list<FrameId>& from = lists[i] == T1 ? t1 : t2;
+  t2.splice(t2.begin(), from, positions[i]);
+  lists[i] = T2;
+}
+
+void ARCPolicy::pageLoaded(const FrameId frame, const std::uint64_t key)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  const std::size_t i = frame - firstFrame;
+  const double c = numFrames;
+  keys[i] = key;
+
+  auto ghost = ghosts.find(key);
+  if (ghost == ghosts.end())
+  {
+    t1.push_front(frame);
+    lists[i] = T1;
+    positions[i] = t1.begin();
+
+    // keep at most c pages in T1 and B1, and 2c in all four lists
+    while (t1.size() + b1.size() > numFrames && !b1.empty())
+      dropGhost(b1);
+    while (t1.size() + t2.size() + b1.size() + b2.size() > 2 * numFrames && !b2.empty())
+      dropGhost(b2);
+    return;
+  }
+
+  // a ghost hit: grow the side that would have kept the page
+  if (ghost->second.first == T1)
+  {
+    p = std::min(c, p + std::max(1.0, (double)b2.size() / b1.size()));
+    b1.erase(ghost->second.second);
+  }
+  else
+  {
+    p = std::max(0.0, p - std::max(1.0, (double)b1.size() / b2.size()));
+    b2.erase(ghost->second.second);
+  }
+  ghosts.erase(ghost);
+  t2.push_front(frame);
+  lists[i] = T2;
+  positions[i] = t2.begin();
+}
+
+void ARCPolicy::pageDropped(const FrameId frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  unlink(frame);
+  addFreeFrame(frame);
+}
+
+bool ARCPolicy::chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  if (takeFreeFrame(claim, frame))
+    return true;
+
+  // REPLACE of ARC: take from T1 if it is above its target size
+  auto ghost = ghosts.find(key);
+  const bool inB2 = ghost != ghosts.end() && ghost->second.first == T2;
+  if (!t1.empty() && (t1.size() > p || (inB2 && t1.size() == p)))
+    return claimFrom(T1, claim, frame) || claimFrom(T2, claim, frame);
+  return claimFrom(T2, claim, frame) || claimFrom(T1, claim, frame);
+}
+
+}
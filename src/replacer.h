@@ -0,0 +1,419 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "types.h"
+
+namespace badgerdb {
+
+class BufDesc;
+
+/**
+ * @brief Page replacement algorithms the buffer manager can be built with.
+ */
+enum ReplacementPolicyType
+{
+	CLOCK,
+	LRU_K,
+	TWO_Q,
+	ARC
+};
+
+/**
+ * @brief Decides which frame of a buffer pool shard is given to the next page read into it.
+ *
+ * The buffer manager reports every hit, every page loaded into a frame and every page dropped from a
+ * frame without replacement (flushFile(), disposePage(), failed reads). When it needs a frame it asks
+ * chooseVictim(), which offers candidates in the order of the algorithm to a claim function; the first
+ * frame claimed is taken out of the algorithm's lists and returned. Pages are identified by the
+ * 64-bit (file id, page number) key of the buffer hash table, so algorithms can remember pages that
+ * are no longer resident.
+ *
+ * A policy is called from many threads at once and does its own locking. It never does I/O: the
+ * victim is written back by the buffer manager after chooseVictim() returns.
+ */
+class ReplacementPolicy
+{
+ public:
+	/**
+	 * Function claiming a frame for the caller of chooseVictim(); false if the frame is pinned
+	 */
+	typedef std::function<bool(FrameId)> ClaimFunc;
+
+	/**
+	 * Destructor of ReplacementPolicy class
+	 */
+	virtual ~ReplacementPolicy() {}
+
+	/**
+	 * Returns a new policy of the given type for the frames firstFrame .. firstFrame+numFrames-1.
+	 *
+	 * @param type  	Replacement algorithm
+	 * @param descs 	Buffer descriptor table of the pool, indexed by frame number
+	 * @param firstFrame	First frame managed by the policy
+	 * @param numFrames	Number of frames managed by the policy
+	 */
+	static ReplacementPolicy* create(const ReplacementPolicyType type, BufDesc* descs,
+			const FrameId firstFrame, const std::uint32_t numFrames);
+
+	/**
+	 * Returns the name of a replacement algorithm, for reports.
+	 */
+	static const char* name(const ReplacementPolicyType type);
+
+	/**
+	 * The page in a pinned frame was referenced again.
+	 */
+	virtual void pageHit(const FrameId frame) = 0;
+
+	/**
+	 * A page was read or allocated into a frame returned by chooseVictim().
+	 *
+	 * @param frame 	Frame now holding the page
+	 * @param key   	Key of the page
+	 */
+	virtual void pageLoaded(const FrameId frame, const std::uint64_t key) = 0;
+
+	/**
+	 * The frame no longer holds a page and is free for any page. Called while the frame is claimed.
+	 */
+	virtual void pageDropped(const FrameId frame) = 0;
+
+	/**
+	 * Pick a frame for a page that is not in the pool and claim it.
+	 *
+	 * @param key   	Key of the page that will be loaded into the frame
+	 * @param claim 	Claims a candidate frame if nobody has it pinned
+	 * @param frame 	Set to the claimed frame if true is returned
+	 * @return  False if no frame could be claimed
+	 */
+	virtual bool chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame) = 0;
+};
+
+/**
+ * @brief Second chance clock over the reference bits of the buffer descriptors. Takes no lock.
+ */
+class ClockPolicy : public ReplacementPolicy
+{
+ private:
+	/**
+	 * Buffer descriptor table of the pool
+	 */
+	BufDesc* descs;
+
+	/**
+	 * First frame of the clock
+	 */
+	FrameId firstFrame;
+
+	/**
+	 * Number of frames of the clock
+	 */
+	std::uint32_t numFrames;
+
+	/**
+	 * Current position of the clock hand, relative to firstFrame; every sweeping thread advances it
+	 */
+	std::atomic<FrameId> clockHand;
+
+	/**
+	 * Advance the clock to its next frame
+	 *
+	 * @return  Frame the clock hand moved to
+	 */
+	FrameId advanceClock()
+	{
+		return firstFrame + (clockHand.fetch_add(1, std::memory_order_relaxed) + 1) % numFrames;
+	}
+
+ public:
+	ClockPolicy(BufDesc* descs, const FrameId firstFrame, const std::uint32_t numFrames);
+	void pageHit(const FrameId frame);
+	void pageLoaded(const FrameId frame, const std::uint64_t key);
+	void pageDropped(const FrameId frame);
+	bool chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame);
+};
+
+/**
+ * @brief Frames and ghost pages kept by the list based policies, each guarded by the policy's mutex.
+ */
+class ListPolicy : public ReplacementPolicy
+{
+ protected:
+	/**
+	 * First frame managed by the policy
+	 */
+	FrameId firstFrame;
+
+	/**
+	 * Number of frames managed by the policy
+	 */
+	std::uint32_t numFrames;
+
+	/**
+	 * Serializes all calls
+	 */
+	std::mutex latch;
+
+	/**
+	 * Frames holding no page
+	 */
+	std::vector<FrameId> freeFrames;
+
+	/**
+	 * True for the frames (relative to firstFrame) in freeFrames
+	 */
+	std::vector<bool> isFree;
+
+	/**
+	 * Offer the free frames to claim; false if none is left
+	 */
+	bool takeFreeFrame(const ClaimFunc& claim, FrameId& frame);
+
+	/**
+	 * Put a frame that left the policy's lists on the free list, unless it is there already
+	 */
+	void addFreeFrame(const FrameId frame);
+
+	ListPolicy(const FrameId firstFrame, const std::uint32_t numFrames);
+};
+
+/**
+ * @brief LRU-K (K = 2): evicts the page whose second most recent reference is oldest. Pages referenced
+ * once are evicted first, least recently used first, so a page touched by a single scan never pushes
+ * out a page referenced twice. Reference histories of evicted pages are retained for as many pages as
+ * there are frames.
+ */
+class LRUKPolicy : public ListPolicy
+{
+ private:
+	static const int K = 2;
+
+	/**
+	 * Times of the last K references, most recent first; 0 for none
+	 */
+	struct History
+	{
+		std::uint64_t times[K];
+	};
+
+	/**
+	 * Logical clock, advanced on every reference
+	 */
+	std::uint64_t now;
+
+	/**
+	 * Key of the page in each frame (relative to firstFrame)
+	 */
+	std::vector<std::uint64_t> keys;
+
+	/**
+	 * Reference history of the page in each frame
+	 */
+	std::vector<History> histories;
+
+	/**
+	 * Resident frames ordered by (K-th reference time, last reference time): the first is evicted first
+	 */
+	std::set<std::pair<std::pair<std::uint64_t, std::uint64_t>, FrameId> > order;
+
+	/**
+	 * Histories of evicted pages, and the position of their keys in retainedOrder
+	 */
+	std::unordered_map<std::uint64_t, std::pair<History, std::list<std::uint64_t>::iterator> > retained;
+
+	/**
+	 * Keys in retained, oldest first
+	 */
+	std::list<std::uint64_t> retainedOrder;
+
+	/**
+	 * Position of a frame in order
+	 */
+	std::pair<std::pair<std::uint64_t, std::uint64_t>, FrameId> rank(const FrameId frame) const;
+
+	/**
+	 * Add a reference at the current time to a history
+	 */
+	void reference(History& history);
+
+ public:
+	LRUKPolicy(const FrameId firstFrame, const std::uint32_t numFrames);
+	void pageHit(const FrameId frame);
+	void pageLoaded(const FrameId frame, const std::uint64_t key);
+	void pageDropped(const FrameId frame);
+	bool chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame);
+};
+
+/**
+ * @brief Full 2Q: new pages enter a FIFO (A1in) holding a quarter of the frames; pages referenced
+ * again after leaving it, while still remembered in the ghost queue A1out, go to an LRU list (Am).
+ * Scanned pages pass through A1in only.
+ */
+class TwoQPolicy : public ListPolicy
+{
+ private:
+	/**
+	 * Queue of each frame (relative to firstFrame)
+	 */
+	enum Queue { NONE, A1IN, AM };
+
+	/**
+	 * Target number of frames in A1in
+	 */
+	std::size_t kin;
+
+	/**
+	 * Number of keys remembered in A1out
+	 */
+	std::size_t kout;
+
+	/**
+	 * Resident FIFO, newest first
+	 */
+	std::list<FrameId> a1in;
+
+	/**
+	 * Resident LRU list, most recently used first
+	 */
+	std::list<FrameId> am;
+
+	/**
+	 * Keys of pages evicted from A1in, newest first
+	 */
+	std::list<std::uint64_t> a1out;
+
+	/**
+	 * Position of each key in a1out
+	 */
+	std::unordered_map<std::uint64_t, std::list<std::uint64_t>::iterator> a1outIndex;
+
+	/**
+	 * Key of the page in each frame
+	 */
+	std::vector<std::uint64_t> keys;
+
+	/**
+	 * Queue of each frame
+	 */
+	std::vector<Queue> queues;
+
+	/**
+	 * Position of each frame in its queue
+	 */
+	std::vector<std::list<FrameId>::iterator> positions;
+
+	/**
+	 * Take a frame out of its queue
+	 */
+	void unlink(const FrameId frame);
+
+	/**
+	 * Offer the frames of a queue to claim, oldest first
+	 */
+	bool claimFrom(std::list<FrameId>& queue, const ClaimFunc& claim, FrameId& frame);
+
+ public:
+	TwoQPolicy(const FrameId firstFrame, const std::uint32_t numFrames);
+	void pageHit(const FrameId frame);
+	void pageLoaded(const FrameId frame, const std::uint64_t key);
+	void pageDropped(const FrameId frame);
+	bool chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame);
+};
+
+/**
+ * @brief Adaptive Replacement Cache: resident pages referenced once (T1) and more than once (T2),
+ * and ghost lists of pages evicted from each (B1, B2). A hit in a ghost list moves the target size p of
+ * T1 towards the list that would have kept the page.
+ */
+class ARCPolicy : public ListPolicy
+{
+ private:
+	/**
+	 * List of each frame (relative to firstFrame)
+	 */
+	enum Where { NONE, T1, T2 };
+
+	/**
+	 * Target number of frames in T1
+	 */
+	double p;
+
+	/**
+	 * Resident pages referenced once, most recent first
+	 */
+	std::list<FrameId> t1;
+
+	/**
+	 * Resident pages referenced more than once, most recent first
+	 */
+	std::list<FrameId> t2;
+
+	/**
+	 * Keys of pages evicted from T1, most recent first
+	 */
+	std::list<std::uint64_t> b1;
+
+	/**
+	 * Keys of pages evicted from T2, most recent first
+	 */
+	std::list<std::uint64_t> b2;
+
+	/**
+	 * Ghost list (T1 for b1, T2 for b2) and position of each key in it
+	 */
+	std::unordered_map<std::uint64_t, std::pair<Where, std::list<std::uint64_t>::iterator> > ghosts;
+
+	/**
+	 * Key of the page in each frame
+	 */
+	std::vector<std::uint64_t> keys;
+
+	/**
+	 * List of each frame
+	 */
+	std::vector<Where> lists;
+
+	/**
+	 * Position of each frame in its list
+	 */
+	std::vector<std::list<FrameId>::iterator> positions;
+
+	/**
+	 * Take a frame out of its list
+	 */
+	void unlink(const FrameId frame);
+
+	/**
+	 * Offer the frames of a list to claim, least recently used first. The claimed frame's page is
+	 * remembered in the ghost list.
+	 */
+	bool claimFrom(const Where where, const ClaimFunc& claim, FrameId& frame);
+
+	/**
+	 * Forget the least recently used key of a ghost list
+	 */
+	void dropGhost(std::list<std::uint64_t>& ghostList);
+
+ public:
+	ARCPolicy(const FrameId firstFrame, const std::uint32_t numFrames);
+	void pageHit(const FrameId frame);
+	void pageLoaded(const FrameId frame, const std::uint64_t key);
+	void pageDropped(const FrameId frame);
+	bool chooseVictim(const std::uint64_t key, const ClaimFunc& claim, FrameId& frame);
+};
+
+}
@@ -0,0 +1,536 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include "string_node.h"
+
+namespace badgerdb {
+
+// -----------------------------------------------------------------------------
+// Helpers shared by both node formats
+// -----------------------------------------------------------------------------
+
+// Number of bytes between the slot array and the key suffixes.
+template <class Node>
+static int freeSpace(const Node& node)
+{
+	return node.heapStart - node.k * (int)sizeof(typename Node::Slot);
+}
+
+// Number of bytes taken by slots and key suffixes.
+template <class Node>
+static int usedSpace(const Node& node)
+{
+	return (int)sizeof(node.data) - freeSpace(node);
+}
+
+// Number of bytes entry i takes.
+template <class Node>
+static int entrySize(const Node& node, int i)
+{
+	return sizeof(typename Node::Slot) + node.slots()[i].length;
+}
+
+// Number of bytes an entry for key takes.
+template <class Node>
+static int entrySize(const Node& node, const StringKey& key)
+{
+	return sizeof(typename Node::Slot) + key.length() - node.prefixLen;
+}
+
+template <class Node>
+static StringKey keyAt(const Node& node, int i)
+{
+	const typename Node::Slot& slot = node.slots()[i];
+	StringKey key;
+	memset(key.data, 0, STRINGSIZE);
+	memcpy(key.data, node.prefix, node.prefixLen);
+	memcpy(key.data + node.prefixLen, node.data + slot.offset, slot.length);
+	return key;
+}
+
+// Position of the first key >= key, or of the first key > key if upper is set.
+template <class Node>
+static int search(const Node& node, const StringKey& key, const bool upper)
+{
+	// All keys share the node prefix, so it decides the answer for keys that do not.
+	const int len = key.length();
+	const int c = memcmp(key.data, node.prefix, std::min(len, (int)node.prefixLen));
+	if (c != 0)
+		return c < 0 ? 0 : node.k;
+	if (len < node.prefixLen)
+		return 0;
+
+	const char* rest = key.data + node.prefixLen;
+	const int restLen = len - node.prefixLen;
+	int lo = 0;
+	int count = node.k;
+	while (count > 0) {
+		const int half = count / 2;
+		const typename Node::Slot& slot = node.slots()[lo + half];
+		int cmp = memcmp(rest, node.data + slot.offset, std::min(restLen, (int)slot.length));
+		if (cmp == 0)
+			cmp = restLen - slot.length;
+		if (cmp > 0 || (upper && cmp == 0)) {
+			lo += half + 1;
+			count -= half + 1;
+		}
+		else
+			count = half;
+	}
+	return lo;
+}
+
+// Insert a slot at pos for a key suffix. The caller sets the slot value.
+template <class Node>
+static typename Node::Slot& insertSlot(Node& node, int pos, const char* suffix, int length)
+{
+	node.heapStart -= length;
+	memcpy(node.data + node.heapStart, suffix, length);
+	typename Node::Slot* slots = node.slots();
+	memmove(&slots[pos+1], &slots[pos], (node.k - pos) * sizeof(typename Node::Slot));
+	slots[pos].offset = node.heapStart;
+	slots[pos].length = length;
+	node.k++;
+	return slots[pos];
+}
+
+// Refill node with entries [begin, end) of from. The prefix of node must extend the prefix of from.
+template <class Node>
+static void copyEntries(Node& node, const Node& from, int begin, int end)
+{
+	const int skip = node.prefixLen - from.prefixLen;
+	node.k = 0;
+	node.heapStart = sizeof(node.data);
+	for (int i = begin; i < end; i++) {
+		const typename Node::Slot& entry = from.slots()[i];
+		typename Node::Slot& slot = insertSlot(node, node.k, from.data + entry.offset + skip, entry.length - skip);
+		const std::uint16_t offset = slot.offset;
+		const std::uint16_t length = slot.length;
+		slot = entry;
+		slot.offset = offset;
+		slot.length = length;
+	}
+}
+
+template <class Node>
+static void compressNode(Node& node, const StringKey* low, const StringKey* high)
+{
+	if (low == NULL || high == NULL)
+		return;
+
+	int len = 0;
+	const int maxLen = std::min(low->length(), high->length());
+	while (len < maxLen && low->data[len] == high->data[len])
+		len++;
+
+	// Keys are sorted, so checking the first and last one covers them all.
+	for (int e = 0; e < node.k && e < 2; e++) {
+		const typename Node::Slot& slot = node.slots()[e == 0 ? 0 : node.k - 1];
+		int i = node.prefixLen;
+		while (i < len && i - node.prefixLen < slot.length && node.data[slot.offset + i - node.prefixLen] == low->data[i])
+			i++;
+		len = i;
+	}
+	if (len <= node.prefixLen)
+		return;
+
+	const Node from = node;
+	memcpy(node.prefix, low->data, len);
+	node.prefixLen = len;
+	copyEntries(node, from, 0, from.k);
+}
+
+// Remove slot i and close the gap its suffix leaves in the key area.
+template <class Node>
+static void removeSlot(Node& node, int i)
+{
+	typename Node::Slot* slots = node.slots();
+	const int offset = slots[i].offset;
+	const int length = slots[i].length;
+	memmove(&slots[i], &slots[i+1], (node.k - i - 1) * sizeof(typename Node::Slot));
+	node.k--;
+	memmove(node.data + node.heapStart + length, node.data + node.heapStart, offset - node.heapStart);
+	for (int j = 0; j < node.k; j++) {
+		if (slots[j].offset < offset)
+			slots[j].offset += length;
+	}
+	node.heapStart += length;
+}
+
+// An entry taken out of a node: its whole key, and its slot for the value.
+template <class Node>
+struct Entry {
+	StringKey key;
+	typename Node::Slot slot;
+};
+
+template <class Node>
+static void takeEntries(const Node& node, std::vector< Entry<Node> >& entries)
+{
+	Entry<Node> entry;
+	for (int i = 0; i < node.k; i++) {
+		entry.key = keyAt(node, i);
+		entry.slot = node.slots()[i];
+		entries.push_back(entry);
+	}
+}
+
+static int commonPrefix(const char* a, const int aLen, const char* b, const int bLen)
+{
+	int len = 0;
+	while (len < aLen && len < bLen && a[len] == b[len])
+		len++;
+	return len;
+}
+
+// Bytes entry takes with the first prefixLen characters of its key left out.
+template <class Node>
+static int entrySize(const Entry<Node>& entry, const int prefixLen)
+{
+	return sizeof(typename Node::Slot) + entry.key.length() - prefixLen;
+}
+
+// Refill node with entries [begin, end), leaving out the first prefixLen characters of every key.
+// The prefix is taken from the first key.
+template <class Node>
+static void refill(Node& node, const std::vector< Entry<Node> >& entries, int begin, int end, const int prefixLen)
+{
+	memcpy(node.prefix, entries[begin].key.data, prefixLen);
+	node.prefixLen = prefixLen;
+	node.k = 0;
+	node.heapStart = sizeof(node.data);
+	for (int i = begin; i < end; i++) {
+		const StringKey& key = entries[i].key;
+		typename Node::Slot& slot = insertSlot(node, node.k, key.data + prefixLen, key.length() - prefixLen);
+		const std::uint16_t offset = slot.offset;
+		const std::uint16_t length = slot.length;
+		slot = entries[i].slot;
+		slot.offset = offset;
+		slot.length = length;
+	}
+}
+
+// Position m that splits entries into [0, m) and [m + gap, n) of nearly equal size, both fitting in a node,
+// with at least minLeft entries on the left and one on the right. Returns -1 if there is none.
+template <class Node>
+static int balancedSplit(const std::vector< Entry<Node> >& entries, const int prefixLen, const int gap, const int minLeft)
+{
+	const int n = entries.size();
+	const int capacity = sizeof(((Node*)0)->data);
+	int total = 0;
+	for (int i = 0; i < n; i++)
+		total += entrySize(entries[i], prefixLen);
+
+	int best = -1;
+	int bestDiff = 0;
+	int left = 0;
+	for (int m = 0; m + gap < n; m++) {
+		if (m >= minLeft) {
+			const int right = total - left - (gap ? entrySize(entries[m], prefixLen) : 0);
+			const int diff = std::abs(left - right);
+			if (left <= capacity && right <= capacity && (best < 0 || diff < bestDiff)) {
+				best = m;
+				bestDiff = diff;
+			}
+		}
+		left += entrySize(entries[m], prefixLen);
+	}
+	return best;
+}
+
+StringKey shortestSeparator(const StringKey& left, const StringKey& right)
+{
+	if (!(left < right))
+		return right;
+	int len = 0;
+	while (left.data[len] == right.data[len])
+		len++;
+	StringKey sep;
+	memset(sep.data, 0, STRINGSIZE);
+	memcpy(sep.data, right.data, len + 1);
+	return sep;
+}
+
+// -----------------------------------------------------------------------------
+// LeafNodeString
+// -----------------------------------------------------------------------------
+
+StringKey LeafNodeString::key(int i) const
+{
+	return keyAt(*this, i);
+}
+
+RecordId LeafNodeString::rid(int i) const
+{
+	return slots()[i].rid;
+}
+
+void LeafNodeString::copyRids(int i, int count, RecordId* out) const
+{
+	const Slot* s = slots() + i;
+	for (int j = 0; j < count; j++)
+		out[j] = s[j].rid;
+}
+
+int LeafNodeString::lowerBound(const StringKey& key) const
+{
+	return search(*this, key, false);
+}
+
+int LeafNodeString::upperBound(const StringKey& key) const
+{
+	return search(*this, key, true);
+}
+
+bool LeafNodeString::canInsert(const StringKey& key) const
+{
+	return entrySize(*this, key) <= freeSpace(*this);
+}
+
+bool LeafNodeString::canAppend(const StringKey& key, const double fillFactor) const
+{
+	const int size = entrySize(*this, key);
+	return size <= freeSpace(*this) && (k == 0 || usedSpace(*this) + size <= sizeof(data) * fillFactor);
+}
+
+void LeafNodeString::insert(int pos, const StringKey& key, RecordId rid)
+{
+	insertSlot(*this, pos, key.data + prefixLen, key.length() - prefixLen).rid = rid;
+}
+
+StringKey LeafNodeString::split(LeafNodeString& right)
+{
+	right.prefixLen = prefixLen;
+	memcpy(right.prefix, prefix, prefixLen);
+
+	const int half = usedSpace(*this) / 2;
+	int moved = 0;
+	int m = k;
+	while (m > 1 && moved < half) {
+		m--;
+		moved += entrySize(*this, m);
+	}
+	copyEntries(right, *this, m, k);
+	const LeafNodeString from = *this;
+	copyEntries(*this, from, 0, m);
+	return shortestSeparator(key(m-1), right.key(0));
+}
+
+void LeafNodeString::compress(const StringKey* low, const StringKey* high)
+{
+	compressNode(*this, low, high);
+}
+
+bool LeafNodeString::isUnderfull() const
+{
+	return usedSpace(*this) < (int)sizeof(data) / 2;
+}
+
+void LeafNodeString::remove(int i)
+{
+	removeSlot(*this, i);
+}
+
+bool LeafNodeString::merge(const LeafNodeString& right)
+{
+	std::vector< Entry<LeafNodeString> > entries;
+	takeEntries(*this, entries);
+	takeEntries(right, entries);
+	if (entries.empty())
+		return true;
+
+	const int p = commonPrefix(prefix, prefixLen, right.prefix, right.prefixLen);
+	int size = 0;
+	for (std::size_t i = 0; i < entries.size(); i++)
+		size += entrySize(entries[i], p);
+	if (size > (int)sizeof(data))
+		return false;
+	refill(*this, entries, 0, entries.size(), p);
+	return true;
+}
+
+bool LeafNodeString::redistribute(LeafNodeString& right, StringKey& sep)
+{
+	std::vector< Entry<LeafNodeString> > entries;
+	takeEntries(*this, entries);
+	takeEntries(right, entries);
+
+	const int p = commonPrefix(prefix, prefixLen, right.prefix, right.prefixLen);
+	const int m = balancedSplit(entries, p, 0, 1);
+	if (m < 0 || m == k)
+		return false;
+	refill(*this, entries, 0, m, p);
+	refill(right, entries, m, entries.size(), p);
+	sep = shortestSeparator(entries[m-1].key, entries[m].key);
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// NonLeafNodeString
+// -----------------------------------------------------------------------------
+
+StringKey NonLeafNodeString::key(int i) const
+{
+	return keyAt(*this, i);
+}
+
+PageId NonLeafNodeString::child(int i) const
+{
+	return i == 0 ? firstPageNo : slots()[i-1].pageNo;
+}
+
+int NonLeafNodeString::lowerBound(const StringKey& key) const
+{
+	return search(*this, key, false);
+}
+
+int NonLeafNodeString::upperBound(const StringKey& key) const
+{
+	return search(*this, key, true);
+}
+
+bool NonLeafNodeString::isFull() const
+{
+	return freeSpace(*this) < (int)sizeof(Slot) + STRINGSIZE - prefixLen;
+}
+
+bool NonLeafNodeString::canAppend(const StringKey& key, const double fillFactor) const
+{
+	const int size = entrySize(*this, key);
+	return size <= freeSpace(*this) && (k == 0 || usedSpace(*this) + size <= sizeof(data) * fillFactor);
+}
+
+void NonLeafNodeString::setFirstChild(PageId pageNo)
+{
+	firstPageNo = pageNo;
+}
+
+void NonLeafNodeString::insert(int pos, const StringKey& key, PageId pageNo)
+{
+	insertSlot(*this, pos, key.data + prefixLen, key.length() - prefixLen).pageNo = pageNo;
+}
+
+StringKey NonLeafNodeString::split(NonLeafNodeString& right)
+{
+	right.level = level;
+	right.prefixLen = prefixLen;
+	memcpy(right.prefix, prefix, prefixLen);
+
+	// Keys after m move right, key m moves up.
+	const int half = usedSpace(*this) / 2;
+	int moved = 0;
+	int m = k - 1;
+	while (m > 1 && moved < half) {
+		moved += entrySize(*this, m);
+		m--;
+	}
+	const StringKey middle = key(m);
+	right.setFirstChild(slots()[m].pageNo);
+	copyEntries(right, *this, m + 1, k);
+	const NonLeafNodeString from = *this;
+	copyEntries(*this, from, 0, m);
+	return middle;
+}
+
+void NonLeafNodeString::compress(const StringKey* low, const StringKey* high)
+{
+	compressNode(*this, low, high);
+}
+
+bool NonLeafNodeString::isUnderfull() const
+{
+	return usedSpace(*this) < (int)sizeof(data) / 2;
+}
+
+void NonLeafNodeString::remove(int i)
+{
+	removeSlot(*this, i);
+}
+
+bool NonLeafNodeString::canSetKey(int i, const StringKey& key) const
+{
+	const int len = key.length();
+	return len >= prefixLen && memcmp(key.data, prefix, prefixLen) == 0
+		&& len - prefixLen <= freeSpace(*this) + slots()[i].length;
+}
+
+void NonLeafNodeString::setKey(int i, const StringKey& key)
+{
+	const PageId pageNo = slots()[i].pageNo;
+	removeSlot(*this, i);
+	insert(i, key, pageNo);
+}
+
+// Entries of left, then sep with the first child of right, then the entries of right.
+static void takeEntries(const NonLeafNodeString& left, const StringKey& sep, const NonLeafNodeString& right,
+		std::vector< Entry<NonLeafNodeString> >& entries)
+{
+	takeEntries(left, entries);
+	Entry<NonLeafNodeString> middle;
+	middle.key = sep;
+	middle.slot.pageNo = right.firstPageNo;
+	entries.push_back(middle);
+	takeEntries(right, entries);
+}
+
+// Prefix shared by left, right and the separator between them.
+static int sharedPrefix(const NonLeafNodeString& left, const StringKey& sep, const NonLeafNodeString& right)
+{
+	const int p = commonPrefix(left.prefix, left.prefixLen, right.prefix, right.prefixLen);
+	return commonPrefix(left.prefix, p, sep.data, sep.length());
+}
+
+bool NonLeafNodeString::merge(const StringKey& sep, const NonLeafNodeString& right)
+{
+	std::vector< Entry<NonLeafNodeString> > entries;
+	takeEntries(*this, sep, right, entries);
+
+	const int p = sharedPrefix(*this, sep, right);
+	int size = 0;
+	for (std::size_t i = 0; i < entries.size(); i++)
+		size += entrySize(entries[i], p);
+	if (size > (int)sizeof(data))
+		return false;
+	refill(*this, entries, 0, entries.size(), p);
+	return true;
+}
+
+bool NonLeafNodeString::redistribute(StringKey& sep, NonLeafNodeString& right)
+{
+	std::vector< Entry<NonLeafNodeString> > entries;
+	takeEntries(*this, sep, right, entries);
+
+	// Key m goes up to the parent.
+	const int p = sharedPrefix(*this, sep, right);
+	const int m = balancedSplit(entries, p, 1, 0);
+	if (m < 0 || m == k)
+		return false;
+	const Entry<NonLeafNodeString> middle = entries[m];
+	if (m > 0)
+		refill(*this, entries, 0, m, p);
+	else {
+		prefixLen = p;
+		k = 0;
+		heapStart = sizeof(data);
+	}
+	right.setFirstChild(middle.slot.pageNo);
+	if (m + 1 < (int)entries.size())
+		refill(right, entries, m + 1, entries.size(), p);
+	else {
+		memcpy(right.prefix, middle.key.data, p);
+		right.prefixLen = p;
+		right.k = 0;
+		right.heapStart = sizeof(right.data);
+	}
+	sep = middle.key;
+	return true;
+}
+
+}
@@ -0,0 +1,412 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include "string.h"
+#include "types.h"
+#include "page.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Size of STRING keys in bytes. Longer strings are truncated when inserted or searched.
+ */
+const int STRINGSIZE = 64;
+
+/**
+ * @brief Fixed-width STRING key. Holds the string zero padded to STRINGSIZE bytes, so two keys are
+ * compared (and copied) as plain byte arrays.
+ */
+struct StringKey {
+  /**
+   * Characters of the key, zero padded.
+   */
+	char data[STRINGSIZE];
+
+  /**
+   * Set the key from a string of up to STRINGSIZE characters.
+   */
+	void set(const char* str)
+	{
+		strncpy(data, str, STRINGSIZE);
+	}
+
+  /**
+   * Number of characters in the key.
+   */
+	int length() const
+	{
+		return strnlen(data, STRINGSIZE);
+	}
+
+	bool operator<(const StringKey& rhs) const { return memcmp(data, rhs.data, STRINGSIZE) < 0; }
+	bool operator>(const StringKey& rhs) const { return memcmp(data, rhs.data, STRINGSIZE) > 0; }
+	bool operator<=(const StringKey& rhs) const { return memcmp(data, rhs.data, STRINGSIZE) <= 0; }
+	bool operator>=(const StringKey& rhs) const { return memcmp(data, rhs.data, STRINGSIZE) >= 0; }
+	bool operator==(const StringKey& rhs) const { return memcmp(data, rhs.data, STRINGSIZE) == 0; }
+	bool operator!=(const StringKey& rhs) const { return memcmp(data, rhs.data, STRINGSIZE) != 0; }
+};
+
+/**
+ * @brief Print the characters of a STRING key.
+ */
+inline std::ostream& operator<<(std::ostream& os, const StringKey& key)
+{
+	return os << std::string(key.data, key.length());
+}
+
+/**
+ * Returns the shortest key s with left < s <= right, made of the first characters of right. This is the
+ * separator placed between two nodes when the last key of the left one is left and the first key of the
+ * right one is right. If left == right no such key exists and right itself is returned.
+ *
+ * @param left   Largest key on the left side
+ * @param right  Smallest key on the right side
+ * @return  Separator key
+ */
+StringKey shortestSeparator(const StringKey& left, const StringKey& right);
+
+/**
+ * @brief Slotted B+Tree leaf for STRING keys.
+ *
+ * Only the characters a key actually has are stored, and the prefix shared by every key that can be
+ * routed to the node (the common prefix of the separators around it in the parent) is stored once in
+ * prefix and left out of each key. The slot array grows from the front of data and the key suffixes
+ * grow from the back. Slots are kept in key order, so the node is binary searched like a fixed node.
+ */
+struct LeafNodeString {
+  /**
+   * Entry of the slot array.
+   */
+	struct Slot {
+    /**
+     * Record of the entry.
+     */
+		RecordId rid;
+
+    /**
+     * Position of the key suffix in data.
+     */
+		std::uint16_t offset;
+
+    /**
+     * Length of the key suffix.
+     */
+		std::uint16_t length;
+	};
+
+  /**
+   * cout of the key stored.
+   */
+	int k;
+
+  /**
+   * Page number of the leaf on the right side.
+	 * This linking of leaves allows to easily move from one leaf to the next leaf during index scan.
+   */
+	PageId rightSibPageNo;
+
+  /**
+   * Length of the prefix left out of every key.
+   */
+	std::uint16_t prefixLen;
+
+  /**
+   * Position in data of the first byte of key suffixes. Suffixes fill data from here to the end.
+   */
+	std::uint16_t heapStart;
+
+  /**
+   * Prefix left out of every key.
+   */
+	char prefix[STRINGSIZE];
+
+  /**
+   * Separator left of the right sibling: no key of the leaf is above it.
+   */
+	StringKey highKey;
+
+  /**
+   * Slot array followed by free space and key suffixes.
+   */
+	char data[Page::SIZE - sizeof(int) - sizeof(PageId) - 2*sizeof(std::uint16_t) - 2*STRINGSIZE];
+
+  LeafNodeString(): k(0), rightSibPageNo(Page::INVALID_NUMBER), prefixLen(0), heapStart(sizeof(data)), highKey() {};
+
+  /**
+   * Returns true if key is above the high key, so a split has moved it to the right sibling.
+   */
+	bool pastHighKey(const StringKey& key) const { return rightSibPageNo != Page::INVALID_NUMBER && highKey < key; }
+
+  /**
+   * Returns the key of entry i.
+   */
+	StringKey key(int i) const;
+
+  /**
+   * Returns the record of entry i.
+   */
+	RecordId rid(int i) const;
+
+  /**
+   * Copy the records of the count entries from entry i on to out.
+   */
+	void copyRids(int i, int count, RecordId* out) const;
+
+  /**
+   * Returns the position of the first key >= key.
+   */
+	int lowerBound(const StringKey& key) const;
+
+  /**
+   * Returns the position of the first key > key.
+   */
+	int upperBound(const StringKey& key) const;
+
+  /**
+   * Returns true if there is room to insert key.
+   */
+	bool canInsert(const StringKey& key) const;
+
+  /**
+   * Returns true if a bulk load can append key without filling the node past fillFactor.
+   */
+	bool canAppend(const StringKey& key, const double fillFactor) const;
+
+  /**
+   * Insert key at position pos. There must be room for it (see canInsert()).
+   */
+	void insert(int pos, const StringKey& key, RecordId rid);
+
+  /**
+   * Move the upper half of the entries, by size, to the empty leaf right.
+   *
+   * @return  Separator between the two halves
+   */
+	StringKey split(LeafNodeString& right);
+
+  /**
+   * Leave out the prefix shared by every key in [low, high], the key range the parent routes to this node.
+   * A NULL bound is unknown and the current prefix is kept.
+   */
+	void compress(const StringKey* low, const StringKey* high);
+
+  /**
+   * Returns true if less than half of data is used.
+   */
+	bool isUnderfull() const;
+
+  /**
+   * Remove entry i.
+   */
+	void remove(int i);
+
+  /**
+   * Append all entries of the right sibling right, if they fit. The prefix becomes the one both nodes
+   * share. Sibling links are left to the caller.
+   *
+   * @return  False, with nothing changed, if they do not fit
+   */
+	bool merge(const LeafNodeString& right);
+
+  /**
+   * Even out the entries of this leaf and its right sibling right, by size. Both get the prefix the
+   * two nodes share.
+   *
+   * @param sep  New separator between the two leaves is returned in this
+   * @return  False if nothing moved
+   */
+	bool redistribute(LeafNodeString& right, StringKey& sep);
+
+  /**
+   * Slot array.
+   */
+	Slot* slots() { return reinterpret_cast<Slot*>(data); }
+	const Slot* slots() const { return reinterpret_cast<const Slot*>(data); }
+};
+
+/**
+ * @brief Slotted B+Tree non-leaf for STRING keys. Stored like LeafNodeString; separator keys are
+ * the shortest prefixes that tell the two sides apart (see shortestSeparator()).
+ */
+struct NonLeafNodeString {
+  /**
+   * Entry of the slot array.
+   */
+	struct Slot {
+    /**
+     * Child page right of the key.
+     */
+		PageId pageNo;
+
+    /**
+     * Position of the key suffix in data.
+     */
+		std::uint16_t offset;
+
+    /**
+     * Length of the key suffix.
+     */
+		std::uint16_t length;
+	};
+
+  /**
+   * Level of the node in the tree.
+   */
+	int level;
+
+  /**
+   * cout of the key stored.
+   */
+	int k;
+
+  /**
+   * Left-most child page.
+   */
+	PageId firstPageNo;
+
+  /**
+   * Page number of the node on the right side at the same level, or Page::INVALID_NUMBER for the right-most one.
+   */
+	PageId rightSibPageNo;
+
+  /**
+   * Length of the prefix left out of every key.
+   */
+	std::uint16_t prefixLen;
+
+  /**
+   * Position in data of the first byte of key suffixes. Suffixes fill data from here to the end.
+   */
+	std::uint16_t heapStart;
+
+  /**
+   * Prefix left out of every key.
+   */
+	char prefix[STRINGSIZE];
+
+  /**
+   * Separator left of the right sibling: no key routed to this node is above it.
+   */
+	StringKey highKey;
+
+  /**
+   * Slot array followed by free space and key suffixes.
+   */
+	char data[Page::SIZE - 2*sizeof(int) - 2*sizeof(PageId) - 2*sizeof(std::uint16_t) - 2*STRINGSIZE];
+
+  NonLeafNodeString(): level(0), k(0), firstPageNo(Page::INVALID_NUMBER), rightSibPageNo(Page::INVALID_NUMBER),
+    prefixLen(0), heapStart(sizeof(data)), highKey() {};
+
+  /**
+   * Returns separator key i.
+   */
+	StringKey key(int i) const;
+
+  /**
+   * Returns child page i, in [0, k].
+   */
+	PageId child(int i) const;
+
+  /**
+   * Returns true if key is above the high key, so a split has moved it to the right sibling.
+   */
+	bool pastHighKey(const StringKey& key) const { return rightSibPageNo != Page::INVALID_NUMBER && highKey < key; }
+
+  /**
+   * Returns the position of the first key >= key.
+   */
+	int lowerBound(const StringKey& key) const;
+
+  /**
+   * Returns the position of the first key > key.
+   */
+	int upperBound(const StringKey& key) const;
+
+  /**
+   * Returns true if a separator of any length may not fit.
+   */
+	bool isFull() const;
+
+  /**
+   * Returns true if a bulk load can append key without filling the node past fillFactor.
+   */
+	bool canAppend(const StringKey& key, const double fillFactor) const;
+
+  /**
+   * Set the left-most child page.
+   */
+	void setFirstChild(PageId pageNo);
+
+  /**
+   * Insert key at position pos, with child page pageNo on its right.
+   */
+	void insert(int pos, const StringKey& key, PageId pageNo);
+
+  /**
+   * Move the keys above the middle one, by size, and their children to the empty node right.
+   *
+   * @return  The middle key, which is removed and goes up to the parent
+   */
+	StringKey split(NonLeafNodeString& right);
+
+  /**
+   * Leave out the prefix shared by every key in [low, high], the key range the parent routes to this node.
+   * A NULL bound is unknown and the current prefix is kept.
+   */
+	void compress(const StringKey* low, const StringKey* high);
+
+  /**
+   * Returns true if less than half of data is used.
+   */
+	bool isUnderfull() const;
+
+  /**
+   * Remove key i and child page i + 1.
+   */
+	void remove(int i);
+
+  /**
+   * Returns true if key i can be replaced by key.
+   */
+	bool canSetKey(int i, const StringKey& key) const;
+
+  /**
+   * Replace key i by key. There must be room for it (see canSetKey()).
+   */
+	void setKey(int i, const StringKey& key);
+
+  /**
+   * Append the separator sep and all keys and children of the right sibling right, if they fit.
+   * The prefix becomes the one both nodes share.
+   *
+   * @return  False, with nothing changed, if they do not fit
+   */
+	bool merge(const StringKey& sep, const NonLeafNodeString& right);
+
+  /**
+   * Even out the keys of this node and its right sibling right, by size, rotating them through the
+   * separator sep of the parent. Both get the prefix the two nodes share.
+   *
+   * @return  False if nothing moved
+   */
+	bool redistribute(StringKey& sep, NonLeafNodeString& right);
+
+  /**
+   * Slot array.
+   */
+	Slot* slots() { return reinterpret_cast<Slot*>(data); }
+	const Slot* slots() const { return reinterpret_cast<const Slot*>(data); }
+};
+
+static_assert(sizeof(LeafNodeString) <= Page::SIZE && sizeof(NonLeafNodeString) <= Page::SIZE,
+              "STRING nodes must fit in a page.");
+
+}